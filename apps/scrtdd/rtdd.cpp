@@ -16,7 +16,9 @@
  ***************************************************************************/
 
 #include "rtdd.h"
+#include "bincatalog.h"
 #include "csvreader.h"
+#include "nllttt.h"
 #include "rtddmsg.h"
 
 #include <seiscomp3/logging/channel.h>
@@ -243,6 +245,9 @@ RTDD::Config::Config()
   cacheAllWaveforms    = false;
   debugWaveforms       = false;
 
+  nllGridPoolMaxGrids    = 1000;
+  nllGridPoolMaxMappedMB = 0;
+
   loadProfileWf   = false;
   forceProcessing = false;
   testMode        = false;
@@ -284,13 +289,17 @@ RTDD::RTDD(int argc, char **argv) : Application(argc, argv)
 
   NEW_OPT(_config.profileTimeAlive, "performance.profileTimeAlive");
   NEW_OPT(_config.cacheWaveforms, "performance.cacheWaveforms");
+  NEW_OPT(_config.nllGridPoolMaxGrids, "performance.nllGridPool.maxGrids");
+  NEW_OPT(_config.nllGridPoolMaxMappedMB,
+          "performance.nllGridPool.maxMappedMB");
 
   NEW_OPT_CLI(
       _config.relocateCatalog, "Mode", "reloc-catalog",
       "Relocate the catalog passed as argument in multi-event mode. The "
-      "input can be a single file (containing seiscomp origin ids) or a file "
-      "triplet (station.csv,event.csv,phase.csv). For events stored "
-      "in a XML files add the --ep option. Use in combination with --profile",
+      "input can be a single file (containing seiscomp origin ids or a binary "
+      "catalog) or a file triplet (station.csv,event.csv,phase.csv). For "
+      "events stored in a XML files add the --ep option. Use in combination "
+      "with --profile",
       true);
   NEW_OPT_CLI(
       _config.originIDs, "Mode", "origin-id,O",
@@ -310,8 +319,8 @@ RTDD::RTDD(int argc, char **argv) : Application(argc, argv)
       _config.evalXCorr, "Mode", "eval-xcorr",
       "Compute cross-correlation statistics fon the catalog passed as "
       "argument. The input can be a single file (containing seiscomp origin "
-      "ids) or a file triplet (station.csv,event.csv,phase.csv). Use in "
-      "combination with --profile",
+      "ids or a binary catalog) or a file triplet "
+      "(station.csv,event.csv,phase.csv). Use in combination with --profile",
       true);
   NEW_OPT_CLI(_config.loadProfileWf, "Mode", "load-profile-wf",
               "Load catalog waveforms from the configured recordstream and "
@@ -331,6 +340,19 @@ RTDD::RTDD(int argc, char **argv) : Application(argc, argv)
               "(station1.csv,event1.csv,phase1.csv,station2.csv,event2.csv,"
               "phase2.csv,...) passed as arguments.",
               true);
+  NEW_OPT_CLI(_config.convertCatalog, "Catalog", "convert-catalog",
+              "Convert the catalog file triplet (station.csv,event.csv,"
+              "phase.csv) passed as argument into a binary catalog file or, "
+              "viceversa, a binary catalog file into a file triplet. See "
+              "--convert-catalog-output.",
+              true);
+  NEW_OPT_CLI(_config.convertCatalogOutput, "Catalog",
+              "convert-catalog-output",
+              "Output path prefix of --convert-catalog (e.g. 'dir/new-'): "
+              "the files written are prefixcatalog.bin or prefixstation.csv, "
+              "prefixevent.csv and prefixphase.csv. Existing files are not "
+              "overwritten.",
+              true);
   NEW_OPT_CLI(_config.forceProfile, "ModeOptions", "profile",
               "To be used in combination with other options: select the "
               "profile configuration to use",
@@ -394,7 +416,8 @@ bool RTDD::validateParameters()
 
   // disable messaging (offline mode) with certain command line options
   if (!_config.eventXML.empty() || !_config.dumpCatalog.empty() ||
-      !_config.mergeCatalogs.empty() || !_config.evalXCorr.empty() ||
+      !_config.mergeCatalogs.empty() || !_config.convertCatalog.empty() ||
+      !_config.evalXCorr.empty() ||
       !_config.relocateCatalog.empty() || _config.loadProfileWf ||
       (!_config.originIDs.empty() && _config.testMode))
   {
@@ -810,6 +833,46 @@ bool RTDD::validateParameters()
       prof->ddCfg.wfFilter.resampleFreq = 400;
     }
 
+    prefix = string("profile.") + prof->name +
+             ".crossCorrelation.waveformStripCache.";
+    try
+    {
+      prof->ddCfg.wfStrip.blockLen = configGetDouble(prefix + "blockLength");
+    }
+    catch (...)
+    {
+      prof->ddCfg.wfStrip.blockLen = 0;
+    }
+    try
+    {
+      prof->ddCfg.wfStrip.maxBlocks =
+          std::max(configGetInt(prefix + "maxBlocks"), 0);
+    }
+    catch (...)
+    {
+      prof->ddCfg.wfStrip.maxBlocks = 500;
+    }
+
+    prefix = string("profile.") + prof->name + ".crossCorrelation.";
+    try
+    {
+      prof->ddCfg.wfCompactCache =
+          configGetBool(prefix + "compactWaveformCache");
+    }
+    catch (...)
+    {
+      prof->ddCfg.wfCompactCache = false;
+    }
+    try
+    {
+      prof->ddCfg.wfExclusion.unavailableExpiry =
+          configGetDouble(prefix + "unavailableWaveformExpiry");
+    }
+    catch (...)
+    {
+      prof->ddCfg.wfExclusion.unavailableExpiry = 86400;
+    }
+
     prefix = string("profile.") + prof->name + ".crossCorrelation.snr.";
     try
     {
@@ -872,6 +935,15 @@ bool RTDD::validateParameters()
       prof->ddCfg.ttt.model = "iasp91";
     }
     try
+    {
+      prof->ddCfg.ttt.lookupTable =
+          configGetBool(prefix + "travelTimeTable.lookupTable");
+    }
+    catch (...)
+    {
+      prof->ddCfg.ttt.lookupTable = false;
+    }
+    try
     {
       prof->solverCfg.type = configGetString(prefix + "solverType");
     }
@@ -960,6 +1032,24 @@ bool RTDD::validateParameters()
     {
       prof->solverCfg.xcorrObsWeight = 1.0;
     }
+    try
+    {
+      prof->solverCfg.ttMemoMaxMovement =
+          configGetDouble(prefix + "travelTimeMemoization.maxMovement");
+    }
+    catch (...)
+    {
+      prof->solverCfg.ttMemoMaxMovement = 0;
+    }
+    try
+    {
+      prof->solverCfg.ttMemoFirstOrderCorrection =
+          configGetBool(prefix + "travelTimeMemoization.firstOrderCorrection");
+    }
+    catch (...)
+    {
+      prof->solverCfg.ttMemoFirstOrderCorrection = false;
+    }
 
     prof->ddCfg.recordStreamURL = recordStreamURL();
 
@@ -1026,6 +1116,11 @@ bool RTDD::init()
   _inputOrgs  = addInputObjectLog("origin");
   _outputOrgs = addOutputObjectLog("origin", primaryMessagingGroup());
 
+  // NLL grids are shared by all profiles and kept loaded across relocations
+  HDD::NLL::GridPool::instance().setLimits(
+      std::max(_config.nllGridPoolMaxGrids, 0),
+      size_t(std::max(_config.nllGridPoolMaxMappedMB, 0)) * 1024 * 1024);
+
   _cache.setTimeSpan(Core::TimeSpan(_config.fExpiry * 3600.));
   _cache.setDatabaseArchive(query());
 
@@ -1148,6 +1243,63 @@ bool RTDD::run()
     return true;
   }
 
+  // convert catalog between file triplet and binary format and exit
+  if (!_config.convertCatalog.empty())
+  {
+    std::vector<std::string> tokens;
+    boost::split(tokens, _config.convertCatalog, boost::is_any_of(","),
+                 boost::token_compress_on);
+
+    const bool toBinary = tokens.size() == 3;
+    if (!toBinary &&
+        !(tokens.size() == 1 && HDD::BinaryCatalog::isBinaryCatalog(tokens[0])))
+    {
+      SEISCOMP_ERROR("--convert-catalog accepts a catalog file triplet or a "
+                     "binary catalog file only");
+      return false;
+    }
+
+    if (_config.convertCatalogOutput.empty())
+    {
+      SEISCOMP_ERROR("--convert-catalog requires --convert-catalog-output");
+      return false;
+    }
+    const string &prefix = _config.convertCatalogOutput;
+    std::vector<std::string> outFiles;
+    if (toBinary)
+      outFiles = {prefix + "catalog.bin"};
+    else
+      outFiles = {prefix + "event.csv", prefix + "phase.csv",
+                  prefix + "station.csv"};
+    for (const string &file : outFiles)
+    {
+      if (Util::fileExists(file))
+      {
+        SEISCOMP_ERROR("Output file %s already exists", file.c_str());
+        return false;
+      }
+    }
+
+    if (toBinary)
+    {
+      SEISCOMP_INFO("Reading %s, %s, %s", tokens[0].c_str(),
+                    tokens[1].c_str(), tokens[2].c_str());
+      HDD::CatalogPtr cat =
+          new HDD::Catalog(tokens[0], tokens[1], tokens[2], true);
+      cat->writeToFile(outFiles[0]);
+      SEISCOMP_INFO("Wrote file %s", outFiles[0].c_str());
+    }
+    else
+    {
+      SEISCOMP_INFO("Reading %s", tokens[0].c_str());
+      HDD::CatalogPtr cat = new HDD::Catalog(tokens[0], true);
+      cat->writeToFile(outFiles[0], outFiles[1], outFiles[2]);
+      SEISCOMP_INFO("Wrote files %s, %s, %s", outFiles[0].c_str(),
+                    outFiles[1].c_str(), outFiles[2].c_str());
+    }
+    return true;
+  }
+
   // relocate full catalog and exit
   if (!_config.relocateCatalog.empty())
   {
@@ -1975,7 +2127,7 @@ void RTDD::convertOrigin(
   {
     const HDD::Catalog::Phase &phase = it->second;
     bool phaseUsed =
-        phase.relocInfo.isRelocated && phase.relocInfo.finalWeight != 0;
+        phase.relocInfo->isRelocated && phase.relocInfo->finalWeight != 0;
 
     // drop phases discovered via cross-correlation if those phases were not
     // used for the relocations
@@ -2034,11 +2186,11 @@ void RTDD::convertOrigin(
       newOrg->add(newArr);
     }
 
-    newArr->setWeight(phase.relocInfo.isRelocated ? phase.relocInfo.finalWeight
-                                                  : 0.);
+    newArr->setWeight(
+        phase.relocInfo->isRelocated ? phase.relocInfo->finalWeight : 0.);
     newArr->setTimeUsed(phaseUsed);
     newArr->setTimeResidual(
-        phase.relocInfo.isRelocated ? phase.relocInfo.finalResidual : 0.);
+        phase.relocInfo->isRelocated ? phase.relocInfo->finalResidual : 0.);
 
     auto search = relocatedOrg->getStations().find(phase.stationId);
     if (search == relocatedOrg->getStations().end())
@@ -2113,7 +2265,11 @@ RTDD::getCatalog(const std::string &catalogPath,
 
   try
   {
-    if (tokens.size() == 1) // single file containing origin ids
+    if (tokens.size() == 1 && HDD::BinaryCatalog::isBinaryCatalog(tokens[0]))
+    {
+      return new HDD::Catalog(tokens[0], true);
+    }
+    else if (tokens.size() == 1) // single file containing origin ids
     {
       CatalogDataSrc dataSrc(query(), &_cache, _eventParameters.get());
       HDD::ScCatalog *cat = new HDD::ScCatalog();
@@ -2388,6 +2544,11 @@ void RTDD::Profile::load(DatabaseQuery *query,
     {
       ddbgc = alternativeCatalog;
     }
+    else if (!eventIDFile.empty() &&
+             HDD::BinaryCatalog::isBinaryCatalog(eventIDFile))
+    {
+      ddbgc = new HDD::Catalog(eventIDFile);
+    }
     else if (!eventIDFile.empty()) // catalog is a list of origin ids
     {
       CatalogDataSrc dataSrc(query, cache, eventParameters);
@@ -2409,6 +2570,12 @@ void RTDD::Profile::load(DatabaseQuery *query,
     if (preloadData)
     {
       hypodd->preloadWaveforms();
+      hypodd->precomputeFixedObservationParams();
+    }
+    else
+    {
+      // reuse the values of a previous run if still valid
+      hypodd->loadFixedObservationParams();
     }
   }
   catch (exception &e)
@@ -2464,13 +2631,10 @@ HDD::CatalogPtr RTDD::Profile::relocateSingleEvent(DataModel::Origin *org)
   else
     hypodd->setUseArtificialPhases(this->useTheoreticalAuto);
 
-  HDD::CatalogPtr rel = hypodd->relocateSingleEvent(
-      orgToRelocate, singleEventClustering, singleEventClustering, solverCfg);
-
-  hypodd
-      ->unloadTTT(); // free memory and file descriptors (mostly for NLL grids)
-
-  return rel;
+  // NLL grids are not unloaded here: they are kept in the process-wide
+  // grid pool, bounded by performance.nllGridPool settings
+  return hypodd->relocateSingleEvent(orgToRelocate, singleEventClustering,
+                                     singleEventClustering, solverCfg);
 }
 
 HDD::CatalogPtr RTDD::Profile::relocateCatalog()
@@ -145,6 +145,8 @@ private:
     bool allowManualOrigin;
     int profileTimeAlive; // seconds
     bool cacheWaveforms;
+    int nllGridPoolMaxGrids;
+    int nllGridPoolMaxMappedMB;
     bool cacheAllWaveforms;
     bool debugWaveforms;
 
@@ -159,6 +161,8 @@ private:
     std::string relocateCatalog;
     std::string dumpCatalog;
     std::string mergeCatalogs;
+    std::string convertCatalog;
+    std::string convertCatalogOutput;
     std::string evalXCorr;
     std::string reloadProfileMsg;
     bool loadProfileWf;
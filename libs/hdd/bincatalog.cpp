@@ -0,0 +1,581 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU LESSER GENERAL PUBLIC LICENSE as          *
+ * published by the Free Software Foundation, either version 3 of the      *
+ * License, or (at your option) any later version.                         *
+ *                                                                         *
+ * This software is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/
+
+#include "bincatalog.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <seiscomp3/core/strings.h>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using Seiscomp::Core::stringify;
+
+namespace {
+
+using Seiscomp::HDD::Catalog;
+using Seiscomp::HDD::Symbol;
+
+const char MAGIC[8]            = {'H', 'D', 'D', 'C', 'A', 'T', 'B', '\0'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+/*
+ * On-disk records. Fields are sorted by size so that there is no implicit
+ * padding and the layout is the same for every compiler
+ */
+struct Header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t numStrings;
+  uint32_t numStations;
+  uint32_t numEvents;
+  uint32_t numPhases;
+  uint64_t stringDataSize;
+};
+static_assert(sizeof(Header) == 40, "Unexpected binary catalog header size");
+
+struct StationRecord
+{
+  double latitude;
+  double longitude;
+  double elevation;
+  uint32_t id;
+  uint32_t networkCode;
+  uint32_t stationCode;
+  uint32_t locationCode;
+};
+static_assert(sizeof(StationRecord) == 40,
+              "Unexpected binary catalog station record size");
+
+struct EventRecord
+{
+  int64_t timeSeconds;
+  double latitude;
+  double longitude;
+  double depth;
+  double magnitude;
+  double rms;
+  double startRms;
+  double locChange;
+  double depthChange;
+  double timeChange;
+  double meanDistToCentroid;
+  double meanDepthDistToCentroid;
+  double eventDistToCentroid;
+  double eventDepthDistToCentroid;
+  double stationDistMedian;
+  double stationDistMin;
+  double stationDistMax;
+  double startResidualMedian;
+  double startResidualMAD;
+  double finalResidualMedian;
+  double finalResidualMAD;
+  uint32_t id;
+  uint32_t timeMicroseconds;
+  uint32_t numNeighbours;
+  uint32_t usedP;
+  uint32_t usedS;
+  uint32_t numTTp;
+  uint32_t numTTs;
+  uint32_t numCCp;
+  uint32_t numCCs;
+  uint32_t isRelocated;
+};
+static_assert(sizeof(EventRecord) == 208,
+              "Unexpected binary catalog event record size");
+
+struct PhaseRecord
+{
+  int64_t timeSeconds;
+  double lowerUncertainty;
+  double upperUncertainty;
+  double startWeight;
+  double finalWeight;
+  double startResidual;
+  double finalResidual;
+  double startMeanObsResidual;
+  double finalMeanObsResidual;
+  uint32_t eventId;
+  uint32_t timeMicroseconds;
+  uint32_t stationId;
+  uint32_t type;
+  uint32_t networkCode;
+  uint32_t stationCode;
+  uint32_t locationCode;
+  uint32_t channelCode;
+  uint32_t numTTObs;
+  uint32_t numCCObs;
+  uint8_t isManual;
+  uint8_t isRelocated;
+  uint8_t padding[6];
+};
+static_assert(sizeof(PhaseRecord) == 120,
+              "Unexpected binary catalog phase record size");
+
+// keep each section 8 bytes aligned
+uint64_t alignedSize(uint64_t size) { return (size + 7) & ~uint64_t(7); }
+
+/*
+ * Assign an index to each distinct string. Symbols are interned, so the
+ * string address identifies the string
+ */
+class StringTableBuilder
+{
+public:
+  uint32_t index(const Symbol &symbol)
+  {
+    auto it = _indices.find(&symbol.str());
+    if (it != _indices.end()) return it->second;
+    uint32_t idx = _strings.size();
+    _strings.push_back(&symbol.str());
+    _indices.emplace(&symbol.str(), idx);
+    return idx;
+  }
+
+  const vector<const string *> &strings() const { return _strings; }
+
+private:
+  unordered_map<const string *, uint32_t> _indices;
+  vector<const string *> _strings;
+};
+
+/*
+ * Read-only memory mapping of a whole file, unmapped on destruction
+ */
+class MappedFile
+{
+public:
+  explicit MappedFile(const string &filename)
+  {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      string msg = stringify("Cannot open binary catalog %s (%s)",
+                             filename.c_str(), std::strerror(errno));
+      throw runtime_error(msg);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+      close(fd);
+      string msg = stringify("Cannot stat binary catalog %s (%s)",
+                             filename.c_str(), std::strerror(errno));
+      throw runtime_error(msg);
+    }
+
+    if (st.st_size == 0)
+    {
+      close(fd);
+      string msg = stringify("Binary catalog %s is empty", filename.c_str());
+      throw runtime_error(msg);
+    }
+
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps a reference to the file
+    if (data == MAP_FAILED)
+    {
+      string msg = stringify("Cannot memory-map binary catalog %s (%s)",
+                             filename.c_str(), std::strerror(errno));
+      throw runtime_error(msg);
+    }
+    // the records are read once from start to end
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    _data = static_cast<const char *>(data);
+    _size = st.st_size;
+  }
+
+  ~MappedFile() { munmap(const_cast<char *>(_data), _size); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return _data; }
+  uint64_t size() const { return _size; }
+
+private:
+  const char *_data;
+  uint64_t _size;
+};
+
+template <class T> T readRecord(const char *data, uint64_t offset)
+{
+  T record;
+  std::memcpy(&record, data + offset, sizeof(T));
+  return record;
+}
+
+template <class T> void writeRecord(ofstream &out, const T &record)
+{
+  out.write(reinterpret_cast<const char *>(&record), sizeof(T));
+}
+
+void writePadding(ofstream &out, uint64_t size)
+{
+  static const char zeros[8] = {0};
+  out.write(zeros, alignedSize(size) - size);
+}
+
+} // namespace
+
+namespace Seiscomp {
+namespace HDD {
+namespace BinaryCatalog {
+
+bool isBinaryCatalog(const string &filename)
+{
+  ifstream in(filename, ios::binary);
+  char magic[sizeof(MAGIC)];
+  if (!in.read(magic, sizeof(magic))) return false;
+  return std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+void write(const Catalog &catalog, const string &filename)
+{
+  StringTableBuilder strings;
+
+  vector<StationRecord> stations;
+  stations.reserve(catalog.getStations().size());
+  for (const auto &kv : catalog.getStations())
+  {
+    const Catalog::Station &sta = kv.second;
+    StationRecord rec{};
+    rec.latitude     = sta.latitude;
+    rec.longitude    = sta.longitude;
+    rec.elevation    = sta.elevation;
+    rec.id           = strings.index(sta.id);
+    rec.networkCode  = strings.index(sta.networkCode);
+    rec.stationCode  = strings.index(sta.stationCode);
+    rec.locationCode = strings.index(sta.locationCode);
+    stations.push_back(rec);
+  }
+
+  vector<EventRecord> events;
+  events.reserve(catalog.getEvents().size());
+  for (const auto &kv : catalog.getEvents())
+  {
+    const Catalog::Event &ev = kv.second;
+    EventRecord rec{};
+    rec.id               = ev.id;
+    rec.timeSeconds      = ev.time.seconds();
+    rec.timeMicroseconds = ev.time.microseconds();
+    rec.latitude         = ev.latitude;
+    rec.longitude        = ev.longitude;
+    rec.depth            = ev.depth;
+    rec.magnitude        = ev.magnitude;
+    rec.rms              = ev.rms;
+    rec.isRelocated      = ev.relocInfo.isRelocated;
+    if (ev.relocInfo.isRelocated)
+    {
+      rec.startRms      = ev.relocInfo.startRms;
+      rec.locChange     = ev.relocInfo.locChange;
+      rec.depthChange   = ev.relocInfo.depthChange;
+      rec.timeChange    = ev.relocInfo.timeChange;
+      rec.numNeighbours = ev.relocInfo.neighbours.amount;
+      rec.meanDistToCentroid = ev.relocInfo.neighbours.meanDistToCentroid;
+      rec.meanDepthDistToCentroid =
+          ev.relocInfo.neighbours.meanDepthDistToCentroid;
+      rec.eventDistToCentroid = ev.relocInfo.neighbours.eventDistToCentroid;
+      rec.eventDepthDistToCentroid =
+          ev.relocInfo.neighbours.eventDepthDistToCentroid;
+      rec.usedP               = ev.relocInfo.phases.usedP;
+      rec.usedS               = ev.relocInfo.phases.usedS;
+      rec.stationDistMedian   = ev.relocInfo.phases.stationDistMedian;
+      rec.stationDistMin      = ev.relocInfo.phases.stationDistMin;
+      rec.stationDistMax      = ev.relocInfo.phases.stationDistMax;
+      rec.numTTp              = ev.relocInfo.ddObs.numTTp;
+      rec.numTTs              = ev.relocInfo.ddObs.numTTs;
+      rec.numCCp              = ev.relocInfo.ddObs.numCCp;
+      rec.numCCs              = ev.relocInfo.ddObs.numCCs;
+      rec.startResidualMedian = ev.relocInfo.ddObs.startResidualMedian;
+      rec.startResidualMAD    = ev.relocInfo.ddObs.startResidualMAD;
+      rec.finalResidualMedian = ev.relocInfo.ddObs.finalResidualMedian;
+      rec.finalResidualMAD    = ev.relocInfo.ddObs.finalResidualMAD;
+    }
+    events.push_back(rec);
+  }
+
+  vector<PhaseRecord> phases;
+  phases.reserve(catalog.getPhases().size());
+  for (const auto &kv : catalog.getPhases())
+  {
+    const Catalog::Phase &ph = kv.second;
+    PhaseRecord rec{};
+    rec.eventId          = ph.eventId;
+    rec.timeSeconds      = ph.time.seconds();
+    rec.timeMicroseconds = ph.time.microseconds();
+    rec.lowerUncertainty = ph.lowerUncertainty;
+    rec.upperUncertainty = ph.upperUncertainty;
+    rec.stationId        = strings.index(ph.stationId);
+    rec.type             = strings.index(ph.type);
+    rec.networkCode      = strings.index(ph.networkCode);
+    rec.stationCode      = strings.index(ph.stationCode);
+    rec.locationCode     = strings.index(ph.locationCode);
+    rec.channelCode      = strings.index(ph.channelCode);
+    rec.isManual         = ph.isManual;
+    rec.isRelocated      = ph.relocInfo->isRelocated;
+    if (ph.relocInfo->isRelocated)
+    {
+      rec.startWeight          = ph.procInfo.weight;
+      rec.finalWeight          = ph.relocInfo->finalWeight;
+      rec.startResidual        = ph.relocInfo->startResidual;
+      rec.finalResidual        = ph.relocInfo->finalResidual;
+      rec.numTTObs             = ph.relocInfo->numTTObs;
+      rec.numCCObs             = ph.relocInfo->numCCObs;
+      rec.startMeanObsResidual = ph.relocInfo->startMeanObsResidual;
+      rec.finalMeanObsResidual = ph.relocInfo->finalMeanObsResidual;
+    }
+    phases.push_back(rec);
+  }
+
+  // string table: numStrings + 1 offsets followed by the characters
+  vector<uint64_t> stringOffsets;
+  stringOffsets.reserve(strings.strings().size() + 1);
+  uint64_t stringDataSize = 0;
+  for (const string *str : strings.strings())
+  {
+    stringOffsets.push_back(stringDataSize);
+    stringDataSize += str->size();
+  }
+  stringOffsets.push_back(stringDataSize);
+
+  Header header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version        = VERSION;
+  header.byteOrder      = BYTE_ORDER_MARK;
+  header.numStrings     = strings.strings().size();
+  header.numStations    = stations.size();
+  header.numEvents      = events.size();
+  header.numPhases      = phases.size();
+  header.stringDataSize = stringDataSize;
+
+  ofstream out(filename, ios::binary | ios::trunc);
+  if (!out.is_open())
+  {
+    string msg = "Cannot write binary catalog " + filename;
+    throw runtime_error(msg);
+  }
+
+  writeRecord(out, header);
+  for (uint64_t offset : stringOffsets) writeRecord(out, offset);
+  for (const string *str : strings.strings())
+    out.write(str->data(), str->size());
+  writePadding(out, stringDataSize);
+  for (const StationRecord &rec : stations) writeRecord(out, rec);
+  for (const EventRecord &rec : events) writeRecord(out, rec);
+  for (const PhaseRecord &rec : phases) writeRecord(out, rec);
+
+  if (!out)
+  {
+    string msg = "Error while writing binary catalog " + filename;
+    throw runtime_error(msg);
+  }
+}
+
+void read(const string &filename,
+          bool loadRelocationInfo,
+          unordered_map<string, Catalog::Station> &stations,
+          map<unsigned, Catalog::Event> &events,
+          unordered_multimap<unsigned, Catalog::Phase> &phases)
+{
+  MappedFile file(filename);
+
+  if (file.size() < sizeof(Header))
+  {
+    string msg = stringify("Binary catalog %s is truncated", filename.c_str());
+    throw runtime_error(msg);
+  }
+
+  const Header header = readRecord<Header>(file.data(), 0);
+
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+  {
+    string msg = stringify("File %s is not a binary catalog", filename.c_str());
+    throw runtime_error(msg);
+  }
+
+  if (header.byteOrder != BYTE_ORDER_MARK)
+  {
+    string msg = stringify(
+        "Binary catalog %s was written on a machine with a different byte "
+        "order",
+        filename.c_str());
+    throw runtime_error(msg);
+  }
+
+  if (header.version != VERSION)
+  {
+    string msg = stringify(
+        "Binary catalog %s has version %u, but only version %u is supported",
+        filename.c_str(), header.version, VERSION);
+    throw runtime_error(msg);
+  }
+
+  const uint64_t offsetsPos = sizeof(Header);
+  const uint64_t stringsPos =
+      offsetsPos + (uint64_t(header.numStrings) + 1) * sizeof(uint64_t);
+  const uint64_t stationsPos =
+      stringsPos + alignedSize(header.stringDataSize);
+  const uint64_t eventsPos =
+      stationsPos + uint64_t(header.numStations) * sizeof(StationRecord);
+  const uint64_t phasesPos =
+      eventsPos + uint64_t(header.numEvents) * sizeof(EventRecord);
+  const uint64_t expectedSize =
+      phasesPos + uint64_t(header.numPhases) * sizeof(PhaseRecord);
+
+  if (file.size() < expectedSize)
+  {
+    string msg = stringify("Binary catalog %s is truncated (%llu bytes, "
+                           "expected %llu bytes)",
+                           filename.c_str(), (unsigned long long)file.size(),
+                           (unsigned long long)expectedSize);
+    throw runtime_error(msg);
+  }
+
+  // intern every string once, the records then only copy the Symbols
+  vector<Symbol> strings;
+  strings.reserve(header.numStrings);
+  for (uint32_t i = 0; i < header.numStrings; i++)
+  {
+    uint64_t begin = readRecord<uint64_t>(
+        file.data(), offsetsPos + uint64_t(i) * sizeof(uint64_t));
+    uint64_t end = readRecord<uint64_t>(
+        file.data(), offsetsPos + uint64_t(i + 1) * sizeof(uint64_t));
+    if (begin > end || end > header.stringDataSize)
+    {
+      string msg = stringify("Binary catalog %s has a corrupted string table",
+                             filename.c_str());
+      throw runtime_error(msg);
+    }
+    strings.emplace_back(string(file.data() + stringsPos + begin, end - begin));
+  }
+
+  auto symbol = [&strings, &filename](uint32_t index) -> const Symbol & {
+    if (index >= strings.size())
+    {
+      string msg = stringify("Binary catalog %s has an invalid string index",
+                             filename.c_str());
+      throw runtime_error(msg);
+    }
+    return strings[index];
+  };
+
+  stations.reserve(stations.size() + header.numStations);
+  for (uint32_t i = 0; i < header.numStations; i++)
+  {
+    const StationRecord rec = readRecord<StationRecord>(
+        file.data(), stationsPos + uint64_t(i) * sizeof(StationRecord));
+    Catalog::Station sta;
+    sta.id           = symbol(rec.id);
+    sta.latitude     = rec.latitude;
+    sta.longitude    = rec.longitude;
+    sta.elevation    = rec.elevation;
+    sta.networkCode  = symbol(rec.networkCode);
+    sta.stationCode  = symbol(rec.stationCode);
+    sta.locationCode = symbol(rec.locationCode);
+    stations[sta.id] = sta;
+  }
+
+  for (uint32_t i = 0; i < header.numEvents; i++)
+  {
+    const EventRecord rec = readRecord<EventRecord>(
+        file.data(), eventsPos + uint64_t(i) * sizeof(EventRecord));
+    Catalog::Event ev;
+    ev.id        = rec.id;
+    ev.time      = Core::Time(rec.timeSeconds, rec.timeMicroseconds);
+    ev.latitude  = rec.latitude;
+    ev.longitude = rec.longitude;
+    ev.depth     = rec.depth;
+    ev.magnitude = rec.magnitude;
+    ev.rms       = rec.rms;
+    ev.relocInfo.isRelocated = false;
+    if (loadRelocationInfo && rec.isRelocated)
+    {
+      ev.relocInfo.isRelocated       = true;
+      ev.relocInfo.startRms          = rec.startRms;
+      ev.relocInfo.locChange         = rec.locChange;
+      ev.relocInfo.depthChange       = rec.depthChange;
+      ev.relocInfo.timeChange        = rec.timeChange;
+      ev.relocInfo.neighbours.amount = rec.numNeighbours;
+      ev.relocInfo.neighbours.meanDistToCentroid = rec.meanDistToCentroid;
+      ev.relocInfo.neighbours.meanDepthDistToCentroid =
+          rec.meanDepthDistToCentroid;
+      ev.relocInfo.neighbours.eventDistToCentroid = rec.eventDistToCentroid;
+      ev.relocInfo.neighbours.eventDepthDistToCentroid =
+          rec.eventDepthDistToCentroid;
+      ev.relocInfo.phases.usedP              = rec.usedP;
+      ev.relocInfo.phases.usedS              = rec.usedS;
+      ev.relocInfo.phases.stationDistMedian  = rec.stationDistMedian;
+      ev.relocInfo.phases.stationDistMin     = rec.stationDistMin;
+      ev.relocInfo.phases.stationDistMax     = rec.stationDistMax;
+      ev.relocInfo.ddObs.numTTp              = rec.numTTp;
+      ev.relocInfo.ddObs.numTTs              = rec.numTTs;
+      ev.relocInfo.ddObs.numCCp              = rec.numCCp;
+      ev.relocInfo.ddObs.numCCs              = rec.numCCs;
+      ev.relocInfo.ddObs.startResidualMedian = rec.startResidualMedian;
+      ev.relocInfo.ddObs.startResidualMAD    = rec.startResidualMAD;
+      ev.relocInfo.ddObs.finalResidualMedian = rec.finalResidualMedian;
+      ev.relocInfo.ddObs.finalResidualMAD    = rec.finalResidualMAD;
+    }
+    events[ev.id] = ev;
+  }
+
+  phases.reserve(phases.size() + header.numPhases);
+  for (uint32_t i = 0; i < header.numPhases; i++)
+  {
+    const PhaseRecord rec = readRecord<PhaseRecord>(
+        file.data(), phasesPos + uint64_t(i) * sizeof(PhaseRecord));
+    Catalog::Phase ph;
+    ph.eventId          = rec.eventId;
+    ph.stationId        = symbol(rec.stationId);
+    ph.time             = Core::Time(rec.timeSeconds, rec.timeMicroseconds);
+    ph.lowerUncertainty = rec.lowerUncertainty;
+    ph.upperUncertainty = rec.upperUncertainty;
+    ph.type             = symbol(rec.type);
+    ph.networkCode      = symbol(rec.networkCode);
+    ph.stationCode      = symbol(rec.stationCode);
+    ph.locationCode     = symbol(rec.locationCode);
+    ph.channelCode      = symbol(rec.channelCode);
+    ph.isManual         = rec.isManual;
+    if (loadRelocationInfo && rec.isRelocated)
+    {
+      ph.relocInfo->isRelocated          = true;
+      ph.procInfo.weight                 = rec.startWeight;
+      ph.relocInfo->finalWeight          = rec.finalWeight;
+      ph.relocInfo->startResidual        = rec.startResidual;
+      ph.relocInfo->finalResidual        = rec.finalResidual;
+      ph.relocInfo->numTTObs             = rec.numTTObs;
+      ph.relocInfo->numCCObs             = rec.numCCObs;
+      ph.relocInfo->startMeanObsResidual = rec.startMeanObsResidual;
+      ph.relocInfo->finalMeanObsResidual = rec.finalMeanObsResidual;
+    }
+    phases.emplace(ph.eventId, ph);
+  }
+}
+
+} // namespace BinaryCatalog
+} // namespace HDD
+} // namespace Seiscomp
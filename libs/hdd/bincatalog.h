@@ -0,0 +1,65 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU LESSER GENERAL PUBLIC LICENSE as          *
+ * published by the Free Software Foundation, either version 3 of the      *
+ * License, or (at your option) any later version.                         *
+ *                                                                         *
+ * This software is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/
+
+#ifndef __HDD_BINCATALOG_H__
+#define __HDD_BINCATALOG_H__
+
+#include "catalog.h"
+
+#include <map>
+#include <string>
+#include <unordered_map>
+
+namespace Seiscomp {
+namespace HDD {
+namespace BinaryCatalog {
+
+/*
+ * Binary catalog file: a single file containing stations, events and phases
+ * that is memory-mapped and read without any text parsing.
+ *
+ * Layout (native byte order, checked when reading):
+ *
+ *  header       magic, format version, byte order mark, record counts
+ *  string table offsets of each string followed by the characters
+ *  stations     fixed size records
+ *  events       fixed size records
+ *  phases       fixed size records
+ *
+ * String fields (station ids, network/station/location/channel codes, phase
+ * types) are stored once in the string table and the records refer to them
+ * by index. Files written with a different format version are rejected.
+ */
+constexpr uint32_t VERSION = 1;
+
+/*
+ * Return true if the file exists and starts with the binary catalog magic
+ */
+bool isBinaryCatalog(const std::string &filename);
+
+void write(const Catalog &catalog, const std::string &filename);
+
+void read(const std::string &filename,
+          bool loadRelocationInfo,
+          std::unordered_map<std::string, Catalog::Station> &stations,
+          std::map<unsigned, Catalog::Event> &events,
+          std::unordered_multimap<unsigned, Catalog::Phase> &phases);
+
+} // namespace BinaryCatalog
+} // namespace HDD
+} // namespace Seiscomp
+
+#endif
@@ -15,8 +15,11 @@
  ***************************************************************************/
 
 #include "catalog.h"
+#include "bincatalog.h"
 #include "csvreader.h"
+#include "utils.h"
 
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/range/iterator_range_core.hpp>
@@ -33,6 +36,7 @@
 #include <seiscomp3/datamodel/origin.h>
 #include <seiscomp3/datamodel/pick.h>
 #include <seiscomp3/datamodel/station.h>
+#include <seiscomp3/math/math.h>
 #include <seiscomp3/utils/files.h>
 #include <stdexcept>
 
@@ -45,42 +49,248 @@ using Seiscomp::Core::stringify;
 
 namespace {
 
-template <class Map, class Val>
-typename Map::iterator searchByValue(Map &SearchMap, const Val &SearchVal)
+// hash of the values compared by Event::operator==
+size_t eventValueHash(const HDD::Catalog::Event &event)
 {
-  typename Map::iterator iRet = SearchMap.end();
-  for (typename Map::iterator iTer = SearchMap.begin(); iTer != SearchMap.end();
-       iTer++)
+  auto hashDouble = [](double value) {
+    return std::hash<double>()(value == 0 ? 0. : value); // -0 == 0
+  };
+  size_t hash = std::hash<long>()(event.time.seconds());
+  auto combine = [&hash](size_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  };
+  combine(std::hash<long>()(event.time.microseconds()));
+  combine(hashDouble(event.latitude));
+  combine(hashDouble(event.longitude));
+  combine(hashDouble(event.depth));
+  combine(hashDouble(event.magnitude));
+  combine(hashDouble(event.rms));
+  return hash;
+}
+
+bool strToBool(const HDD::CSV::Field &f)
+{
+  return f == "1" || f == "true" || f == "True" || f == "TRUE";
+}
+
+Core::Time strToTime(const HDD::CSV::Field &f)
+{
+  return Core::Time::FromString(f.str().c_str(), "%FT%T.%fZ"); // iso format
+}
+
+/*
+ * Catalog csv files: the columns are looked up once per file, the relocation
+ * columns are optional
+ */
+struct StationColumns
+{
+  explicit StationColumns(const HDD::CSV::Reader &reader)
+      : id(reader.requiredColumn("id")),
+        latitude(reader.requiredColumn("latitude")),
+        longitude(reader.requiredColumn("longitude")),
+        elevation(reader.requiredColumn("elevation")),
+        networkCode(reader.requiredColumn("networkCode")),
+        stationCode(reader.requiredColumn("stationCode")),
+        locationCode(reader.requiredColumn("locationCode"))
+  {}
+  int id, latitude, longitude, elevation;
+  int networkCode, stationCode, locationCode;
+};
+
+struct EventColumns
+{
+  explicit EventColumns(const HDD::CSV::Reader &reader)
+      : id(reader.requiredColumn("id")),
+        isotime(reader.requiredColumn("isotime")),
+        latitude(reader.requiredColumn("latitude")),
+        longitude(reader.requiredColumn("longitude")),
+        depth(reader.requiredColumn("depth")),
+        magnitude(reader.requiredColumn("magnitude")),
+        rms(reader.requiredColumn("rms")),
+        relocated(reader.column("relocated")),
+        startRms(reader.column("startRms")),
+        locChange(reader.column("locChange")),
+        depthChange(reader.column("depthChange")),
+        timeChange(reader.column("timeChange")),
+        numNeighbours(reader.column("numNeighbours")),
+        meanDistToCentroid(reader.column("neigh_meanDistToCentroid")),
+        meanDepthDistToCentroid(
+            reader.column("neigh_meanDepthDistToCentroid")),
+        eventDistToCentroid(reader.column("neigh_centroidToEventDist")),
+        eventDepthDistToCentroid(
+            reader.column("neigh_centroidToEventDepthDist")),
+        usedP(reader.column("ph_usedP")),
+        usedS(reader.column("ph_usedS")),
+        stationDistMin(reader.column("ph_stationDistMin")),
+        stationDistMedian(reader.column("ph_stationDistMedian")),
+        stationDistMax(reader.column("ph_stationDistMax")),
+        numTTp(reader.column("ddObs_numTTp")),
+        numTTs(reader.column("ddObs_numTTs")),
+        numCCp(reader.column("ddObs_numCCp")),
+        numCCs(reader.column("ddObs_numCCs")),
+        startResidualMedian(reader.column("ddObs_startResidualMedian")),
+        startResidualMAD(reader.column("ddObs_startResidualMAD")),
+        finalResidualMedian(reader.column("ddObs_finalResidualMedian")),
+        finalResidualMAD(reader.column("ddObs_finalResidualMAD"))
+  {}
+  int id, isotime, latitude, longitude, depth, magnitude, rms;
+  int relocated, startRms, locChange, depthChange, timeChange;
+  int numNeighbours, meanDistToCentroid, meanDepthDistToCentroid;
+  int eventDistToCentroid, eventDepthDistToCentroid;
+  int usedP, usedS, stationDistMin, stationDistMedian, stationDistMax;
+  int numTTp, numTTs, numCCp, numCCs;
+  int startResidualMedian, startResidualMAD;
+  int finalResidualMedian, finalResidualMAD;
+};
+
+struct PhaseColumns
+{
+  explicit PhaseColumns(const HDD::CSV::Reader &reader)
+      : eventId(reader.requiredColumn("eventId")),
+        stationId(reader.requiredColumn("stationId")),
+        isotime(reader.requiredColumn("isotime")),
+        lowerUncertainty(reader.requiredColumn("lowerUncertainty")),
+        upperUncertainty(reader.requiredColumn("upperUncertainty")),
+        type(reader.requiredColumn("type")),
+        networkCode(reader.requiredColumn("networkCode")),
+        stationCode(reader.requiredColumn("stationCode")),
+        locationCode(reader.requiredColumn("locationCode")),
+        channelCode(reader.requiredColumn("channelCode")),
+        evalMode(reader.requiredColumn("evalMode")),
+        usedInReloc(reader.column("usedInReloc")),
+        startWeight(reader.column("startWeight")),
+        finalWeight(reader.column("finalWeight")),
+        startResidual(reader.column("startTTTResidual")),
+        finalResidual(reader.column("finalTTTResidual")),
+        numTTObs(reader.column("numTTObs")),
+        numCCObs(reader.column("numCCObs")),
+        startMeanObsResidual(reader.column("startMeanObsResidual")),
+        finalMeanObsResidual(reader.column("finalMeanObsResidual"))
+  {}
+  int eventId, stationId, isotime, lowerUncertainty, upperUncertainty;
+  int type, networkCode, stationCode, locationCode, channelCode, evalMode;
+  int usedInReloc, startWeight, finalWeight, startResidual, finalResidual;
+  int numTTObs, numCCObs, startMeanObsResidual, finalMeanObsResidual;
+};
+
+HDD::Catalog::Station readStation(const HDD::CSV::Reader &row,
+                                  const StationColumns &col)
+{
+  HDD::Catalog::Station sta;
+  sta.id           = row.field(col.id).str();
+  sta.latitude     = row.field(col.latitude).toDouble();
+  sta.longitude    = row.field(col.longitude).toDouble();
+  sta.elevation    = row.field(col.elevation).toDouble();
+  sta.networkCode  = row.field(col.networkCode).str();
+  sta.stationCode  = row.field(col.stationCode).str();
+  sta.locationCode = row.field(col.locationCode).str();
+  return sta;
+}
+
+HDD::Catalog::Event readEvent(const HDD::CSV::Reader &row,
+                              const EventColumns &col,
+                              bool loadRelocationInfo)
+{
+  HDD::Catalog::Event ev;
+  ev.id                    = row.field(col.id).toUnsigned();
+  ev.time                  = strToTime(row.field(col.isotime));
+  ev.latitude              = row.field(col.latitude).toDouble();
+  ev.longitude             = row.field(col.longitude).toDouble();
+  ev.depth                 = row.field(col.depth).toDouble();
+  ev.magnitude             = row.field(col.magnitude).toDouble();
+  ev.rms                   = row.field(col.rms).toDouble();
+  ev.relocInfo.isRelocated = false;
+  if (loadRelocationInfo && strToBool(row.field(col.relocated)))
   {
-    if (iTer->second == SearchVal)
-    {
-      iRet = iTer;
-      break;
-    }
+    ev.relocInfo.isRelocated       = true;
+    ev.relocInfo.startRms          = row.field(col.startRms).toDouble();
+    ev.relocInfo.locChange         = row.field(col.locChange).toDouble();
+    ev.relocInfo.depthChange       = row.field(col.depthChange).toDouble();
+    ev.relocInfo.timeChange        = row.field(col.timeChange).toDouble();
+    ev.relocInfo.neighbours.amount = row.field(col.numNeighbours).toUnsigned();
+    ev.relocInfo.neighbours.meanDistToCentroid =
+        row.field(col.meanDistToCentroid).toDouble();
+    ev.relocInfo.neighbours.meanDepthDistToCentroid =
+        row.field(col.meanDepthDistToCentroid).toDouble();
+    ev.relocInfo.neighbours.eventDistToCentroid =
+        row.field(col.eventDistToCentroid).toDouble();
+    ev.relocInfo.neighbours.eventDepthDistToCentroid =
+        row.field(col.eventDepthDistToCentroid).toDouble();
+    ev.relocInfo.phases.usedP = row.field(col.usedP).toUnsigned();
+    ev.relocInfo.phases.usedS = row.field(col.usedS).toUnsigned();
+    ev.relocInfo.phases.stationDistMin =
+        row.field(col.stationDistMin).toDouble();
+    ev.relocInfo.phases.stationDistMedian =
+        row.field(col.stationDistMedian).toDouble();
+    ev.relocInfo.phases.stationDistMax =
+        row.field(col.stationDistMax).toDouble();
+    ev.relocInfo.ddObs.numTTp = row.field(col.numTTp).toUnsigned();
+    ev.relocInfo.ddObs.numTTs = row.field(col.numTTs).toUnsigned();
+    ev.relocInfo.ddObs.numCCp = row.field(col.numCCp).toUnsigned();
+    ev.relocInfo.ddObs.numCCs = row.field(col.numCCs).toUnsigned();
+    ev.relocInfo.ddObs.startResidualMedian =
+        row.field(col.startResidualMedian).toDouble();
+    ev.relocInfo.ddObs.startResidualMAD =
+        row.field(col.startResidualMAD).toDouble();
+    ev.relocInfo.ddObs.finalResidualMedian =
+        row.field(col.finalResidualMedian).toDouble();
+    ev.relocInfo.ddObs.finalResidualMAD =
+        row.field(col.finalResidualMAD).toDouble();
   }
-  return iRet;
+  return ev;
 }
 
-template <class Map, class Val>
-typename Map::const_iterator searchByValue(const Map &SearchMap,
-                                           const Val &SearchVal)
+HDD::Catalog::Phase readPhase(const HDD::CSV::Reader &row,
+                              const PhaseColumns &col,
+                              bool loadRelocationInfo)
 {
-  typename Map::const_iterator iRet = SearchMap.end();
-  for (typename Map::const_iterator iTer = SearchMap.begin();
-       iTer != SearchMap.end(); iTer++)
+  HDD::Catalog::Phase ph;
+  ph.eventId          = row.field(col.eventId).toUnsigned();
+  ph.stationId        = row.field(col.stationId).str();
+  ph.time             = strToTime(row.field(col.isotime));
+  ph.lowerUncertainty = row.field(col.lowerUncertainty).toDouble();
+  ph.upperUncertainty = row.field(col.upperUncertainty).toDouble();
+  ph.type             = row.field(col.type).str();
+  ph.networkCode      = row.field(col.networkCode).str();
+  ph.stationCode      = row.field(col.stationCode).str();
+  ph.locationCode     = row.field(col.locationCode).str();
+  ph.channelCode      = row.field(col.channelCode).str();
+  ph.isManual         = row.field(col.evalMode) == "manual";
+  if (loadRelocationInfo && strToBool(row.field(col.usedInReloc)))
   {
-    if (iTer->second == SearchVal)
-    {
-      iRet = iTer;
-      break;
-    }
+    ph.relocInfo->isRelocated   = true;
+    ph.procInfo.weight          = row.field(col.startWeight).toDouble();
+    ph.relocInfo->finalWeight   = row.field(col.finalWeight).toDouble();
+    ph.relocInfo->startResidual = row.field(col.startResidual).toDouble();
+    ph.relocInfo->finalResidual = row.field(col.finalResidual).toDouble();
+    ph.relocInfo->numTTObs      = row.field(col.numTTObs).toUnsigned();
+    ph.relocInfo->numCCObs      = row.field(col.numCCObs).toUnsigned();
+    ph.relocInfo->startMeanObsResidual =
+        row.field(col.startMeanObsResidual).toDouble();
+    ph.relocInfo->finalMeanObsResidual =
+        row.field(col.finalMeanObsResidual).toDouble();
   }
-  return iRet;
+  return ph;
 }
 
-bool strToBool(const std::string &s)
+uint64_t stationPhaseKey(uint64_t stationIdx,
+                         const HDD::Catalog::Phase::Type &type)
 {
-  return s == "1" || s == "true" || s == "True" || s == "TRUE";
+  return (stationIdx << 1) | (type == HDD::Catalog::Phase::Type::S ? 1 : 0);
+}
+
+uint64_t eventPhaseKey(unsigned eventId,
+                       uint64_t stationIdx,
+                       const HDD::Catalog::Phase::Type &type)
+{
+  return (uint64_t(eventId) << 32) | stationPhaseKey(stationIdx, type);
+}
+
+// copy-on-write: copy the data if shared before modifying it
+template <class T> T &detach(std::shared_ptr<T> &data)
+{
+  if (data.use_count() > 1) data = std::make_shared<T>(*data);
+  return *data;
 }
 
 } // namespace
@@ -97,14 +307,26 @@ Catalog::Catalog()
 Catalog::Catalog(const unordered_map<string, Station> &stations,
                  const map<unsigned, Event> &events,
                  const unordered_multimap<unsigned, Phase> &phases)
-    : _stations(stations), _events(events), _phases(phases)
-{}
+{
+  _stationData->stations = stations;
+  _eventData->events     = events;
+  _phaseData->phases     = phases;
+  updateAllCoordinates();
+  _eventData->rebuildIndex();
+  _phaseData->rebuildIndex();
+}
 
 Catalog::Catalog(unordered_map<string, Station> &&stations,
                  map<unsigned, Event> &&events,
                  unordered_multimap<unsigned, Phase> &&phases)
-    : _stations(stations), _events(events), _phases(phases)
-{}
+{
+  _stationData->stations = std::move(stations);
+  _eventData->events     = std::move(events);
+  _phaseData->phases     = std::move(phases);
+  updateAllCoordinates();
+  _eventData->rebuildIndex();
+  _phaseData->rebuildIndex();
+}
 
 Catalog::Catalog(const string &stationFile,
                  const string &eventFile,
@@ -129,112 +351,47 @@ Catalog::Catalog(const string &stationFile,
     throw runtime_error(msg);
   }
 
-  vector<unordered_map<string, string>> stations =
-      CSV::readWithHeader(stationFile);
-
-  for (const auto &row : stations)
   {
-    Station sta;
-    sta.id            = row.at("id");
-    sta.latitude      = std::stod(row.at("latitude"));
-    sta.longitude     = std::stod(row.at("longitude"));
-    sta.elevation     = std::stod(row.at("elevation"));
-    sta.networkCode   = row.at("networkCode");
-    sta.stationCode   = row.at("stationCode");
-    sta.locationCode  = row.at("locationCode");
-    _stations[sta.id] = sta;
+    CSV::Reader reader(stationFile);
+    const StationColumns columns(reader);
+    while (reader.next())
+    {
+      Station sta = readStation(reader, columns);
+      _stationData->stations[sta.id] = sta;
+    }
   }
 
-  vector<unordered_map<string, string>> events = CSV::readWithHeader(eventFile);
-
-  for (const auto &row : events)
   {
-    Event ev;
-    ev.id                    = std::stoul(row.at("id"));
-    ev.time                  = Core::Time::FromString(row.at("isotime").c_str(),
-                                     "%FT%T.%fZ"); // iso format
-    ev.latitude              = std::stod(row.at("latitude"));
-    ev.longitude             = std::stod(row.at("longitude"));
-    ev.depth                 = std::stod(row.at("depth"));
-    ev.magnitude             = std::stod(row.at("magnitude"));
-    ev.rms                   = std::stod(row.at("rms"));
-    ev.relocInfo.isRelocated = false;
-    if (loadRelocationInfo && (row.count("relocated") != 0) &&
-        strToBool(row.at("relocated")))
+    CSV::Reader reader(eventFile);
+    const EventColumns columns(reader);
+    while (reader.next())
     {
-      ev.relocInfo.isRelocated       = true;
-      ev.relocInfo.startRms          = std::stod(row.at("startRms"));
-      ev.relocInfo.locChange         = std::stod(row.at("locChange"));
-      ev.relocInfo.depthChange       = std::stod(row.at("depthChange"));
-      ev.relocInfo.timeChange        = std::stod(row.at("timeChange"));
-      ev.relocInfo.neighbours.amount = std::stoul(row.at("numNeighbours"));
-      ev.relocInfo.neighbours.meanDistToCentroid =
-          std::stod(row.at("neigh_meanDistToCentroid"));
-      ev.relocInfo.neighbours.meanDepthDistToCentroid =
-          std::stod(row.at("neigh_meanDepthDistToCentroid"));
-      ev.relocInfo.neighbours.eventDistToCentroid =
-          std::stod(row.at("neigh_centroidToEventDist"));
-      ev.relocInfo.neighbours.eventDepthDistToCentroid =
-          std::stod(row.at("neigh_centroidToEventDepthDist"));
-      ev.relocInfo.phases.usedP = std::stoul(row.at("ph_usedP"));
-      ev.relocInfo.phases.usedS = std::stoul(row.at("ph_usedS"));
-      ev.relocInfo.phases.stationDistMin =
-          std::stod(row.at("ph_stationDistMin"));
-      ev.relocInfo.phases.stationDistMedian =
-          std::stod(row.at("ph_stationDistMedian"));
-      ev.relocInfo.phases.stationDistMax =
-          std::stod(row.at("ph_stationDistMax"));
-      ev.relocInfo.ddObs.numTTp = std::stoul(row.at("ddObs_numTTp"));
-      ev.relocInfo.ddObs.numTTs = std::stoul(row.at("ddObs_numTTs"));
-      ev.relocInfo.ddObs.numCCp = std::stoul(row.at("ddObs_numCCp"));
-      ev.relocInfo.ddObs.numCCs = std::stoul(row.at("ddObs_numCCs"));
-      ev.relocInfo.ddObs.startResidualMedian =
-          std::stod(row.at("ddObs_startResidualMedian"));
-      ev.relocInfo.ddObs.startResidualMAD =
-          std::stod(row.at("ddObs_startResidualMAD"));
-      ev.relocInfo.ddObs.finalResidualMedian =
-          std::stod(row.at("ddObs_finalResidualMedian"));
-      ev.relocInfo.ddObs.finalResidualMAD =
-          std::stod(row.at("ddObs_finalResidualMAD"));
+      Event ev = readEvent(reader, columns, loadRelocationInfo);
+      _eventData->add(ev);
     }
-    _events[ev.id] = ev;
-  }
-
-  vector<unordered_map<string, string>> phases = CSV::readWithHeader(phaFile);
-
-  for (const auto &row : phases)
-  {
-    Phase ph;
-    ph.eventId               = std::stoul(row.at("eventId"));
-    ph.stationId             = row.at("stationId");
-    ph.time                  = Core::Time::FromString(row.at("isotime").c_str(),
-                                     "%FT%T.%fZ"); // iso format
-    ph.lowerUncertainty      = std::stod(row.at("lowerUncertainty"));
-    ph.upperUncertainty      = std::stod(row.at("upperUncertainty"));
-    ph.type                  = row.at("type");
-    ph.networkCode           = row.at("networkCode");
-    ph.stationCode           = row.at("stationCode");
-    ph.locationCode          = row.at("locationCode");
-    ph.channelCode           = row.at("channelCode");
-    ph.isManual              = row.at("evalMode") == "manual";
-    ph.relocInfo.isRelocated = false;
-    if (loadRelocationInfo && (row.count("usedInReloc") != 0) &&
-        strToBool(row.at("usedInReloc")))
+  }
+
+  {
+    CSV::Reader reader(phaFile);
+    const PhaseColumns columns(reader);
+    while (reader.next())
     {
-      ph.relocInfo.isRelocated   = true;
-      ph.procInfo.weight         = std::stod(row.at("startWeight"));
-      ph.relocInfo.finalWeight   = std::stod(row.at("finalWeight"));
-      ph.relocInfo.startResidual = std::stod(row.at("startTTTResidual"));
-      ph.relocInfo.finalResidual = std::stod(row.at("finalTTTResidual"));
-      ph.relocInfo.numTTObs      = std::stoul(row.at("numTTObs"));
-      ph.relocInfo.numCCObs      = std::stoul(row.at("numCCObs"));
-      ph.relocInfo.startMeanObsResidual =
-          std::stod(row.at("startMeanObsResidual"));
-      ph.relocInfo.finalMeanObsResidual =
-          std::stod(row.at("finalMeanObsResidual"));
+      Phase ph = readPhase(reader, columns, loadRelocationInfo);
+      _phaseData->phases.emplace(ph.eventId, ph);
     }
-    _phases.emplace(ph.eventId, ph);
   }
+
+  updateAllCoordinates();
+  _phaseData->rebuildIndex();
+}
+
+Catalog::Catalog(const string &binaryFile, bool loadRelocationInfo)
+{
+  BinaryCatalog::read(binaryFile, loadRelocationInfo, _stationData->stations,
+                      _eventData->events, _phaseData->phases);
+  updateAllCoordinates();
+  _eventData->rebuildIndex();
+  _phaseData->rebuildIndex();
 }
 
 void Catalog::add(const Catalog &other, bool keepEvId)
@@ -242,15 +399,52 @@ void Catalog::add(const Catalog &other, bool keepEvId)
   for (const auto &kv : other.getEvents())
   {
     const Catalog::Event &event = kv.second;
-    if (keepEvId && _events.find(event.id) != _events.end())
+    if (keepEvId)
     {
-      SEISCOMP_DEBUG("Skipping duplicated event id %u", event.id);
-      continue;
+      if (getEvents().find(event.id) != getEvents().end())
+      {
+        SEISCOMP_DEBUG("Skipping duplicated event id %u", event.id);
+        continue;
+      }
+    }
+    else
+    {
+      // don't add an event with same values, but keep merging phases
+      auto it = searchEvent(event);
+      if (it != getEvents().end())
+      {
+        mergePhases(it->first, event.id, other);
+        continue;
+      }
     }
     this->add(event.id, other, keepEvId);
   }
 }
 
+void Catalog::mergePhases(unsigned eventId,
+                          unsigned otherEventId,
+                          const Catalog &other)
+{
+  auto eqlrng = other.getPhases().equal_range(otherEventId);
+  for (auto it = eqlrng.first; it != eqlrng.second; ++it)
+  {
+    Catalog::Phase phase = it->second;
+    phase.eventId        = eventId;
+
+    // skip the phases the event already has
+    auto existing = getPhases().equal_range(eventId);
+    if (std::any_of(existing.first, existing.second,
+                    [&phase](const pair<const unsigned, Phase> &kv) {
+                      return kv.second == phase &&
+                             kv.second.stationId == phase.stationId;
+                    }))
+      continue;
+
+    addStation(other.getStations().at(phase.stationId));
+    addPhase(phase);
+  }
+}
+
 CatalogPtr Catalog::extractEvent(unsigned eventId, bool keepEvId) const
 {
   CatalogPtr eventToExtract = new Catalog();
@@ -267,8 +461,9 @@ CatalogPtr Catalog::extractEvent(unsigned eventId, bool keepEvId) const
 
   if (keepEvId)
   {
-    eventToExtract->_events[event.id] = event;
-    newEventId                        = event.id;
+    eventToExtract->eventData().add(event);
+    eventToExtract->updateEventCoordinates(event);
+    newEventId = event.id;
   }
   else
   {
@@ -280,7 +475,7 @@ CatalogPtr Catalog::extractEvent(unsigned eventId, bool keepEvId) const
   {
     Catalog::Phase phase = it->second;
 
-    const Catalog::Station &station = _stations.at(phase.stationId);
+    const Catalog::Station &station = getStations().at(phase.stationId);
     eventToExtract->addStation(station);
 
     phase.eventId = newEventId;
@@ -294,27 +489,27 @@ unsigned Catalog::add(unsigned evId, const Catalog &evCat, bool keepEvId)
 {
   unsigned newEventId;
 
-  const Catalog::Event &event = evCat._events.find(evId)->second;
+  const Catalog::Event &event = evCat.getEvents().find(evId)->second;
 
   if (keepEvId)
   {
-    if (_events.find(event.id) != _events.end())
+    if (getEvents().find(event.id) != getEvents().end())
       throw runtime_error("Cannot add event, internal logic error");
-    _events[event.id] = event;
-    newEventId        = event.id;
+    eventData().add(event);
+    updateEventCoordinates(event);
+    newEventId = event.id;
   }
   else
   {
-    // don't add an event with same values, but keep merging phases
     newEventId = addEvent(event);
   }
 
-  auto eqlrng = evCat._phases.equal_range(event.id);
+  auto eqlrng = evCat.getPhases().equal_range(event.id);
   for (auto it = eqlrng.first; it != eqlrng.second; ++it)
   {
     Catalog::Phase phase = it->second;
 
-    const Catalog::Station &station = evCat._stations.at(phase.stationId);
+    const Catalog::Station &station = evCat.getStations().at(phase.stationId);
     addStation(station);
 
     phase.eventId = newEventId;
@@ -326,34 +521,34 @@ unsigned Catalog::add(unsigned evId, const Catalog &evCat, bool keepEvId)
 
 void Catalog::removeEvent(unsigned eventId)
 {
-  map<unsigned, Catalog::Event>::const_iterator it = _events.find(eventId);
-  if (it != _events.end())
+  if (getEvents().find(eventId) != getEvents().end())
+  {
+    eventData().remove(eventId);
+  }
+  if (getPhases().find(eventId) != getPhases().end())
   {
-    _events.erase(it);
+    phaseData().removeEvent(eventId);
   }
-  auto eqlrng = _phases.equal_range(eventId);
-  _phases.erase(eqlrng.first, eqlrng.second);
 }
 
 void Catalog::removePhase(unsigned eventId,
                           const std::string &stationId,
                           const Phase::Type &type)
 {
-  unordered_map<unsigned, Phase>::const_iterator it =
-      searchPhase(eventId, stationId, type);
-  if (it != _phases.end())
-  {
-    _phases.erase(it);
-  }
+  PhaseIterator it;
+  if (!_phaseData->search(eventId, stationId, type, it)) return;
+  // the iterator must refer to the phases we are going to modify
+  PhaseData &data = phaseData();
+  data.search(eventId, stationId, type, it);
+  data.remove(it);
 }
 
 bool Catalog::updateStation(const Station &newStation, bool addIfMissing)
 {
-  unordered_map<string, Catalog::Station>::iterator it =
-      _stations.find(newStation.id);
-  if (it != _stations.end())
+  if (getStations().find(newStation.id) != getStations().end())
   {
-    it->second = newStation;
+    stationData().stations.at(newStation.id) = newStation;
+    updateStationCoordinates(newStation);
     return true;
   }
   else if (addIfMissing)
@@ -365,10 +560,10 @@ bool Catalog::updateStation(const Station &newStation, bool addIfMissing)
 
 bool Catalog::updateEvent(const Event &newEv, bool addIfMissing)
 {
-  map<unsigned, Catalog::Event>::iterator it = _events.find(newEv.id);
-  if (it != _events.end())
+  if (getEvents().find(newEv.id) != getEvents().end())
   {
-    it->second = newEv;
+    eventData().add(newEv);
+    updateEventCoordinates(newEv);
     return true;
   }
   else if (addIfMissing)
@@ -380,16 +575,15 @@ bool Catalog::updateEvent(const Event &newEv, bool addIfMissing)
 
 bool Catalog::updatePhase(const Phase &newPh, bool addIfMissing)
 {
-  auto eqlrng = _phases.equal_range(newPh.eventId);
-  for (auto it = eqlrng.first; it != eqlrng.second; ++it)
+  // same event, station and type: the indices are still valid
+  PhaseIterator it;
+  if (_phaseData->search(newPh.eventId, newPh.stationId, newPh.procInfo.type,
+                         it))
   {
-    Catalog::Phase &ph = it->second;
-    if (ph.stationId == newPh.stationId &&
-        ph.procInfo.type == newPh.procInfo.type)
-    {
-      ph = newPh;
-      return true;
-    }
+    PhaseData &data = phaseData();
+    data.search(newPh.eventId, newPh.stationId, newPh.procInfo.type, it);
+    it->second = newPh;
+    return true;
   }
 
   if (addIfMissing)
@@ -402,7 +596,7 @@ bool Catalog::updatePhase(const Phase &newPh, bool addIfMissing)
 map<unsigned, Catalog::Event>::const_iterator
 Catalog::searchEvent(const Event &event) const
 {
-  return searchByValue(_events, event);
+  return _eventData->search(event);
 }
 
 unordered_map<std::string, Catalog::Station>::const_iterator
@@ -411,7 +605,7 @@ Catalog::searchStation(const std::string &networkCode,
                        const std::string &locationCode) const
 {
   string stationId = networkCode + "." + stationCode + "." + locationCode;
-  return _stations.find(stationId);
+  return getStations().find(stationId);
 }
 
 unordered_map<unsigned, Catalog::Phase>::const_iterator
@@ -419,41 +613,320 @@ Catalog::searchPhase(unsigned eventId,
                      const std::string &stationId,
                      const Phase::Type &type) const
 {
-  auto eqlrng = _phases.equal_range(eventId);
-  for (auto it = eqlrng.first; it != eqlrng.second; ++it)
-  {
-    const Catalog::Phase &ph = it->second;
-    if (ph.stationId == stationId && ph.procInfo.type == type) return it;
-  }
-  return _phases.end();
+  PhaseIterator it;
+  if (!_phaseData->search(eventId, stationId, type, it))
+    return getPhases().end();
+  return it;
+}
+
+const set<unsigned> &
+Catalog::searchEventsWithPhase(const std::string &stationId,
+                               const Phase::Type &type) const
+{
+  static const set<unsigned> noEvents;
+  uint64_t staIdx;
+  if (!_phaseData->stationIndex(stationId, staIdx)) return noEvents;
+  const auto &eventsByStationPhase = _phaseData->eventsByStationPhase;
+  auto evIt = eventsByStationPhase.find(stationPhaseKey(staIdx, type));
+  if (evIt == eventsByStationPhase.end()) return noEvents;
+  return evIt->second;
 }
 
 string Catalog::addStation(const Station &sta)
 {
   string stationId =
       sta.networkCode + "." + sta.stationCode + "." + sta.locationCode;
-  if (_stations.find(stationId) == _stations.end())
+  if (getStations().find(stationId) == getStations().end())
   {
-    Station newSta       = sta;
-    newSta.id            = stationId;
-    _stations[newSta.id] = newSta;
+    Station newSta = sta;
+    newSta.id      = stationId;
+    stationData().stations[newSta.id] = newSta;
+    updateStationCoordinates(newSta);
   }
   return stationId;
 }
 
 unsigned Catalog::addEvent(const Event &event)
 {
-  decltype(_events)::key_type maxKey =
-      _events.empty() ? 0 : _events.rbegin()->first;
-  Event newEvent       = event;
-  newEvent.id          = maxKey + 1;
-  _events[newEvent.id] = newEvent;
+  const map<unsigned, Event> &events = getEvents();
+
+  unsigned maxKey = events.empty() ? 0 : events.rbegin()->first;
+  Event newEvent  = event;
+  newEvent.id     = maxKey + 1;
+  eventData().add(newEvent);
+  updateEventCoordinates(newEvent);
   return newEvent.id;
 }
 
-void Catalog::addPhase(const Phase &phase)
+void Catalog::addPhase(const Phase &phase) { phaseData().add(phase); }
+
+Catalog::StationData &Catalog::stationData() { return detach(_stationData); }
+
+Catalog::EventData &Catalog::eventData() { return detach(_eventData); }
+
+Catalog::PhaseData &Catalog::phaseData() { return detach(_phaseData); }
+
+map<unsigned, Catalog::Event>::const_iterator
+Catalog::EventData::search(const Event &event) const
 {
-  _phases.emplace(phase.eventId, phase);
+  // the lowest id among the events with the same values
+  auto found = events.end();
+  auto range = idsByValue.equal_range(eventValueHash(event));
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    auto evIt = events.find(it->second);
+    if (evIt->second == event &&
+        (found == events.end() || evIt->first < found->first))
+      found = evIt;
+  }
+  return found;
+}
+
+void Catalog::EventData::add(const Event &event)
+{
+  auto evIt = events.find(event.id);
+  if (evIt != events.end())
+  {
+    auto range = idsByValue.equal_range(eventValueHash(evIt->second));
+    for (auto it = range.first; it != range.second; ++it)
+    {
+      if (it->second == event.id)
+      {
+        idsByValue.erase(it);
+        break;
+      }
+    }
+    evIt->second = event;
+  }
+  else
+  {
+    events.emplace(event.id, event);
+  }
+  idsByValue.emplace(eventValueHash(event), event.id);
+}
+
+void Catalog::EventData::remove(unsigned eventId)
+{
+  auto evIt = events.find(eventId);
+  if (evIt == events.end()) return;
+  auto range = idsByValue.equal_range(eventValueHash(evIt->second));
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    if (it->second == eventId)
+    {
+      idsByValue.erase(it);
+      break;
+    }
+  }
+  events.erase(evIt);
+  coords.erase(eventId);
+}
+
+void Catalog::EventData::rebuildIndex()
+{
+  idsByValue.clear();
+  idsByValue.reserve(events.size());
+  for (const auto &kv : events)
+    idsByValue.emplace(eventValueHash(kv.second), kv.first);
+}
+
+Catalog::PhaseData::PhaseData(const PhaseData &other) : phases(other.phases)
+{
+  rebuildIndex();
+}
+
+bool Catalog::PhaseData::search(unsigned eventId,
+                                const std::string &stationId,
+                                const Phase::Type &type,
+                                PhaseIterator &it) const
+{
+  uint64_t staIdx;
+  if (!stationIndex(stationId, staIdx)) return false;
+  auto idxIt = phaseIdx.find(eventPhaseKey(eventId, staIdx, type));
+  if (idxIt == phaseIdx.end()) return false;
+  it = idxIt->second;
+  return true;
+}
+
+void Catalog::PhaseData::add(const Phase &phase)
+{
+  const auto bucketCount = phases.bucket_count();
+  PhaseIterator it       = phases.emplace(phase.eventId, phase);
+  // rehashing invalidates the indexed iterators
+  if (phases.bucket_count() != bucketCount)
+    rebuildIndex();
+  else
+    index(it);
+}
+
+void Catalog::PhaseData::remove(const PhaseIterator &it)
+{
+  const Phase &phase = it->second;
+  uint64_t staIdx;
+  stationIndex(phase.stationId, staIdx);
+
+  const uint64_t key =
+      eventPhaseKey(phase.eventId, staIdx, phase.procInfo.type);
+
+  auto idxIt = phaseIdx.find(key);
+  if (idxIt != phaseIdx.end() && idxIt->second == it)
+  {
+    phaseIdx.erase(idxIt);
+
+    // index the duplicated phase, if any
+    bool duplicated = false;
+    auto eqlrng     = phases.equal_range(phase.eventId);
+    for (auto other = eqlrng.first; other != eqlrng.second; ++other)
+    {
+      if (other != it && other->second.stationId == phase.stationId &&
+          other->second.procInfo.type == phase.procInfo.type)
+      {
+        phaseIdx.emplace(key, other);
+        duplicated = true;
+        break;
+      }
+    }
+
+    if (!duplicated)
+    {
+      auto evIt = eventsByStationPhase.find(
+          stationPhaseKey(staIdx, phase.procInfo.type));
+      evIt->second.erase(phase.eventId);
+      if (evIt->second.empty()) eventsByStationPhase.erase(evIt);
+    }
+  }
+
+  phases.erase(it);
+}
+
+void Catalog::PhaseData::removeEvent(unsigned eventId)
+{
+  auto eqlrng = phases.equal_range(eventId);
+  for (auto it = eqlrng.first; it != eqlrng.second; ++it)
+  {
+    const Phase &phase = it->second;
+    uint64_t staIdx;
+    if (!stationIndex(phase.stationId, staIdx)) continue;
+    phaseIdx.erase(eventPhaseKey(eventId, staIdx, phase.procInfo.type));
+    auto evIt = eventsByStationPhase.find(
+        stationPhaseKey(staIdx, phase.procInfo.type));
+    if (evIt == eventsByStationPhase.end()) continue;
+    evIt->second.erase(eventId);
+    if (evIt->second.empty()) eventsByStationPhase.erase(evIt);
+  }
+  phases.erase(eqlrng.first, eqlrng.second);
+}
+
+bool Catalog::PhaseData::stationIndex(const std::string &stationId,
+                                      uint64_t &index) const
+{
+  auto it = stationIdx.find(stationId);
+  if (it == stationIdx.end()) return false;
+  index = it->second;
+  return true;
+}
+
+void Catalog::PhaseData::index(const PhaseIterator &it)
+{
+  const Phase &phase = it->second;
+  const uint64_t staIdx =
+      stationIdx.emplace(phase.stationId, stationIdx.size()).first->second;
+  // in case of duplicated phases the first one is indexed
+  phaseIdx.emplace(eventPhaseKey(phase.eventId, staIdx, phase.procInfo.type),
+                   it);
+  eventsByStationPhase[stationPhaseKey(staIdx, phase.procInfo.type)].insert(
+      phase.eventId);
+}
+
+void Catalog::PhaseData::rebuildIndex()
+{
+  stationIdx.clear();
+  phaseIdx.clear();
+  eventsByStationPhase.clear();
+  for (PhaseIterator it = phases.begin(); it != phases.end(); ++it) index(it);
+}
+
+double Catalog::Coordinates::distance(const Coordinates &other,
+                                      double *azimuth) const
+{
+  const double dx = other.x - x;
+  const double dy = other.y - y;
+  const double dz = other.z - z;
+  if (azimuth)
+  {
+    *azimuth = rad2deg(std::atan2(dx, dy));
+    if (*azimuth < 0) *azimuth += 360;
+  }
+  return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+void Catalog::setOrigin(double latitude, double longitude)
+{
+  _origin.latitude  = latitude;
+  _origin.longitude = longitude;
+  _origin.isSet     = true;
+  _origin.isFixed   = true;
+  updateAllCoordinates();
+}
+
+Catalog::Coordinates Catalog::toLocalCoordinates(double latitude,
+                                                 double longitude,
+                                                 double depth) const
+{
+  double azimuth;
+  double distance = computeDistance(_origin.latitude, _origin.longitude,
+                                    latitude, longitude, &azimuth);
+  azimuth         = deg2rad(azimuth);
+  return {distance * std::sin(azimuth), distance * std::cos(azimuth), depth};
+}
+
+Catalog::Coordinates Catalog::toLocalCoordinates(const Event &event) const
+{
+  return toLocalCoordinates(event.latitude, event.longitude, event.depth);
+}
+
+Catalog::Coordinates Catalog::toLocalCoordinates(const Station &station) const
+{
+  return toLocalCoordinates(station.latitude, station.longitude,
+                            -(station.elevation / 1000.));
+}
+
+void Catalog::updateEventCoordinates(const Event &event)
+{
+  // unless explicitly set, the origin is the first event of the catalog
+  if (!_origin.isFixed && _eventData->coords.empty())
+  {
+    _origin.latitude  = event.latitude;
+    _origin.longitude = event.longitude;
+    _origin.isSet     = true;
+    if (!_stationData->coords.empty())
+    {
+      StationData &data = stationData();
+      for (auto &kv : data.coords)
+        kv.second = toLocalCoordinates(data.stations.at(kv.first));
+    }
+  }
+  eventData().coords[event.id] = toLocalCoordinates(event);
+}
+
+void Catalog::updateStationCoordinates(const Station &station)
+{
+  // stations only catalog: temporarily use the first station as origin
+  if (!_origin.isSet)
+  {
+    _origin.latitude  = station.latitude;
+    _origin.longitude = station.longitude;
+    _origin.isSet     = true;
+  }
+  stationData().coords[station.id] = toLocalCoordinates(station);
+}
+
+void Catalog::updateAllCoordinates()
+{
+  eventData().coords.clear();
+  stationData().coords.clear();
+  for (const auto &kv : getEvents()) updateEventCoordinates(kv.second);
+  for (const auto &kv : getStations()) updateStationCoordinates(kv.second);
 }
 
 void Catalog::writeToFile(string eventFile,
@@ -481,7 +954,7 @@ void Catalog::writeToFile(string eventFile,
   evStreamNoReloc << endl;
 
   bool relocInfo = false;
-  for (const auto &kv : _events)
+  for (const auto &kv : getEvents())
   {
     const Catalog::Event &ev = kv.second;
 
@@ -541,8 +1014,8 @@ void Catalog::writeToFile(string eventFile,
   }
   phStream << endl;
 
-  const multimap<unsigned, Catalog::Phase> orderedPhases(_phases.begin(),
-                                                         _phases.end());
+  const multimap<unsigned, Catalog::Phase> orderedPhases(
+      getPhases().begin(), getPhases().end());
   for (const auto &kv : orderedPhases)
   {
     const Catalog::Phase &ph = kv.second;
@@ -555,7 +1028,7 @@ void Catalog::writeToFile(string eventFile,
 
     if (relocInfo)
     {
-      if (!ph.relocInfo.isRelocated)
+      if (!ph.relocInfo->isRelocated)
       {
         phStream << ",false,,,,,,,,";
       }
@@ -563,10 +1036,11 @@ void Catalog::writeToFile(string eventFile,
       {
         phStream << stringify(
             ",true,%.3f,%.3f,%.2f,%.2f,%u,%u,%.4f,%.4f",
-            ph.relocInfo.startResidual, ph.relocInfo.finalResidual,
-            ph.procInfo.weight, ph.relocInfo.finalWeight, ph.relocInfo.numTTObs,
-            ph.relocInfo.numCCObs, ph.relocInfo.startMeanObsResidual,
-            ph.relocInfo.finalMeanObsResidual);
+            ph.relocInfo->startResidual, ph.relocInfo->finalResidual,
+            ph.procInfo.weight, ph.relocInfo->finalWeight,
+            ph.relocInfo->numTTObs, ph.relocInfo->numCCObs,
+            ph.relocInfo->startMeanObsResidual,
+            ph.relocInfo->finalMeanObsResidual);
       }
     }
     phStream << endl;
@@ -580,8 +1054,8 @@ void Catalog::writeToFile(string eventFile,
       << "id,latitude,longitude,elevation,networkCode,stationCode,locationCode"
       << endl;
 
-  const map<string, Catalog::Station> orderedStations(_stations.begin(),
-                                                      _stations.end());
+  const map<string, Catalog::Station> orderedStations(
+      getStations().begin(), getStations().end());
   for (const auto &kv : orderedStations)
   {
     const Catalog::Station &sta = kv.second;
@@ -593,6 +1067,11 @@ void Catalog::writeToFile(string eventFile,
   }
 }
 
+void Catalog::writeToFile(const string &binaryFile) const
+{
+  BinaryCatalog::write(*this, binaryFile);
+}
+
 /*
  * Build a catalog with requested phases, only. Besides, make sure, that for an
  * event/station pair there is only one P and one S phase. If multiple phases
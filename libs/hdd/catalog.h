@@ -17,9 +17,13 @@
 #ifndef __HDD_CATALOG_H__
 #define __HDD_CATALOG_H__
 
+#include "symbol.h"
 #include <seiscomp3/core/baseobject.h>
 #include <seiscomp3/datamodel/station.h>
 
+#include <cstdint>
+#include <memory>
+#include <set>
 #include <unordered_map>
 #include <vector>
 
@@ -33,15 +37,52 @@ class Catalog : public Core::BaseObject
 {
 
 public:
+  /*
+   * Rarely accessed data stored out of line: unset values take no memory and
+   * copies share the same storage until one of them is modified through the
+   * non-const accessors.
+   */
+  template <class T> class ColdData
+  {
+  public:
+    const T &operator*() const { return _data ? *_data : defaultValue(); }
+    const T *operator->() const { return &operator*(); }
+
+    T &operator*()
+    {
+      if (!_data)
+        _data = std::make_shared<T>();
+      else if (_data.use_count() > 1)
+        _data = std::make_shared<T>(*_data);
+      return *_data;
+    }
+    T *operator->() { return &operator*(); }
+
+    bool isSet() const { return bool(_data); }
+    void reset() { _data.reset(); }
+
+  private:
+    static const T &defaultValue()
+    {
+      static const T value{};
+      return value;
+    }
+    std::shared_ptr<T> _data;
+  };
+
+  /*
+   * The string fields of Station and Phase are interned: they are shared by
+   * all the records with the same value (see Symbol)
+   */
   struct Station
   {
-    std::string id;
+    Symbol id;
     double latitude;
     double longitude;
     double elevation; // meter
-    std::string networkCode;
-    std::string stationCode;
-    std::string locationCode;
+    Symbol networkCode;
+    Symbol stationCode;
+    Symbol locationCode;
 
     // Compare attributes when the id is not known (works between multiple
     // catalogs).
@@ -122,15 +163,15 @@ public:
   struct Phase
   {
     unsigned eventId;
-    std::string stationId;
+    Symbol stationId;
     Core::Time time;
     double lowerUncertainty;
     double upperUncertainty;
-    std::string type;
-    std::string networkCode;
-    std::string stationCode;
-    std::string locationCode;
-    std::string channelCode;
+    Symbol type;
+    Symbol networkCode;
+    Symbol stationCode;
+    Symbol locationCode;
+    Symbol channelCode;
     bool isManual;
 
     enum class Type : char
@@ -149,12 +190,12 @@ public:
 
     struct
     {
-      Type type;
-      double weight; // 0-1 interval
-      Source source;
+      Type type     = Type::P;
+      double weight = 0; // 0-1 interval
+      Source source = Source::CATALOG;
     } procInfo;
 
-    struct
+    struct RelocInfo
     {
       bool isRelocated = false;
       double startResidual;
@@ -164,7 +205,8 @@ public:
       unsigned numCCObs;
       double startMeanObsResidual;
       double finalMeanObsResidual;
-    } relocInfo;
+    };
+    ColdData<RelocInfo> relocInfo; // set only by the relocation
 
     // Compare attributes when the id is not known (works between multiple
     // catalogs).
@@ -188,15 +230,31 @@ public:
     }
   };
 
+  /*
+   * Local Cartesian coordinates in km: x east, y north and z depth (stations
+   * have negative depth). They are computed with an azimuthal equidistant
+   * projection centered on the catalog origin, so the Euclidean distance
+   * between two points is a cheap replacement of the geodesic one within the
+   * area covered by a double-difference catalog.
+   */
+  struct Coordinates
+  {
+    double x;
+    double y;
+    double z;
+
+    double distance(const Coordinates &other, double *azimuth = nullptr) const;
+  };
+
   Catalog();
   virtual ~Catalog() {}
 
+  // Copies share the catalog data until they are modified (copy-on-write),
+  // so copying is cheap and a modified copy duplicates only the stations,
+  // events or phases it actually changes
   Catalog(const Catalog &other) = default;
   Catalog &operator=(const Catalog &other) = default;
 
-  Catalog(Catalog &&other) = default;
-  Catalog &operator=(Catalog &&other) = default;
-
   Catalog(std::unordered_map<std::string, Station> &&stations,
           std::map<unsigned, Event> &&events,
           std::unordered_multimap<unsigned, Phase> &&phases);
@@ -207,8 +265,13 @@ public:
           const std::string &eventFile,
           const std::string &phaseFile,
           bool loadRelocationInfo = false);
+  // load a binary catalog file (see BinaryCatalog)
+  Catalog(const std::string &binaryFile, bool loadRelocationInfo = false);
 
+  // With keepEvId false, the events having the same values of an existing
+  // one (see searchEvent) are not added again, only their missing phases are
   void add(const Catalog &other, bool keepEvId);
+  // With keepEvId false, the event is always added with a new id
   unsigned add(unsigned evId, const Catalog &eventCatalog, bool keepEvId);
   CatalogPtr extractEvent(unsigned eventId, bool keepEvId) const;
 
@@ -227,12 +290,15 @@ public:
 
   const std::unordered_map<std::string, Station> &getStations() const
   {
-    return _stations;
+    return _stationData->stations;
+  }
+  const std::map<unsigned, Event> &getEvents() const
+  {
+    return _eventData->events;
   }
-  const std::map<unsigned, Event> &getEvents() const { return _events; }
   const std::unordered_multimap<unsigned, Phase> &getPhases() const
   {
-    return _phases;
+    return _phaseData->phases;
   }
 
   std::unordered_map<std::string, Station>::const_iterator
@@ -245,13 +311,43 @@ public:
               const std::string &stationId,
               const Phase::Type &type) const;
 
+  // ids of the events having a phase of `type` at `stationId`
+  const std::set<unsigned> &
+  searchEventsWithPhase(const std::string &stationId,
+                        const Phase::Type &type) const;
+
   void writeToFile(std::string eventFile,
                    std::string phaseFile,
                    std::string stationFile) const;
+  // write a binary catalog file (see BinaryCatalog)
+  void writeToFile(const std::string &binaryFile) const;
 
   //
   //  static
   //
+  /*
+   * The coordinates of the catalog events and stations are kept up to date by
+   * the methods above. The origin defaults to the first event added to the
+   * catalog, changing it recomputes all coordinates.
+   */
+  void setOrigin(double latitude, double longitude);
+  double getOriginLatitude() const { return _origin.latitude; }
+  double getOriginLongitude() const { return _origin.longitude; }
+
+  const Coordinates &getEventCoordinates(unsigned eventId) const
+  {
+    return _eventData->coords.at(eventId);
+  }
+  const Coordinates &getStationCoordinates(const std::string &stationId) const
+  {
+    return _stationData->coords.at(stationId);
+  }
+
+  Coordinates
+  toLocalCoordinates(double latitude, double longitude, double depth) const;
+  Coordinates toLocalCoordinates(const Event &event) const;
+  Coordinates toLocalCoordinates(const Station &station) const;
+
   static double computePickWeight(double uncertainty);
   static double computePickWeight(const Catalog::Phase &phase);
   static Catalog *
@@ -263,10 +359,87 @@ public:
   static constexpr double DEFAULT_MANUAL_PICK_UNCERTAINTY    = 0.030;
   static constexpr double DEFAULT_AUTOMATIC_PICK_UNCERTAINTY = 0.100;
 
-protected:
-  std::unordered_map<std::string, Station> _stations; // indexed by station id
-  std::map<unsigned, Event> _events;                  // indexed by event id
-  std::unordered_multimap<unsigned, Phase> _phases;   // indexed by event id
+private:
+  using PhaseIterator = std::unordered_multimap<unsigned, Phase>::iterator;
+
+  struct StationData
+  {
+    std::unordered_map<std::string, Station> stations; // indexed by station id
+    std::unordered_map<std::string, Coordinates> coords;
+  };
+
+  /*
+   * Events and an index of their ids by the hash of the values compared by
+   * Event::operator==, which makes searchEvent a lookup
+   */
+  struct EventData
+  {
+    std::map<unsigned, Event>::const_iterator search(const Event &event) const;
+    void add(const Event &event); // replace an existing event with same id
+    void remove(unsigned eventId);
+    void rebuildIndex();
+
+    std::map<unsigned, Event> events; // indexed by event id
+    std::unordered_map<unsigned, Coordinates> coords;
+    std::unordered_multimap<size_t, unsigned> idsByValue;
+  };
+
+  /*
+   * Phases and their indices. The station ids are mapped to sequential
+   * integers so that the (event id, station, phase type) and (station, phase
+   * type) keys fit in a single integer. The indices reference the phases, so
+   * a copy rebuilds them.
+   */
+  struct PhaseData
+  {
+    PhaseData() = default;
+    PhaseData(const PhaseData &other);
+    PhaseData &operator=(const PhaseData &other) = delete;
+
+    bool search(unsigned eventId,
+                const std::string &stationId,
+                const Phase::Type &type,
+                PhaseIterator &it) const;
+    void add(const Phase &phase);
+    void remove(const PhaseIterator &it);
+    void removeEvent(unsigned eventId);
+
+    bool stationIndex(const std::string &stationId, uint64_t &index) const;
+    void index(const PhaseIterator &it);
+    void rebuildIndex();
+
+    std::unordered_multimap<unsigned, Phase> phases; // indexed by event id
+    std::unordered_map<std::string, uint64_t> stationIdx;
+    std::unordered_map<uint64_t, PhaseIterator> phaseIdx;
+    std::unordered_map<uint64_t, std::set<unsigned>> eventsByStationPhase;
+  };
+
+  // Access the data for modification, copying it first if it is shared with
+  // other catalogs
+  StationData &stationData();
+  EventData &eventData();
+  PhaseData &phaseData();
+
+  // add to `eventId` the phases of `otherEventId` in `other` it doesn't have
+  void mergePhases(unsigned eventId,
+                   unsigned otherEventId,
+                   const Catalog &other);
+
+  void updateEventCoordinates(const Event &event);
+  void updateStationCoordinates(const Station &station);
+  void updateAllCoordinates();
+
+  std::shared_ptr<StationData> _stationData = std::make_shared<StationData>();
+  std::shared_ptr<EventData> _eventData     = std::make_shared<EventData>();
+  std::shared_ptr<PhaseData> _phaseData     = std::make_shared<PhaseData>();
+
+  struct
+  {
+    double latitude  = 0;
+    double longitude = 0;
+    bool isSet       = false;
+    bool isFixed     = false; // set by the user
+  } _origin;
 };
 
 } // namespace HDD
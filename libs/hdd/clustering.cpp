@@ -19,6 +19,15 @@
 #include "utils.h"
 
 #include <seiscomp3/core/strings.h>
+#include <seiscomp3/math/geo.h>
+#include <seiscomp3/math/math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <numeric>
+#include <thread>
 
 #define SEISCOMP_COMPONENT HDD
 #include <seiscomp3/logging/log.h>
@@ -30,6 +39,28 @@ using Event   = HDD::Catalog::Event;
 using Phase   = HDD::Catalog::Phase;
 using Station = HDD::Catalog::Station;
 
+namespace {
+
+// Call `func` for each index in [0, size), using all the available cores.
+// `func` must not throw.
+void parallelFor(size_t size, const std::function<void(size_t)> &func)
+{
+  const size_t numThreads =
+      std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), size);
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < size; i = next++) func(i);
+  };
+
+  vector<std::thread> threads;
+  for (size_t t = 1; t < numThreads; t++) threads.emplace_back(worker);
+  worker();
+  for (std::thread &thread : threads) thread.join();
+}
+
+} // namespace
+
 namespace Seiscomp {
 namespace HDD {
 
@@ -52,6 +83,111 @@ CatalogPtr Neighbours::toCatalog(const CatalogCPtr &catalog,
   return returnCat;
 }
 
+EventSpatialIndex::EventSpatialIndex(double cellSize)
+{
+  // make the cells fit exactly the latitude/longitude ranges
+  _numLatCells = std::max(1, int(std::ceil(180. / cellSize)));
+  _numLonCells = std::max(1, int(std::ceil(360. / cellSize)));
+  _latCellSize = 180. / _numLatCells;
+  _lonCellSize = 360. / _numLonCells;
+}
+
+EventSpatialIndex::EventSpatialIndex(const Catalog &catalog, double cellSize)
+    : EventSpatialIndex(cellSize)
+{
+  for (const auto &kv : catalog.getEvents()) add(kv.second);
+}
+
+int EventSpatialIndex::latIndex(double lat) const
+{
+  int idx = int(std::floor((lat + 90.) / _latCellSize));
+  return std::min(std::max(idx, 0), _numLatCells - 1);
+}
+
+int EventSpatialIndex::lonIndex(double lon) const
+{
+  int idx = int(std::floor(lon / _lonCellSize)) % _numLonCells;
+  return idx < 0 ? idx + _numLonCells : idx;
+}
+
+void EventSpatialIndex::add(const Catalog::Event &event)
+{
+  remove(event.id);
+  const int64_t cell =
+      cellKey(latIndex(event.latitude), lonIndex(event.longitude));
+  _cells[cell].push_back(event.id);
+  _events[event.id] = Entry{event.depth, cell};
+}
+
+void EventSpatialIndex::remove(unsigned eventId)
+{
+  auto it = _events.find(eventId);
+  if (it == _events.end()) return;
+  auto cellIt           = _cells.find(it->second.cell);
+  vector<unsigned> &ids = cellIt->second;
+  ids.erase(std::find(ids.begin(), ids.end(), eventId));
+  if (ids.empty()) _cells.erase(cellIt);
+  _events.erase(it);
+}
+
+vector<unsigned> EventSpatialIndex::candidates(double lat,
+                                               double lon,
+                                               double depth,
+                                               double horizontalDist,
+                                               double verticalDist) const
+{
+  // The epicentral distance is computed on geocentric latitudes, which
+  // differ from the geographic ones by less than 1%: enlarge the search
+  // area accordingly
+  const double margin   = 1.01;
+  const double distance = Math::Geo::km2deg(horizontalDist) * margin + 1e-6;
+  const double minLat   = lat - distance;
+  const double maxLat   = lat + distance;
+
+  // The longitude range shrinks with the distance from the equator
+  // (haversine formula), unless the search area includes a pole
+  int firstLon = 0, lastLon = _numLonCells - 1;
+  if (minLat > -90 && maxLat < 90)
+  {
+    const double maxAbsLat = std::max(std::abs(minLat), std::abs(maxLat));
+    const double sinHalfLonDelta =
+        std::sin(deg2rad(distance) / 2) / std::cos(deg2rad(maxAbsLat));
+    if (sinHalfLonDelta < 1)
+    {
+      const double lonDelta =
+          rad2deg(2 * std::asin(sinHalfLonDelta)) * margin + 1e-6;
+      const int first = int(std::floor((lon - lonDelta) / _lonCellSize));
+      const int last  = int(std::floor((lon + lonDelta) / _lonCellSize));
+      if (last - first + 1 < _numLonCells)
+      {
+        firstLon = first;
+        lastLon  = last;
+      }
+    }
+  }
+
+  vector<unsigned> ids;
+  for (int latIdx = latIndex(minLat); latIdx <= latIndex(maxLat); latIdx++)
+  {
+    for (int i = firstLon; i <= lastLon; i++)
+    {
+      int lonIdx = i % _numLonCells;
+      if (lonIdx < 0) lonIdx += _numLonCells;
+
+      const auto &cellIt = _cells.find(cellKey(latIdx, lonIdx));
+      if (cellIt == _cells.end()) continue;
+
+      for (unsigned id : cellIt->second)
+      {
+        if (std::abs(_events.at(id).depth - depth) <= verticalDist)
+          ids.push_back(id);
+      }
+    }
+  }
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
 NeighboursPtr selectNeighbouringEvents(const CatalogCPtr &catalog,
                                        const Event &refEv,
                                        const CatalogCPtr &refEvCatalog,
@@ -65,7 +201,8 @@ NeighboursPtr selectNeighbouringEvents(const CatalogCPtr &catalog,
                                        unsigned maxNumNeigh,
                                        unsigned numEllipsoids,
                                        double maxEllipsoidSize,
-                                       bool keepUnmatched)
+                                       bool keepUnmatched,
+                                       const EventSpatialIndex *index)
 {
   SEISCOMP_INFO(
       "Selecting Neighbouring Events for event %s lat %.6f lon %.6f depth %.4f",
@@ -106,21 +243,42 @@ NeighboursPtr selectNeighbouringEvents(const CatalogCPtr &catalog,
   unordered_map<unsigned, double> distanceByEvent; // eventid, distance
   unordered_map<unsigned, double> azimuthByEvent;  // eventid, azimuth
 
-  for (const auto &kv : catalog->getEvents())
+  const Ellipsoid &outmostEllip = ellipsoids[0]->getOuterEllipsoid();
+
+  // Distances are computed in the catalog local coordinates, the ellipsoid
+  // boundaries are still checked geodetically
+  const Catalog::Coordinates refEvCoords = catalog->toLocalCoordinates(refEv);
+
+  // When the index is available, consider only the events in the outmost
+  // ellipsoid bounding box (in event id order, as the catalog)
+  vector<unsigned> candidateIds;
+  if (index)
+  {
+    candidateIds = index->candidates(
+        refEv.latitude, refEv.longitude, refEv.depth, outmostEllip.axis_a,
+        outmostEllip.axis_c * 1.01); // the exact check follows
+  }
+  else
+  {
+    candidateIds.reserve(catalog->getEvents().size());
+    for (const auto &kv : catalog->getEvents())
+      candidateIds.push_back(kv.first);
+  }
+
+  for (unsigned candidateId : candidateIds)
   {
-    const Event &event = kv.second;
+    const Event &event = catalog->getEvents().at(candidateId);
 
     if (event == refEv) continue;
 
     // drop event if outside the outmost ellipsod boundaries
-    HddEllipsoidPtr outmostEllip = ellipsoids[0];
-    if (!outmostEllip->getOuterEllipsoid().isInside(
-            event.latitude, event.longitude, event.depth))
+    if (!outmostEllip.isInside(event.latitude, event.longitude, event.depth))
       continue;
 
     // compute distance between current event and reference origin
     double azimuth;
-    double distance = computeDistance(refEv, event, &azimuth);
+    double distance = refEvCoords.distance(
+        catalog->getEventCoordinates(event.id), &azimuth);
 
     // keep a list of events in range sorted by distance
     eventByDistance.emplace(distance, event.id);
@@ -134,11 +292,11 @@ NeighboursPtr selectNeighbouringEvents(const CatalogCPtr &catalog,
   unordered_map<string, double> validatedStationDistance;
   for (const auto &kv : catalog->getStations())
   {
-    const string &staId    = kv.first;
-    const Station &station = kv.second;
+    const string &staId = kv.first;
 
     // compute distance between reference event and station
-    double staRefEvDistance = computeDistance(refEv, station);
+    double staRefEvDistance =
+        refEvCoords.distance(catalog->getStationCoordinates(staId));
 
     // check if station distance is ok
     if ((maxESdist <= 0 || staRefEvDistance <= maxESdist) || // too far away ?
@@ -177,8 +335,7 @@ NeighboursPtr selectNeighbouringEvents(const CatalogCPtr &catalog,
     auto eqlrng = catalog->getPhases().equal_range(event.id);
     for (auto it = eqlrng.first; it != eqlrng.second; ++it)
     {
-      const Phase &phase     = it->second;
-      const Station &station = catalog->getStations().at(phase.stationId);
+      const Phase &phase = it->second;
 
       // check pick weight
       if (phase.procInfo.weight < minPhaseWeight) continue;
@@ -198,7 +355,9 @@ NeighboursPtr selectNeighbouringEvents(const CatalogCPtr &catalog,
       if (maxESdist > 0 || minESdist > 0 || minEStoIEratio > 0)
       {
         // compute distance between current event and station
-        double stationDistance = computeDistance(event, station);
+        double stationDistance =
+            catalog->getEventCoordinates(event.id).distance(
+                catalog->getStationCoordinates(phase.stationId));
 
         if ((maxESdist > 0 && stationDistance > maxESdist) || // too far away ?
             (stationDistance < minESdist) ||                  // too close ?
@@ -390,95 +549,89 @@ list<NeighboursPtr> selectNeighbouringEventsCatalog(const CatalogCPtr &catalog,
 {
   SEISCOMP_INFO("Selecting Catalog Neighbouring Events ");
 
-  // neighbours for each event
-  list<NeighboursPtr> neighboursList;
-
-  // for each event find the neighbours
   CatalogPtr validCatalog = new Catalog(*catalog);
-  list<unsigned> todoEvents;
+  EventSpatialIndex index(*validCatalog);
+
+  // const reference used by the worker threads, so that they don't touch
+  // the catalog reference count
+  const CatalogCPtr constCatalog = validCatalog;
+
+  map<unsigned, NeighboursPtr> neighboursByEvent; // key event id
+  // for each event, the events that selected it as neighbour
+  unordered_map<unsigned, unordered_set<unsigned>> referencedBy;
+
+  vector<unsigned> todoEvents;
   for (const auto &kv : validCatalog->getEvents())
     todoEvents.push_back(kv.first);
 
   while (!todoEvents.empty())
   {
-    list<NeighboursPtr> newNeighbourCats;
-    vector<unsigned> removedEvents;
-
-    // for each event find the neighbours
-    for (unsigned evIdTodo : todoEvents)
-    {
-      Catalog::Event event = validCatalog->getEvents().find(evIdTodo)->second;
-
-      NeighboursPtr neighbours;
+    // The catalog doesn't change while the neighbours of the pending events
+    // are computed, so they can be computed in parallel
+    vector<NeighboursPtr> newNeighbours(todoEvents.size());
+    parallelFor(todoEvents.size(), [&](size_t i) {
+      const Event &event = constCatalog->getEvents().at(todoEvents[i]);
       try
       {
-        neighbours = selectNeighbouringEvents(
-            validCatalog, event, validCatalog, minPhaseWeight, minESdist,
+        newNeighbours[i] = selectNeighbouringEvents(
+            constCatalog, event, constCatalog, minPhaseWeight, minESdist,
             maxESdist, minEStoIEratio, minDTperEvt, maxDTperEvt, minNumNeigh,
-            maxNumNeigh, numEllipsoids, maxEllipsoidSize, keepUnmatched);
+            maxNumNeigh, numEllipsoids, maxEllipsoidSize, keepUnmatched,
+            &index);
       }
       catch (...)
       {}
+    });
 
+    vector<unsigned> removedEvents;
+    for (size_t i = 0; i < todoEvents.size(); i++)
+    {
+      const NeighboursPtr &neighbours = newNeighbours[i];
       if (!neighbours)
       {
         // event discarded because it doesn't satisfy requirements
-        removedEvents.push_back(event.id);
-        // next loop we don't want other events to pick this as neighbour
-        validCatalog->removeEvent(event.id);
-        todoEvents.remove(event.id); // this invalidates the loop !
-        // stop here because we dont' want to keep building potentially wrong
-        // neighbours
-        break;
+        removedEvents.push_back(todoEvents[i]);
+        continue;
       }
-
-      newNeighbourCats.push_back(neighbours);
+      neighboursByEvent[neighbours->refEvId] = neighbours;
+      for (unsigned neighbourId : neighbours->ids)
+        referencedBy[neighbourId].insert(neighbours->refEvId);
     }
 
-    // add newly computed neighbors catalogs to previous ones
-    for (NeighboursPtr &neighbours : newNeighbourCats)
+    // Other events must not pick the discarded ones as neighbour: remove them
+    // from the catalog and compute again the neighbours of the events that
+    // used them. The neighbours of the other events are not affected.
+    set<unsigned> invalidEvents;
+    for (unsigned removedEventId : removedEvents)
     {
-      neighboursList.push_back(neighbours);
-      // make sure we won't recompute what has been already done
-      todoEvents.remove(neighbours->refEvId);
+      validCatalog->removeEvent(removedEventId);
+      index.remove(removedEventId);
+
+      const auto &referencedByIt = referencedBy.find(removedEventId);
+      if (referencedByIt == referencedBy.end()) continue;
+      invalidEvents.insert(referencedByIt->second.begin(),
+                           referencedByIt->second.end());
+      referencedBy.erase(referencedByIt);
     }
 
-    // check if the removed events were used as neighbour of any other event;
-    // if so rebuild neighbours for those events
-    bool redo;
-    do
+    for (unsigned invalidEventId : invalidEvents)
     {
-      redo = false;
-      list<NeighboursPtr> validNeighbourCats;
-
-      for (NeighboursPtr &neighbours : neighboursList)
+      const auto &neighboursIt = neighboursByEvent.find(invalidEventId);
+      for (unsigned neighbourId : neighboursIt->second->ids)
       {
-        bool currCatInvalid = false;
-        for (unsigned removedEventId : removedEvents)
-        {
-          if (neighbours->ids.count(removedEventId) != 0)
-          {
-            currCatInvalid = true;
-            break;
-          }
-        }
-
-        if (currCatInvalid)
-        {
-          removedEvents.push_back(neighbours->refEvId);
-          todoEvents.push_back(neighbours->refEvId);
-          redo = true;
-          continue;
-        }
-        validNeighbourCats.push_back(neighbours);
+        const auto &referencedByIt = referencedBy.find(neighbourId);
+        if (referencedByIt != referencedBy.end())
+          referencedByIt->second.erase(invalidEventId);
       }
+      neighboursByEvent.erase(neighboursIt);
+    }
 
-      neighboursList.clear();
-      neighboursList = validNeighbourCats;
-
-    } while (redo);
+    todoEvents.assign(invalidEvents.begin(), invalidEvents.end());
   }
 
+  // neighbours for each event
+  list<NeighboursPtr> neighboursList;
+  for (const auto &kv : neighboursByEvent) neighboursList.push_back(kv.second);
   return neighboursList;
 }
 
@@ -487,92 +640,93 @@ list<NeighboursPtr> selectNeighbouringEventsCatalog(const CatalogCPtr &catalog,
  *
  * Also, we don't want to report the same pair multiple times
  * (e.g. ev1-ev2 and ev2-ev1) since we only want one observation
- * per pair
+ * per pair: the pair is kept by the event with the lowest id.
+ *
+ * The clusters are built with a union-find over the events, which are
+ * connected when one of them is a neighbour of the other.
  */
 deque<list<NeighboursPtr>>
 clusterizeNeighbouringEvents(const list<NeighboursPtr> &neighboursList)
 {
-  map<unsigned, list<NeighboursPtr>> clusters;
-
-  unordered_map<unsigned, unsigned> clusterIdByEvent; // event id, cluster id
-
-  unordered_map<unsigned, NeighboursPtr> neighboursByEvent; // key event id
+  // dense indices: events sorted by id
+  map<unsigned, NeighboursPtr> neighboursByEvent; // key event id
   for (const NeighboursPtr &neighbours : neighboursList)
     neighboursByEvent[neighbours->refEvId] = neighbours;
 
-  while (!neighboursByEvent.empty())
+  vector<NeighboursPtr> events;
+  unordered_map<unsigned, unsigned> indexByEvent; // event id, dense index
+  events.reserve(neighboursByEvent.size());
+  indexByEvent.reserve(neighboursByEvent.size());
+  for (const auto &kv : neighboursByEvent)
   {
-    // keep track of event pairs found (for dropping identical pairs)
-    unordered_multimap<unsigned, unsigned> discoveredPairs;
-
-    // start traversal with first unseen event neighbours
-    unordered_set<unsigned> clusterEvs({neighboursByEvent.begin()->first});
+    indexByEvent.emplace(kv.first, events.size());
+    events.push_back(kv.second);
+  }
 
-    list<NeighboursPtr> currentCluster;
-    unordered_set<unsigned> connectedClusters;
+  // union-find with path halving and union by size
+  vector<unsigned> parent(events.size());
+  vector<unsigned> clusterSize(events.size(), 1);
+  std::iota(parent.begin(), parent.end(), 0);
 
-    while (!clusterEvs.empty()) // when empty, the cluster is fully built
+  auto find = [&parent](unsigned idx) {
+    while (parent[idx] != idx)
     {
-      unsigned currentEv = *clusterEvs.begin();
-      clusterEvs.erase(currentEv);
-
-      // keep track of clusters connected to the current one
-      if (clusterIdByEvent.find(currentEv) != clusterIdByEvent.end())
-        connectedClusters.insert(clusterIdByEvent.at(currentEv));
-
-      const auto &neighboursByEventIt = neighboursByEvent.find(currentEv);
-
-      // skip already processed events
-      if (neighboursByEventIt == neighboursByEvent.end()) continue;
+      parent[idx] = parent[parent[idx]];
+      idx         = parent[idx];
+    }
+    return idx;
+  };
 
-      NeighboursPtr neighbours = neighboursByEventIt->second;
-      neighboursByEvent.erase(neighbours->refEvId);
+  auto unite = [&](unsigned idx1, unsigned idx2) {
+    idx1 = find(idx1);
+    idx2 = find(idx2);
+    if (idx1 == idx2) return;
+    if (clusterSize[idx1] < clusterSize[idx2]) std::swap(idx1, idx2);
+    parent[idx2] = idx1;
+    clusterSize[idx1] += clusterSize[idx2];
+  };
 
-      // update the set for the traversal of this cluster
-      for (unsigned neighEvId : neighbours->ids) clusterEvs.insert(neighEvId);
+  for (unsigned idx = 0; idx < events.size(); idx++)
+  {
+    NeighboursPtr &neighbours = events[idx];
 
-      // remove from current neighbours the pairs that appeared previously
-      // in this cluster
-      auto eqlrng = discoveredPairs.equal_range(neighbours->refEvId);
-      for (auto existingPair = eqlrng.first; existingPair != eqlrng.second;
-           existingPair++)
-      {
-        neighbours->ids.erase(existingPair->second);
-        neighbours->phases.erase(existingPair->second);
-      }
+    vector<unsigned> duplicatedPairs;
+    for (unsigned neighEvId : neighbours->ids)
+    {
+      // only the events with neighbours can be part of a cluster
+      const auto &neighIdxIt = indexByEvent.find(neighEvId);
+      if (neighIdxIt == indexByEvent.end()) continue;
+      const unsigned neighIdx = neighIdxIt->second;
 
-      // keep track of new event pairs for following iterations and
-      // update the queue for the breadth-first traversal
-      for (unsigned neighEvId : neighbours->ids)
-        discoveredPairs.emplace(neighEvId, neighbours->refEvId);
+      unite(idx, neighIdx);
 
-      // populate current cluster
-      currentCluster.push_back(neighbours);
+      // the neighbour has a lower id and it already reported this pair
+      if (neighIdx < idx && events[neighIdx]->has(neighbours->refEvId))
+        duplicatedPairs.push_back(neighEvId);
     }
 
-    if (!connectedClusters.empty())
+    for (unsigned neighEvId : duplicatedPairs)
     {
-      // merge all connected clusters to the current one
-      for (unsigned clusterId : connectedClusters)
-      {
-        currentCluster.splice(currentCluster.end(), clusters[clusterId]);
-        clusters.erase(clusterId);
-      }
+      neighbours->ids.erase(neighEvId);
+      neighbours->phases.erase(neighEvId);
     }
-
-    // save current cluster
-    unsigned maxKey       = clusters.empty() ? 0 : clusters.rbegin()->first;
-    unsigned newClusterId = maxKey + 1;
-
-    clusters[newClusterId] = currentCluster;
-
-    for (const NeighboursPtr &n : currentCluster)
-      clusterIdByEvent[n->refEvId] = newClusterId;
   }
 
-  deque<list<NeighboursPtr>> returnClusters;
-  for (auto &kv : clusters) returnClusters.push_back(kv.second);
-  return returnClusters;
+  // clusters ordered by their lowest event id
+  deque<list<NeighboursPtr>> clusters;
+  unordered_map<unsigned, unsigned> clusterByRoot; // root index, position
+  for (unsigned idx = 0; idx < events.size(); idx++)
+  {
+    const unsigned root = find(idx);
+    auto it             = clusterByRoot.find(root);
+    if (it == clusterByRoot.end())
+    {
+      it = clusterByRoot.emplace(root, clusters.size()).first;
+      clusters.emplace_back();
+    }
+    clusters[it->second].push_back(events[idx]);
+  }
+  return clusters;
 }
 
 } // namespace HDD
@@ -18,12 +18,14 @@
 #define __HDD_CLUSTERING_H__
 
 #include "catalog.h"
+#include <cstdint>
 #include <deque>
 #include <list>
 #include <seiscomp3/core/baseobject.h>
 #include <set>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace Seiscomp {
 namespace HDD {
@@ -90,21 +92,66 @@ struct Neighbours : public Core::BaseObject
                        bool includeRefEv = false) const;
 };
 
+/*
+ * Uniform latitude/longitude grid of catalog events, used to find the
+ * events close to a location without scanning the whole catalog. The index
+ * must be kept in sync with the catalog it was built from.
+ */
+class EventSpatialIndex
+{
+public:
+  explicit EventSpatialIndex(double cellSize = 0.1); // degrees
+  explicit EventSpatialIndex(const Catalog &catalog, double cellSize = 0.1);
+
+  void add(const Catalog::Event &event);
+  void remove(unsigned eventId);
+  size_t size() const { return _events.size(); }
+
+  // Return the sorted ids of the events that might be within
+  // `horizontalDist` km (epicentral distance) and within `verticalDist` km
+  // depth difference from the given location. The result is a superset of
+  // those events: the caller has to check the actual distance.
+  std::vector<unsigned> candidates(double lat,
+                                   double lon,
+                                   double depth,
+                                   double horizontalDist,
+                                   double verticalDist) const;
+
+private:
+  int latIndex(double lat) const;
+  int lonIndex(double lon) const;
+  int64_t cellKey(int latIdx, int lonIdx) const
+  {
+    return int64_t(latIdx) * _numLonCells + lonIdx;
+  }
+
+  struct Entry
+  {
+    double depth;
+    int64_t cell;
+  };
+  int _numLatCells, _numLonCells;
+  double _latCellSize, _lonCellSize;
+  std::unordered_map<int64_t, std::vector<unsigned>> _cells;
+  std::unordered_map<unsigned, Entry> _events; // indexed by event id
+};
+
 NeighboursPtr
 selectNeighbouringEvents(const CatalogCPtr &catalog,
                          const Catalog::Event &refEv,
                          const CatalogCPtr &refEvCatalog,
-                         double minPhaseWeight   = 0,
-                         double minESdis         = 0,
-                         double maxESdis         = -1, // -1 = no limits
-                         double minEStoIEratio   = 0,
-                         unsigned minDTperEvt    = 1,
-                         unsigned maxDTperEvt    = 0, // 0 = no limits
-                         unsigned minNumNeigh    = 1,
-                         unsigned maxNumNeigh    = 0, // 0 = no limits
-                         unsigned numEllipsoids  = 5,
-                         double maxEllipsoidSize = 10,
-                         bool keepUnmatched      = false);
+                         double minPhaseWeight          = 0,
+                         double minESdis                = 0,
+                         double maxESdis                = -1, // -1 = no limits
+                         double minEStoIEratio          = 0,
+                         unsigned minDTperEvt           = 1,
+                         unsigned maxDTperEvt           = 0, // 0 = no limits
+                         unsigned minNumNeigh           = 1,
+                         unsigned maxNumNeigh           = 0, // 0 = no limits
+                         unsigned numEllipsoids         = 5,
+                         double maxEllipsoidSize        = 10,
+                         bool keepUnmatched             = false,
+                         const EventSpatialIndex *index = nullptr); // optional
 
 std::list<NeighboursPtr>
 selectNeighbouringEventsCatalog(const CatalogCPtr &catalog,
@@ -14,13 +14,22 @@
  *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
  ***************************************************************************/
 
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <istream>
 #include <iterator>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "csvreader.h"
 
 using namespace std;
@@ -160,6 +169,159 @@ readWithHeader(const string &filename, const vector<string> &header)
   return readWithHeader(csvfile, header);
 }
 
+bool Field::operator==(const char *other) const
+{
+  return std::strlen(other) == _size && std::memcmp(_data, other, _size) == 0;
+}
+
+double Field::toDouble() const
+{
+  // the field is not null terminated
+  char buf[64];
+  string longField;
+  const char *str = buf;
+  if (_size < sizeof(buf))
+  {
+    std::memcpy(buf, _data, _size);
+    buf[_size] = '\0';
+  }
+  else
+  {
+    longField = this->str();
+    str       = longField.c_str();
+  }
+
+  char *end;
+  errno        = 0;
+  double value = std::strtod(str, &end);
+  if (end == str || errno == ERANGE)
+    throw runtime_error("Invalid floating point value '" + this->str() + "'");
+  return value;
+}
+
+unsigned long Field::toUnsigned() const
+{
+  char buf[32];
+  if (_size >= sizeof(buf))
+    throw runtime_error("Invalid integer value '" + this->str() + "'");
+  std::memcpy(buf, _data, _size);
+  buf[_size] = '\0';
+
+  char *end;
+  errno               = 0;
+  unsigned long value = std::strtoul(buf, &end, 10);
+  if (end == buf || errno == ERANGE)
+    throw runtime_error("Invalid integer value '" + this->str() + "'");
+  return value;
+}
+
+Reader::Reader(const string &filename) : _filename(filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    throw runtime_error("Cannot open file " + filename + " (" +
+                        std::strerror(errno) + ")");
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    throw runtime_error("Cannot stat file " + filename + " (" +
+                        std::strerror(errno) + ")");
+  }
+
+  if (st.st_size > 0)
+  {
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      close(fd);
+      throw runtime_error("Cannot memory-map file " + filename + " (" +
+                          std::strerror(errno) + ")");
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    _data = static_cast<const char *>(data);
+    _size = st.st_size;
+  }
+  close(fd); // the mapping keeps a reference to the file
+
+  Field line;
+  if (nextLine(line)) _header = readRow(line.str());
+}
+
+Reader::~Reader()
+{
+  if (_data) munmap(const_cast<char *>(_data), _size);
+}
+
+int Reader::column(const string &name) const
+{
+  for (size_t i = 0; i < _header.size(); i++)
+  {
+    if (_header[i] == name) return i;
+  }
+  return -1;
+}
+
+int Reader::requiredColumn(const string &name) const
+{
+  int idx = column(name);
+  if (idx < 0)
+    throw runtime_error("Missing column " + name + " in file " + _filename);
+  return idx;
+}
+
+bool Reader::next()
+{
+  Field line;
+  if (!nextLine(line)) return false;
+  split(line);
+  return true;
+}
+
+bool Reader::nextLine(Field &line)
+{
+  if (_pos >= _size) return false;
+  const char *begin = _data + _pos;
+  const char *end =
+      static_cast<const char *>(std::memchr(begin, '\n', _size - _pos));
+  if (!end) end = _data + _size;
+  line = Field(begin, end - begin);
+  _pos = (end - _data) + 1;
+  return true;
+}
+
+void Reader::split(const Field &line)
+{
+  _fields.clear();
+
+  // quoted fields need unescaping, let readRow handle them
+  if (std::memchr(line.data(), '"', line.size()))
+  {
+    _unquoted = readRow(line.str());
+    for (const string &field : _unquoted)
+      _fields.emplace_back(field.data(), field.size());
+    return;
+  }
+
+  const char *begin = line.data();
+  const char *end   = line.data() + line.size();
+  while (true)
+  {
+    const char *comma =
+        static_cast<const char *>(std::memchr(begin, ',', end - begin));
+    if (!comma)
+    {
+      _fields.emplace_back(begin, end - begin);
+      break;
+    }
+    _fields.emplace_back(begin, comma - begin);
+    begin = comma + 1;
+  }
+}
+
 } // namespace CSV
 } // namespace HDD
 } // namespace Seiscomp
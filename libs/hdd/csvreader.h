@@ -17,7 +17,9 @@
 #ifndef __HDD_CSVREADER_H__
 #define __HDD_CSVREADER_H__
 
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace Seiscomp {
 namespace HDD {
@@ -86,6 +88,90 @@ std::vector<std::unordered_map<std::string, std::string>>
 readWithHeader(const std::string &filename,
                const std::vector<std::string> &header);
 
+/*
+ * A field of the row currently read by Reader. It points inside the file
+ * content (or to an unescaped copy for quoted fields) without copying it, so
+ * it is valid only until the next row is read.
+ */
+class Field
+{
+public:
+  Field() = default;
+  Field(const char *data, size_t size) : _data(data), _size(size) {}
+
+  const char *data() const { return _data; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  std::string str() const { return std::string(_data, _size); }
+
+  bool operator==(const char *other) const;
+  bool operator!=(const char *other) const { return !operator==(other); }
+
+  // same parsing rules as std::stod/std::stoul
+  double toDouble() const;
+  unsigned long toUnsigned() const;
+
+private:
+  const char *_data = "";
+  size_t _size      = 0;
+};
+
+/*
+ * Streaming reader for files with header. The file is memory-mapped and
+ * split in place one row at a time, following the same rules as read(), so
+ * that no per-row containers are allocated. The header columns are resolved
+ * to indices once, then each row field is accessed by index.
+ *
+ * E.g.
+
+ CSV::Reader reader("event.csv");
+ const int idCol = reader.requiredColumn("id");
+ while (reader.next())
+ {
+   unsigned id = reader.field(idCol).toUnsigned();
+ }
+
+ */
+class Reader
+{
+public:
+  explicit Reader(const std::string &filename);
+  ~Reader();
+
+  Reader(const Reader &) = delete;
+  Reader &operator=(const Reader &) = delete;
+
+  const std::vector<std::string> &header() const { return _header; }
+
+  // index of the header column `name` or -1 if missing
+  int column(const std::string &name) const;
+  // same as above, but throws if the column is missing
+  int requiredColumn(const std::string &name) const;
+
+  // move to the next row, return false at the end of the file
+  bool next();
+
+  // field of the current row, empty if the row has less fields than the
+  // header or the column is -1
+  Field field(int column) const
+  {
+    return (column >= 0 && size_t(column) < _fields.size()) ? _fields[column]
+                                                            : Field();
+  }
+
+private:
+  bool nextLine(Field &line);
+  void split(const Field &line);
+
+  std::string _filename;
+  const char *_data = nullptr;
+  size_t _size      = 0;
+  size_t _pos       = 0;
+  std::vector<std::string> _header;
+  std::vector<Field> _fields;
+  std::vector<std::string> _unquoted; // storage of quoted fields
+};
+
 } // namespace CSV
 } // namespace HDD
 } // namespace Seiscomp
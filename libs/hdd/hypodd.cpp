@@ -24,13 +24,19 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <set>
 #include <seiscomp3/client/inventory.h>
 #include <seiscomp3/core/datetime.h>
 #include <seiscomp3/core/strings.h>
 #include <seiscomp3/core/typedarray.h>
 #include <seiscomp3/io/recordinput.h>
+#include <seiscomp3/math/math.h>
 #include <seiscomp3/utils/files.h>
+#include <sstream>
 #include <stdexcept>
+#include <tuple>
 
 #define SEISCOMP_COMPONENT HDD
 #include <seiscomp3/logging/file.h>
@@ -44,6 +50,35 @@ using Phase   = HDD::Catalog::Phase;
 using Station = HDD::Catalog::Station;
 using HDD::Waveform::getBandAndInstrumentCodes;
 
+namespace {
+
+// FNV-1a: unlike std::hash the result is stable across runs and builds,
+// which is needed for values stored on disk
+void stableHashUpdate(uint64_t &hash, const string &str)
+{
+  for (unsigned char c : str)
+  {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+}
+
+string stableHashToString(uint64_t hash)
+{
+  return stringify("%016llx", (unsigned long long)hash);
+}
+
+const uint64_t STABLE_HASH_INIT = 14695981039346656037ULL;
+
+string stableHash(const string &str)
+{
+  uint64_t hash = STABLE_HASH_INIT;
+  stableHashUpdate(hash, str);
+  return stableHashToString(hash);
+}
+
+} // namespace
+
 namespace Seiscomp {
 namespace HDD {
 
@@ -95,6 +130,8 @@ void HypoDD::setCatalog(const CatalogCPtr &catalog)
   _srcCat = catalog;
   _bgCat  = Catalog::filterPhasesAndSetWeights(
       *_srcCat, Phase::Source::CATALOG, _cfg.validPphases, _cfg.validSphases);
+  _bgCatIndex = EventSpatialIndex(*_bgCat);
+  _fixedObsParams.values.clear();
 }
 
 void HypoDD::setUseCatalogWaveformDiskCache(bool cache)
@@ -103,48 +140,282 @@ void HypoDD::setUseCatalogWaveformDiskCache(bool cache)
   createWaveformCache();
 }
 
+void HypoDD::loadTTT()
+{
+  if (_ttt) return;
+
+  // profiles using the same table share it
+  _ttt = TravelTimeTableRegistry::instance().get(
+      _cfg.ttt.type, _cfg.ttt.model, _cfg.ttt.lookupTable);
+}
+
+void HypoDD::unloadTTT()
+{
+  if (_ttt) TravelTimeTableRegistry::instance().release(_ttt);
+}
+
+string HypoDD::fixedObservationParamsFile() const
+{
+  return (boost::filesystem::path(_workingDir) / "fixed-obs-params.csv")
+      .string();
+}
+
+string HypoDD::fixedObservationParamsHash()
+{
+  loadTTT();
+
+  // The parameters depend on the background events/stations locations and
+  // on the travel time table: store a hash of those along with the values.
+  // The phases are hashed in (event, station, phase) order, so that the
+  // hash doesn't depend on the catalog containers iteration order. The table
+  // files are identified by size and modification time, so that replacing
+  // them in place invalidates the stored values too
+  uint64_t hash = STABLE_HASH_INIT;
+  stableHashUpdate(hash, stringify("%s|%s|%d", _cfg.ttt.type.c_str(),
+                                   _cfg.ttt.model.c_str(),
+                                   int(_cfg.ttt.lookupTable)));
+  set<tuple<unsigned, string, char>> phases;
+  for (const auto &kv : _bgCat->getPhases())
+  {
+    const Phase &phase = kv.second;
+    phases.emplace(phase.eventId, phase.stationId, char(phase.procInfo.type));
+  }
+  set<pair<string, char>> stationPhases;
+  for (const auto &p : phases)
+  {
+    const Event &event     = _bgCat->getEvents().at(get<0>(p));
+    const Station &station = _bgCat->getStations().at(get<1>(p));
+    stableHashUpdate(
+        hash, stringify("%u|%s|%c|%.6f|%.6f|%.6f|%.6f|%.6f|%.6f", event.id,
+                        station.id.c_str(), get<2>(p), event.latitude,
+                        event.longitude, event.depth, station.latitude,
+                        station.longitude, station.elevation));
+    stationPhases.emplace(station.id, get<2>(p));
+  }
+  set<string> tableFiles;
+  for (const auto &sp : stationPhases)
+  {
+    for (const string &f : _ttt->dataFiles(_bgCat->getStations().at(sp.first),
+                                            string(1, sp.second)))
+    {
+      tableFiles.insert(f);
+    }
+  }
+  for (const string &f : tableFiles)
+  {
+    boost::system::error_code ec1, ec2;
+    const uintmax_t size = boost::filesystem::file_size(f, ec1);
+    const time_t mtime   = boost::filesystem::last_write_time(f, ec2);
+    stableHashUpdate(hash, (ec1 || ec2)
+                               ? f + "|missing"
+                               : stringify("%s|%ju|%lld", f.c_str(), size,
+                                           (long long)mtime));
+  }
+  return stableHashToString(hash);
+}
+
+bool HypoDD::readFixedObservationParams(const string &hash)
+{
+  const string file = fixedObservationParamsFile();
+
+  _fixedObsParams.values.clear();
+
+  // file format: the hash on the first line, then one
+  // "event id,station id,phase type,travel time,azimuth,dip,velocity"
+  // entry per line
+  if (!Util::fileExists(file)) return false;
+
+  std::ifstream ifs(file);
+  string line;
+  if (!getline(ifs, line) || line != hash) return false;
+
+  unsigned count = 0;
+  while (getline(ifs, line))
+  {
+    std::istringstream iss(line);
+    unsigned eventId;
+    FixedObservationParams::Value v;
+    char sep;
+    if (!(iss >> eventId >> sep) || !getline(iss, v.stationId, ',') ||
+        !(iss >> v.phaseType >> sep >> v.travelTime >> sep >>
+          v.takeOfAngleAzim >> sep >> v.takeOfAngleDip >> sep >>
+          v.velocityAtSrc))
+    {
+      SEISCOMP_WARNING("Ignoring malformed line in %s: %s", file.c_str(),
+                       line.c_str());
+      continue;
+    }
+    _fixedObsParams.values[eventId].push_back(v);
+    count++;
+  }
+  SEISCOMP_INFO("Loaded %u fixed observation parameters from %s", count,
+                file.c_str());
+  return true;
+}
+
+bool HypoDD::loadFixedObservationParams()
+{
+  // avoid hashing the catalog when there is nothing to load
+  if (!Util::fileExists(fixedObservationParamsFile()))
+  {
+    _fixedObsParams.values.clear();
+    return false;
+  }
+  return readFixedObservationParams(fixedObservationParamsHash());
+}
+
+bool HypoDD::precomputeFixedObservationParams()
+{
+  const string file    = fixedObservationParamsFile();
+  const string hashStr = fixedObservationParamsHash();
+
+  if (readFixedObservationParams(hashStr)) return true;
+
+  SEISCOMP_INFO("Computing fixed observation parameters for %lu events",
+                _bgCat->getEvents().size());
+
+  vector<const Station *> stations;
+  vector<string> phaseTypes;
+  vector<double> travelTimes, takeOfAngleAzims, takeOfAngleDips,
+      velocitiesAtSrc;
+  vector<string> errors;
+  unsigned count = 0;
+
+  for (const auto &kv : _bgCat->getEvents())
+  {
+    const Event &event = kv.second;
+
+    stations.clear();
+    phaseTypes.clear();
+    auto eqlrng = _bgCat->getPhases().equal_range(event.id);
+    for (auto it = eqlrng.first; it != eqlrng.second; ++it)
+    {
+      const Phase &phase = it->second;
+      stations.push_back(&_bgCat->getStations().at(phase.stationId));
+      phaseTypes.push_back(string(1, char(phase.procInfo.type)));
+    }
+    if (stations.empty()) continue;
+
+    _ttt->computeBatch(event, stations, phaseTypes, travelTimes,
+                       takeOfAngleAzims, takeOfAngleDips, velocitiesAtSrc,
+                       errors);
+
+    vector<FixedObservationParams::Value> &values =
+        _fixedObsParams.values[event.id];
+    for (size_t i = 0; i < stations.size(); i++)
+    {
+      // failures are left to the relocation, which reports them
+      if (!errors[i].empty()) continue;
+      values.push_back(FixedObservationParams::Value{
+          stations[i]->id, phaseTypes[i].at(0), travelTimes[i],
+          takeOfAngleAzims[i], takeOfAngleDips[i], velocitiesAtSrc[i]});
+      count++;
+    }
+  }
+
+  std::ofstream ofs(file, std::ios::trunc);
+  if (!ofs)
+  {
+    SEISCOMP_WARNING("Cannot write to %s", file.c_str());
+    return false;
+  }
+  ofs << hashStr << std::endl;
+  ofs << std::setprecision(std::numeric_limits<double>::max_digits10);
+  for (const auto &kv : _fixedObsParams.values)
+  {
+    for (const FixedObservationParams::Value &v : kv.second)
+    {
+      ofs << kv.first << "," << v.stationId << "," << v.phaseType << ","
+          << v.travelTime << "," << v.takeOfAngleAzim << ","
+          << v.takeOfAngleDip << "," << v.velocityAtSrc << "\n";
+    }
+  }
+  SEISCOMP_INFO("Stored %u fixed observation parameters to %s", count,
+                file.c_str());
+  return false;
+}
+
 void HypoDD::createWaveformCache()
 {
   _wfAccess.unloadableWfs.clear();
   _wfAccess.loader    = nullptr;
   _wfAccess.diskCache = nullptr;
+  _wfAccess.projCache = nullptr;
   _wfAccess.extraLen  = nullptr;
   _wfAccess.snrFilter = nullptr;
   _wfAccess.memCache  = nullptr;
 
-  _wfAccess.loader = new Waveform::Loader(_cfg.recordStreamURL);
+  if (_cfg.wfStrip.blockLen > 0)
+  {
+    _wfAccess.loader = new Waveform::StripCachedLoader(
+        _cfg.recordStreamURL, _cfg.wfStrip.blockLen, _cfg.wfStrip.maxBlocks);
+  }
+  else
+  {
+    _wfAccess.loader = new Waveform::Loader(_cfg.recordStreamURL);
+  }
 
   if (_useCatalogWaveformDiskCache)
   {
     _wfAccess.diskCache =
         new Waveform::DiskCachedLoader(_wfAccess.loader, _cacheDir);
+    _wfAccess.projCache =
+        new Waveform::ProjectionCachedLoader(_wfAccess.diskCache);
     _wfAccess.extraLen =
-        new Waveform::ExtraLenLoader(_wfAccess.diskCache, DISK_TRACE_MIN_LEN);
+        new Waveform::ExtraLenLoader(_wfAccess.projCache, DISK_TRACE_MIN_LEN);
+
+    // The data availability depends on the data source only, while the SNR
+    // verdicts depend on the processing too: use a different file for each
+    // configuration
+    const string snrCfg = stringify(
+        "%s|%s|%.6f|%.6f|%.6f|%.6f|%.6f|%.6f", _cfg.recordStreamURL.c_str(),
+        _cfg.wfFilter.filterStr.c_str(), _cfg.wfFilter.resampleFreq,
+        _cfg.snr.minSnr, _cfg.snr.noiseStart, _cfg.snr.noiseEnd,
+        _cfg.snr.signalStart, _cfg.snr.signalEnd);
+
+    // Only the data fetched by the catalog loader is persisted: the data of
+    // a real-time event might simply not be available yet
+    _wfAccess.loader->setExclusionList(new Waveform::ExclusionList(
+        (boost::filesystem::path(_cacheDir) /
+         ("unavailable-" + stableHash(_cfg.recordStreamURL) + ".csv"))
+            .string(),
+        _cfg.wfExclusion.unavailableExpiry));
 
     if (_cfg.snr.minSnr > 0)
     {
       _wfAccess.snrFilter = new Waveform::SnrFilteredLoader(
           _wfAccess.extraLen, _cfg.snr.minSnr, _cfg.snr.noiseStart,
           _cfg.snr.noiseEnd, _cfg.snr.signalStart, _cfg.snr.signalEnd);
-      _wfAccess.memCache = new Waveform::MemCachedLoader(_wfAccess.snrFilter);
+      _wfAccess.snrFilter->setExclusionList(new Waveform::ExclusionList(
+          (boost::filesystem::path(_cacheDir) /
+           ("snr-low-" + stableHash(snrCfg) + ".csv"))
+              .string()));
+      _wfAccess.memCache = new Waveform::MemCachedLoader(
+          _wfAccess.snrFilter, _cfg.wfCompactCache);
     }
     else
     {
-      _wfAccess.memCache = new Waveform::MemCachedLoader(_wfAccess.extraLen);
+      _wfAccess.memCache = new Waveform::MemCachedLoader(
+          _wfAccess.extraLen, _cfg.wfCompactCache);
     }
   }
   else
   {
+    _wfAccess.projCache =
+        new Waveform::ProjectionCachedLoader(_wfAccess.loader);
+
     if (_cfg.snr.minSnr > 0)
     {
       _wfAccess.snrFilter = new Waveform::SnrFilteredLoader(
-          _wfAccess.loader, _cfg.snr.minSnr, _cfg.snr.noiseStart,
+          _wfAccess.projCache, _cfg.snr.minSnr, _cfg.snr.noiseStart,
           _cfg.snr.noiseEnd, _cfg.snr.signalStart, _cfg.snr.signalEnd);
-      _wfAccess.memCache = new Waveform::MemCachedLoader(_wfAccess.snrFilter);
+      _wfAccess.memCache = new Waveform::MemCachedLoader(
+          _wfAccess.snrFilter, _cfg.wfCompactCache);
     }
     else
     {
-      _wfAccess.memCache = new Waveform::MemCachedLoader(_wfAccess.loader);
+      _wfAccess.memCache = new Waveform::MemCachedLoader(
+          _wfAccess.projCache, _cfg.wfCompactCache);
     }
   }
 }
@@ -243,7 +514,7 @@ CatalogPtr HypoDD::relocateMultiEvents(const ClusteringOptions &clustOpt,
 {
   SEISCOMP_INFO("Starting HypoDD relocator in multiple events mode");
 
-  if (!_ttt) _ttt = TravelTimeTable::create(_cfg.ttt.type, _cfg.ttt.model);
+  loadTTT();
 
   CatalogPtr catToReloc(new Catalog(*_bgCat));
 
@@ -377,7 +648,7 @@ CatalogPtr HypoDD::relocateSingleEvent(const CatalogCPtr &singleEvent,
                                        const ClusteringOptions &clustOpt2,
                                        const SolverOptions &solverOpt)
 {
-  if (!_ttt) _ttt = TravelTimeTable::create(_cfg.ttt.type, _cfg.ttt.model);
+  loadTTT();
 
   const CatalogCPtr bgCat = _bgCat;
 
@@ -548,7 +819,7 @@ CatalogPtr HypoDD::relocateEventSingleStep(const CatalogCPtr bgCat,
         clustOpt.minESdist, clustOpt.maxESdist, clustOpt.minEStoIEratio,
         clustOpt.minDTperEvt, clustOpt.maxDTperEvt, clustOpt.minNumNeigh,
         clustOpt.maxNumNeigh, clustOpt.numEllipsoids, clustOpt.maxEllipsoidSize,
-        keepUnmatchedPhases);
+        keepUnmatchedPhases, bgCat == _bgCat ? &_bgCatIndex : nullptr);
 
     //
     // prepare catalog to relocate
@@ -613,7 +884,15 @@ CatalogPtr HypoDD::relocate(const CatalogCPtr &catalog,
   //
   CatalogCPtr finalCatalog = catalog;
   unordered_map<unsigned, NeighboursPtr> finalNeighCluster;
-  ObservationParams obsparams;
+  std::unique_ptr<TravelTimeMemo> ttMemo;
+  if (solverOpt.ttMemoMaxMovement > 0)
+  {
+    ttMemo.reset(new TravelTimeMemo(solverOpt.ttMemoMaxMovement,
+                                    solverOpt.ttMemoFirstOrderCorrection));
+  }
+  const FixedObservationParams *fixedObsParams =
+      keepNeighboursFixed ? &_fixedObsParams : nullptr;
+  ObservationParams obsparams(ttMemo.get(), fixedObsParams);
   for (unsigned iteration = 0; iteration < solverOpt.algoIterations;
        iteration++)
   {
@@ -671,7 +950,7 @@ CatalogPtr HypoDD::relocate(const CatalogCPtr &catalog,
     }
 
     // prepare for next iteration
-    obsparams = ObservationParams();
+    obsparams = ObservationParams(ttMemo.get(), fixedObsParams);
 
     // update event parameters
     finalCatalog = updateRelocatedEvents(
@@ -679,6 +958,12 @@ CatalogPtr HypoDD::relocate(const CatalogCPtr &catalog,
         std::max(absTTDiffObsWeight, xcorrObsWeight), finalNeighCluster);
   }
 
+  if (ttMemo)
+  {
+    SEISCOMP_INFO("Travel time memoization: %u hits, %u recomputes",
+                  ttMemo->hits, ttMemo->recomputes);
+  }
+
   // compute last bit of statistics for the relocated events
   return updateRelocatedEventsFinalStats(catalog, finalCatalog,
                                          finalNeighCluster);
@@ -737,6 +1022,16 @@ void HypoDD::addObservations(Solver &solver,
   // copy event because we'll update it
   const Event &refEv = catalog->getEvents().at(neighbours->refEvId);
 
+  struct Observation
+  {
+    const Phase *refPhase;
+    const Phase *phase;
+    const Event *event;
+    const Station *station;
+    double diffTime;
+  };
+  vector<Observation> observations;
+
   //
   // loop through reference event phases
   //
@@ -745,7 +1040,6 @@ void HypoDD::addObservations(Solver &solver,
   {
     const Phase &refPhase  = it->second;
     const Station &station = catalog->getStations().at(refPhase.stationId);
-    char phaseTypeAsChar   = static_cast<char>(refPhase.procInfo.type);
 
     //
     // loop through neighbouring events and look for the matching phase
@@ -781,47 +1075,108 @@ void HypoDD::addObservations(Solver &solver,
         continue;
       }
 
-      if (!obsparams.add(_ttt, refEv, station, refPhase, true) ||
-          !obsparams.add(_ttt, event, station, phase, !keepNeighboursFixed))
-      {
-        SEISCOMP_DEBUG("Skipping observation (ev %u-%u sta %s phase %c)",
-                       refEv.id, event.id, station.id.c_str(), phaseTypeAsChar);
-        continue;
-      }
+      obsparams.prepare(refEv, station, refPhase, true);
+      obsparams.prepare(event, station, phase, !keepNeighboursFixed);
+      observations.push_back(Observation{&refPhase, &phase, &event, &station,
+                                         ref_travel_time - travel_time});
+    }
+  }
 
-      //
-      // compute absolute travel time differences to the solver
-      //
-      double diffTime = ref_travel_time - travel_time;
-      double weight =
-          usePickUncertainty
-              ? (refPhase.procInfo.weight + phase.procInfo.weight) / 2.0
-              : 1.0;
-      bool isXcorr = false;
+  // compute the travel times for all the events in one go
+  obsparams.computePending(_ttt);
 
-      //
-      // Check if we have cross-correlation results for the current
-      // event/`refEv` pair at station/phase and use those instead.
-      //
-      if (xcorr.has(refEv.id, event.id, refPhase.stationId,
-                    refPhase.procInfo.type))
-      {
+  for (const Observation &obs : observations)
+  {
+    const Phase &refPhase  = *obs.refPhase;
+    const Phase &phase     = *obs.phase;
+    const Event &event     = *obs.event;
+    const Station &station = *obs.station;
+    char phaseTypeAsChar   = static_cast<char>(refPhase.procInfo.type);
 
-        const auto &xcdata = xcorr.get(refEv.id, event.id, refPhase.stationId,
-                                       refPhase.procInfo.type);
-        diffTime -= xcdata.lag;
-        weight *= xcorrObsWeight;
-        isXcorr = true;
-      }
-      else
-      {
-        weight *= absTTDiffObsWeight;
-      }
+    if (!obsparams.add(_ttt, refEv, station, refPhase, true) ||
+        !obsparams.add(_ttt, event, station, phase, !keepNeighboursFixed))
+    {
+      SEISCOMP_DEBUG("Skipping observation (ev %u-%u sta %s phase %c)",
+                     refEv.id, event.id, station.id.c_str(), phaseTypeAsChar);
+      continue;
+    }
+
+    //
+    // compute absolute travel time differences to the solver
+    //
+    double diffTime = obs.diffTime;
+    double weight =
+        usePickUncertainty
+            ? (refPhase.procInfo.weight + phase.procInfo.weight) / 2.0
+            : 1.0;
+    bool isXcorr = false;
+
+    //
+    // Check if we have cross-correlation results for the current
+    // event/`refEv` pair at station/phase and use those instead.
+    //
+    if (xcorr.has(refEv.id, event.id, refPhase.stationId,
+                  refPhase.procInfo.type))
+    {
+
+      const auto &xcdata = xcorr.get(refEv.id, event.id, refPhase.stationId,
+                                     refPhase.procInfo.type);
+      diffTime -= xcdata.lag;
+      weight *= xcorrObsWeight;
+      isXcorr = true;
+    }
+    else
+    {
+      weight *= absTTDiffObsWeight;
+    }
+
+    solver.addObservation(refEv.id, event.id, refPhase.stationId,
+                          phaseTypeAsChar, diffTime, weight, isXcorr);
+  }
+}
 
-      solver.addObservation(refEv.id, event.id, refPhase.stationId,
-                            phaseTypeAsChar, diffTime, weight, isXcorr);
+bool HypoDD::FixedObservationParams::get(unsigned eventId,
+                                         const std::string &stationId,
+                                         char phaseType,
+                                         double &travelTime,
+                                         double &takeOfAngleAzim,
+                                         double &takeOfAngleDip,
+                                         double &velocityAtSrc) const
+{
+  auto it = values.find(eventId);
+  if (it == values.end()) return false;
+  for (const Value &v : it->second)
+  {
+    if (v.phaseType == phaseType && v.stationId == stationId)
+    {
+      travelTime      = v.travelTime;
+      takeOfAngleAzim = v.takeOfAngleAzim;
+      takeOfAngleDip  = v.takeOfAngleDip;
+      velocityAtSrc   = v.velocityAtSrc;
+      return true;
     }
   }
+  return false;
+}
+
+bool HypoDD::ObservationParams::lookup(const std::string &key,
+                                       const Event &event,
+                                       const Station &station,
+                                       char phaseType,
+                                       bool computeEvChanges,
+                                       double &travelTime,
+                                       double &takeOfAngleAzim,
+                                       double &takeOfAngleDip,
+                                       double &velocityAtSrc)
+{
+  if (_fixed && !computeEvChanges &&
+      _fixed->get(event.id, station.id, phaseType, travelTime,
+                  takeOfAngleAzim, takeOfAngleDip, velocityAtSrc))
+  {
+    return true;
+  }
+  return _memo && _memo->get(key, event, travelTime, takeOfAngleAzim,
+                             takeOfAngleDip, velocityAtSrc);
 }
 
 bool HypoDD::ObservationParams::add(HDD::TravelTimeTablePtr ttt,
@@ -832,14 +1187,24 @@ bool HypoDD::ObservationParams::add(HDD::TravelTimeTablePtr ttt,
 {
   char phaseType = static_cast<char>(phase.procInfo.type);
   const std::string key =
-      std::to_string(event.id) + "@" + station.id + ":" + phaseType;
+      ObservationParams::makeKey(event.id, station.id, phaseType);
+  if (_failed.find(key) != _failed.end()) return false;
   if (_entries.find(key) == _entries.end())
   {
     try
     {
       double travelTime, takeOfAngleAzim, takeOfAngleDip, velocityAtSrc;
-      ttt->compute(event, station, string(1, phaseType), travelTime,
-                   takeOfAngleAzim, takeOfAngleDip, velocityAtSrc);
+      if (!lookup(key, event, station, phaseType, computeEvChanges,
+                  travelTime, takeOfAngleAzim, takeOfAngleDip, velocityAtSrc))
+      {
+        ttt->compute(event, station, string(1, phaseType), travelTime,
+                     takeOfAngleAzim, takeOfAngleDip, velocityAtSrc);
+        if (_memo)
+        {
+          _memo->set(key, event, travelTime, takeOfAngleAzim, takeOfAngleDip,
+                     velocityAtSrc);
+        }
+      }
       double ttResidual = travelTime - (phase.time - event.time).length();
       _entries[key]     = Entry{event,          station,       phaseType,
                             travelTime,     ttResidual,    takeOfAngleAzim,
@@ -858,12 +1223,103 @@ bool HypoDD::ObservationParams::add(HDD::TravelTimeTablePtr ttt,
   return true;
 }
 
+void HypoDD::ObservationParams::prepare(const Event &event,
+                                        const Station &station,
+                                        const Phase &phase,
+                                        bool computeEvChanges)
+{
+  char phaseType = static_cast<char>(phase.procInfo.type);
+  const std::string key =
+      ObservationParams::makeKey(event.id, station.id, phaseType);
+  if (_entries.find(key) != _entries.end() ||
+      _failed.find(key) != _failed.end() ||
+      _pendingKeys.find(key) != _pendingKeys.end())
+  {
+    return;
+  }
+
+  double travelTime, takeOfAngleAzim, takeOfAngleDip, velocityAtSrc;
+  if (lookup(key, event, station, phaseType, computeEvChanges, travelTime,
+             takeOfAngleAzim, takeOfAngleDip, velocityAtSrc))
+  {
+    double ttResidual = travelTime - (phase.time - event.time).length();
+    _entries[key]     = Entry{event,          station,       phaseType,
+                          travelTime,     ttResidual,    takeOfAngleAzim,
+                          takeOfAngleDip, velocityAtSrc, computeEvChanges};
+    return;
+  }
+
+  _pendingKeys.insert(key);
+  auto it = _pending.find(event.id);
+  if (it == _pending.end())
+  {
+    it = _pending.emplace(event.id, PendingEvent{event, {}, {}, {}, {}}).first;
+  }
+  PendingEvent &pending = it->second;
+  pending.stations.push_back(&station);
+  pending.phaseTypes.push_back(string(1, phaseType));
+  pending.observedTravelTimes.push_back((phase.time - event.time).length());
+  pending.computeEvChanges.push_back(computeEvChanges);
+}
+
+void HypoDD::ObservationParams::computePending(HDD::TravelTimeTablePtr ttt)
+{
+  vector<double> travelTimes, takeOfAngleAzims, takeOfAngleDips,
+      velocitiesAtSrc;
+  vector<string> errors;
+
+  for (const auto &kv : _pending)
+  {
+    const PendingEvent &pending = kv.second;
+    const Event &event          = pending.event;
+
+    ttt->computeBatch(event, pending.stations, pending.phaseTypes, travelTimes,
+                      takeOfAngleAzims, takeOfAngleDips, velocitiesAtSrc,
+                      errors);
+
+    for (size_t i = 0; i < pending.stations.size(); i++)
+    {
+      const Station &station = *pending.stations[i];
+      char phaseType         = pending.phaseTypes[i].at(0);
+      const std::string key =
+          ObservationParams::makeKey(event.id, station.id, phaseType);
+
+      if (!errors[i].empty())
+      {
+        SEISCOMP_WARNING(
+            "Travel Time Table error: %s (Event lat %.6f lon %.6f depth %.6f "
+            "Station lat %.6f lon %.6f elevation %.f )",
+            errors[i].c_str(), event.latitude, event.longitude, event.depth,
+            station.latitude, station.longitude, station.elevation);
+        _failed.insert(key);
+        continue;
+      }
+
+      double ttResidual = travelTimes[i] - pending.observedTravelTimes[i];
+      _entries[key]     = Entry{event,
+                            station,
+                            phaseType,
+                            travelTimes[i],
+                            ttResidual,
+                            takeOfAngleAzims[i],
+                            takeOfAngleDips[i],
+                            velocitiesAtSrc[i],
+                            pending.computeEvChanges[i]};
+      if (_memo)
+      {
+        _memo->set(key, event, travelTimes[i], takeOfAngleAzims[i],
+                   takeOfAngleDips[i], velocitiesAtSrc[i]);
+      }
+    }
+  }
+  _pending.clear();
+  _pendingKeys.clear();
+}
+
 const HypoDD::ObservationParams::Entry &HypoDD::ObservationParams::get(
     unsigned eventId, const std::string stationId, char phaseType) const
 {
-  const std::string key =
-      std::to_string(eventId) + "@" + stationId + ":" + phaseType;
-  return _entries.at(key);
+  return _entries.at(ObservationParams::makeKey(eventId, stationId, phaseType));
 }
 
 void HypoDD::ObservationParams::addToSolver(Solver &solver) const
@@ -889,10 +1345,12 @@ CatalogPtr HypoDD::updateRelocatedEvents(
     std::unordered_map<unsigned, NeighboursPtr> &finalNeighCluster // output
 ) const
 {
-  unordered_map<string, Station> stations    = catalog->getStations();
-  map<unsigned, Event> events                = catalog->getEvents();
-  unordered_multimap<unsigned, Phase> phases = catalog->getPhases();
-  unsigned relocatedEvs                      = 0;
+  // The relocated catalog shares the data with `catalog` until it is
+  // modified, the stations are never copied
+  CatalogPtr relocatedCatalog(new Catalog(*catalog));
+  const unordered_map<string, Station> &stations =
+      relocatedCatalog->getStations();
+  unsigned relocatedEvs = 0;
   vector<double> allRms;
 
   //
@@ -900,7 +1358,7 @@ CatalogPtr HypoDD::updateRelocatedEvents(
   //
   for (const NeighboursPtr &neighbours : neighCluster)
   {
-    Event &event = events.at(neighbours->refEvId);
+    Event event = relocatedCatalog->getEvents().at(neighbours->refEvId);
 
     // get relocation changes computed by the solver for the current event
     double deltaLat, deltaLon, deltaDepth, deltaTT;
@@ -908,6 +1366,7 @@ CatalogPtr HypoDD::updateRelocatedEvents(
                                 deltaTT))
     {
       event.relocInfo.isRelocated = false;
+      relocatedCatalog->updateEvent(event);
       continue;
     }
 
@@ -948,14 +1407,27 @@ CatalogPtr HypoDD::updateRelocatedEvents(
     set<unsigned> neighbourIds;
     vector<double> obsResiduals;
     unsigned rmsCount = 0;
-    auto eqlrng       = phases.equal_range(event.id);
+
+    vector<Phase> phases;
+    auto eqlrng = relocatedCatalog->getPhases().equal_range(event.id);
     for (auto it = eqlrng.first; it != eqlrng.second; ++it)
+      phases.push_back(it->second);
+
+    // compute the travel times for all the event phases in one go
+    for (const Phase &phase : phases)
+    {
+      obsparams.prepare(event, stations.at(phase.stationId), phase, true);
+    }
+    obsparams.computePending(_ttt);
+
+    for (Phase &phase : phases)
     {
-      Phase &phase           = it->second;
       const Station &station = stations.at(phase.stationId);
       char phaseTypeAsChar   = static_cast<char>(phase.procInfo.type);
 
-      phase.relocInfo.isRelocated = false;
+      // keep the values from the previous iteration, but don't allocate them
+      // for phases never relocated
+      if (phase.relocInfo.isSet()) phase.relocInfo->isRelocated = false;
 
       unsigned startTTObs, startCCObs, finalTotalObs;
       double meanObsResidual, meanAPrioriWeight, meanFinalWeight;
@@ -970,42 +1442,42 @@ CatalogPtr HypoDD::updateRelocatedEvents(
 
       if (finalTotalObs == 0) continue;
 
-      phase.relocInfo.isRelocated = true;
-      phase.relocInfo.finalWeight =
+      phase.relocInfo->isRelocated = true;
+      phase.relocInfo->finalWeight =
           meanFinalWeight / pickWeightScaler; // range 0-1
-      phase.relocInfo.numTTObs = startTTObs;
-      phase.relocInfo.numCCObs = startCCObs;
+      phase.relocInfo->numTTObs = startTTObs;
+      phase.relocInfo->numCCObs = startCCObs;
       if (isFirstIteration)
-        phase.relocInfo.startMeanObsResidual = meanObsResidual;
-      phase.relocInfo.finalMeanObsResidual = meanObsResidual;
+        phase.relocInfo->startMeanObsResidual = meanObsResidual;
+      phase.relocInfo->finalMeanObsResidual = meanObsResidual;
       obsResiduals.push_back(meanObsResidual);
 
       if (obsparams.add(_ttt, event, station, phase, true))
       {
         double travelTime =
             obsparams.get(event.id, station.id, phaseTypeAsChar).travelTime;
-        phase.relocInfo.finalResidual =
+        phase.relocInfo->finalResidual =
             travelTime - (phase.time - event.time).length();
         rmsCount++;
       }
       else
       {
-        phase.relocInfo.finalResidual = 0;
+        phase.relocInfo->finalResidual = 0;
       }
 
       event.rms +=
-          (phase.relocInfo.finalResidual * phase.relocInfo.finalResidual);
+          (phase.relocInfo->finalResidual * phase.relocInfo->finalResidual);
       if (phase.procInfo.type == Phase::Type::P)
       {
         event.relocInfo.phases.usedP++;
-        event.relocInfo.ddObs.numCCp += phase.relocInfo.numCCObs;
-        event.relocInfo.ddObs.numTTp += phase.relocInfo.numTTObs;
+        event.relocInfo.ddObs.numCCp += phase.relocInfo->numCCObs;
+        event.relocInfo.ddObs.numTTp += phase.relocInfo->numTTObs;
       }
       if (phase.procInfo.type == Phase::Type::S)
       {
         event.relocInfo.phases.usedS++;
-        event.relocInfo.ddObs.numCCs += phase.relocInfo.numCCObs;
-        event.relocInfo.ddObs.numTTs += phase.relocInfo.numTTObs;
+        event.relocInfo.ddObs.numCCs += phase.relocInfo->numCCObs;
+        event.relocInfo.ddObs.numTTs += phase.relocInfo->numTTObs;
       }
 
       for (unsigned nId : neighbourIds)
@@ -1033,6 +1505,9 @@ CatalogPtr HypoDD::updateRelocatedEvents(
 
     event.relocInfo.neighbours.amount = finalNeighbours->numNeighbours();
     finalNeighCluster[finalNeighbours->refEvId] = finalNeighbours;
+
+    relocatedCatalog->updateEvent(event);
+    for (const Phase &phase : phases) relocatedCatalog->updatePhase(phase);
   }
 
   const double allRmsMedian = computeMedian(allRms);
@@ -1043,7 +1518,7 @@ CatalogPtr HypoDD::updateRelocatedEvents(
       "absolute deviation %.4f [sec]",
       relocatedEvs, allRmsMedian, allRmsMAD);
 
-  return new Catalog(stations, events, phases);
+  return relocatedCatalog;
 }
 
 CatalogPtr HypoDD::updateRelocatedEventsFinalStats(
@@ -1089,32 +1564,44 @@ CatalogPtr HypoDD::updateRelocatedEventsFinalStats(
     unsigned rmsCount             = 0;
     finalEvent.relocInfo.startRms = 0;
     auto eqlrng = tmpCat->getPhases().equal_range(finalEvent.id);
+
+    vector<Phase> finalPhases;
+    vector<const Station *> phaseStations;
+    vector<string> phaseTypes;
     for (auto it = eqlrng.first; it != eqlrng.second; ++it)
     {
-      Phase finalPhase       = it->second;
-      const Station &station = tmpCat->getStations().at(finalPhase.stationId);
-      try
-      {
-        double travelTime;
-        _ttt->compute(startEvent, station,
-                      string(1, static_cast<char>(finalPhase.procInfo.type)),
-                      travelTime);
-        double residual =
-            travelTime - (finalPhase.time - startEvent.time).length();
-        finalPhase.relocInfo.startResidual = residual;
-        tmpCat->updatePhase(finalPhase, false);
-        finalEvent.relocInfo.startRms += residual * residual;
-        rmsCount++;
-      }
-      catch (exception &e)
+      const Phase &finalPhase = it->second;
+      finalPhases.push_back(finalPhase);
+      phaseStations.push_back(&tmpCat->getStations().at(finalPhase.stationId));
+      phaseTypes.push_back(
+          string(1, static_cast<char>(finalPhase.procInfo.type)));
+    }
+
+    vector<double> travelTimes;
+    vector<string> errors;
+    _ttt->computeBatch(startEvent, phaseStations, phaseTypes, travelTimes,
+                       errors);
+
+    for (size_t i = 0; i < finalPhases.size(); i++)
+    {
+      Phase &finalPhase      = finalPhases[i];
+      const Station &station = *phaseStations[i];
+      if (!errors[i].empty())
       {
         SEISCOMP_WARNING(
             "Travel Time Table error: %s (Event lat %.6f lon %.6f depth %.6f "
             "Station lat %.6f lon %.6f elevation %.f )",
-            e.what(), startEvent.latitude, startEvent.longitude,
+            errors[i].c_str(), startEvent.latitude, startEvent.longitude,
             startEvent.depth, station.latitude, station.longitude,
             station.elevation);
+        continue;
       }
+      double residual =
+          travelTimes[i] - (finalPhase.time - startEvent.time).length();
+      finalPhase.relocInfo->startResidual = residual;
+      tmpCat->updatePhase(finalPhase, false);
+      finalEvent.relocInfo.startRms += residual * residual;
+      rmsCount++;
     }
 
     if (rmsCount > 0)
@@ -1137,7 +1624,8 @@ CatalogPtr HypoDD::updateRelocatedEventsFinalStats(
         // keepUnmatchedPhases option during clustering). Make sure that the
         // phase was used for relocation.
         auto it = tmpCat->searchPhase(finalEvent.id, stationId, phaseType);
-        if (it != tmpCat->getPhases().end() && it->second.relocInfo.isRelocated)
+        if (it != tmpCat->getPhases().end() &&
+            it->second.relocInfo->isRelocated)
         {
           const Station &station =
               tmpCat->getStations().at(it->second.stationId);
@@ -1275,8 +1763,6 @@ HypoDD::getMissingPhases(const Event &refEv,
                          CatalogPtr &refEvCatalog,
                          const CatalogCPtr &searchCatalog) const
 {
-  const auto &refEvPhases = refEvCatalog->getPhases().equal_range(refEv.id);
-
   //
   // Loop through stations and find those for which the `refEv` doesn't have
   // phases.
@@ -1286,27 +1772,13 @@ HypoDD::getMissingPhases(const Event &refEv,
   {
     const Station &station = kv.second;
 
-    bool foundP = false, foundS = false;
-    for (auto it = refEvPhases.first; it != refEvPhases.second; ++it)
+    for (Phase::Type type : {Phase::Type::P, Phase::Type::S})
     {
-      const Phase &phase = it->second;
-      if (station.networkCode == phase.networkCode &&
-          station.stationCode == phase.stationCode &&
-          station.locationCode == phase.locationCode)
+      if (refEvCatalog->searchPhase(refEv.id, station.id, type) ==
+          refEvCatalog->getPhases().end())
       {
-        if (phase.procInfo.type == Phase::Type::P) foundP = true;
-        if (phase.procInfo.type == Phase::Type::S) foundS = true;
+        missingPhases.push_back(MissingStationPhase(station.id, type));
       }
-      if (foundP and foundS) break;
-    }
-    if (!foundP || !foundS)
-    {
-      if (!foundP)
-        missingPhases.push_back(
-            MissingStationPhase(station.id, Phase::Type::P));
-      if (!foundS)
-        missingPhases.push_back(
-            MissingStationPhase(station.id, Phase::Type::S));
     }
   }
 
@@ -1321,32 +1793,53 @@ HypoDD::findPhasePeers(const Station &station,
 {
   //
   // Loop through every other event and select those manual phases of the
-  // `station` we are interested in.
+  // `station` we are interested in. Iterate the smaller between the
+  // neighbours and the catalog events having a phase at `station`, the
+  // lowest neighbour id is picked either way.
   //
   vector<PhasePeer> phasePeers;
 
-  for (unsigned neighEvId : neighbours->ids)
-  {
-    const Event &event = searchCatalog->getEvents().at(neighEvId);
+  const set<unsigned> &eventsWithPhase =
+      searchCatalog->searchEventsWithPhase(station.id, phaseType);
 
-    if (neighbours->has(neighEvId, station.id, phaseType))
+  bool found         = false;
+  unsigned neighEvId = 0;
+  if (eventsWithPhase.size() <= neighbours->ids.size())
+  {
+    for (unsigned evId : eventsWithPhase)
     {
-      const Phase &phase =
-          searchCatalog->searchPhase(neighEvId, station.id, phaseType)->second;
-
-      if (station.networkCode == phase.networkCode &&
-          station.stationCode == phase.stationCode &&
-          station.locationCode == phase.locationCode &&
-          phaseType == phase.procInfo.type)
+      if (neighbours->has(evId, station.id, phaseType))
       {
-        if (phase.isManual)
-        {
-          phasePeers.push_back(PhasePeer(event, phase));
-        }
+        found     = true;
+        neighEvId = evId;
         break;
       }
     }
   }
+  else
+  {
+    for (unsigned evId : neighbours->ids)
+    {
+      if ((!found || evId < neighEvId) &&
+          neighbours->has(evId, station.id, phaseType) &&
+          eventsWithPhase.count(evId) != 0)
+      {
+        found     = true;
+        neighEvId = evId;
+      }
+    }
+  }
+
+  if (found)
+  {
+    const Event &event = searchCatalog->getEvents().at(neighEvId);
+    const Phase &phase =
+        searchCatalog->searchPhase(neighEvId, station.id, phaseType)->second;
+    if (phase.isManual)
+    {
+      phasePeers.push_back(PhasePeer(event, phase));
+    }
+  }
 
   return phasePeers;
 }
@@ -1486,16 +1979,18 @@ void HypoDD::buildXcorrDiffTTimePairs(CatalogPtr &catalog,
   //
   // loop through reference event phases
   //
+  const Catalog::Coordinates refEvCoords = catalog->toLocalCoordinates(refEv);
+
   auto eqlrngRef = catalog->getPhases().equal_range(refEv.id);
   for (auto itRef = eqlrngRef.first; itRef != eqlrngRef.second; ++itRef)
   {
-    const Phase &refPhase  = itRef->second;
-    const Station &station = catalog->getStations().at(refPhase.stationId);
+    const Phase &refPhase = itRef->second;
 
     //
     // skip stations too far away
     //
-    double stationDistance = computeDistance(refEv, station);
+    double stationDistance = refEvCoords.distance(
+        catalog->getStationCoordinates(refPhase.stationId));
     if (stationDistance > xcorrMaxEvStaDist && xcorrMaxEvStaDist >= 0) continue;
 
     //
@@ -1524,7 +2019,8 @@ void HypoDD::buildXcorrDiffTTimePairs(CatalogPtr &catalog,
       //
       // skip events too far away
       //
-      double interEventDistance = computeDistance(refEv, event);
+      double interEventDistance =
+          refEvCoords.distance(catalog->getEventCoordinates(neighEvId));
       if (interEventDistance > xcorrMaxInterEvDist && xcorrMaxInterEvDist >= 0)
         continue;
 
@@ -1700,11 +2196,12 @@ HypoDD::preloadNonCatalogWaveforms(CatalogPtr &catalog,
   //
   // loop through reference event phases
   //
+  const Catalog::Coordinates refEvCoords = catalog->toLocalCoordinates(refEv);
+
   auto eqlrngRef = catalog->getPhases().equal_range(refEv.id);
   for (auto itRef = eqlrngRef.first; itRef != eqlrngRef.second; ++itRef)
   {
-    const Phase &refPhase  = itRef->second;
-    const Station &station = catalog->getStations().at(refPhase.stationId);
+    const Phase &refPhase = itRef->second;
 
     // We deal only with real-time event data
     if (refPhase.procInfo.source == Phase::Source::CATALOG) continue;
@@ -1712,7 +2209,8 @@ HypoDD::preloadNonCatalogWaveforms(CatalogPtr &catalog,
     //
     // skip stations too far away
     //
-    double stationDistance = computeDistance(refEv, station);
+    double stationDistance = refEvCoords.distance(
+        catalog->getStationCoordinates(refPhase.stationId));
     if (stationDistance > xcorrMaxEvStaDist && xcorrMaxEvStaDist >= 0) continue;
 
     //
@@ -1725,7 +2223,8 @@ HypoDD::preloadNonCatalogWaveforms(CatalogPtr &catalog,
       //
       // skip events too far away
       //
-      double interEventDistance = computeDistance(refEv, event);
+      double interEventDistance =
+          refEvCoords.distance(catalog->getEventCoordinates(neighEvId));
       if (interEventDistance > xcorrMaxInterEvDist && xcorrMaxInterEvDist >= 0)
         continue;
 
@@ -1853,6 +2352,10 @@ void HypoDD::resetCounters()
   {
     _wfAccess.diskCache->_counters_wf_cached = 0;
   }
+  if (_wfAccess.projCache)
+  {
+    _wfAccess.projCache->_counters_wf_cached = 0;
+  }
   if (_wfAccess.snrFilter)
   {
     _wfAccess.snrFilter->_counters_wf_snr_low = 0;
@@ -1906,6 +2409,12 @@ void HypoDD::printCounters() const
                 performed, wf_snr_low, wf_no_avail, wf_downloaded,
                 wf_disk_cached);
 
+  if (_cfg.wfCompactCache && _wfAccess.memCache)
+  {
+    SEISCOMP_INFO("Compact waveform cache: %.2f MB of memory saved",
+                  _wfAccess.memCache->_counters_wf_mem_saved / 1048576.);
+  }
+
   SEISCOMP_INFO("Total xcorr %u (P %.f%%, S %.f%%) success %.f%% (%u/%u). "
                 "Successful P %.f%% (%u/%u). Successful S %.f%% (%u/%u)",
                 performed, (performed_p * 100. / performed),
@@ -2209,7 +2718,8 @@ GenericRecordCPtr HypoDD::getWaveform(const Core::TimeWindow &tw,
   const string wfId = Waveform::waveformId(ph, tw);
 
   // Check if we have already excluded the trace because we couldn't load it
-  // (-> save time).
+  // (-> save time). The verdicts persisted across restarts are handled by
+  // the loaders themselves (data availability and SNR separately)
   if (_wfAccess.unloadableWfs.find(wfId) != _wfAccess.unloadableWfs.end())
   {
     return nullptr;
@@ -2367,7 +2877,8 @@ void HypoDD::evalXCorr(const ClusteringOptions &clustOpt, bool theoretical)
           _bgCat, event, _bgCat, clustOpt.minWeight, clustOpt.minESdist,
           clustOpt.maxESdist, clustOpt.minEStoIEratio, clustOpt.minDTperEvt,
           clustOpt.maxDTperEvt, clustOpt.minNumNeigh, clustOpt.maxNumNeigh,
-          clustOpt.numEllipsoids, clustOpt.maxEllipsoidSize, false);
+          clustOpt.numEllipsoids, clustOpt.maxEllipsoidSize, false,
+          &_bgCatIndex);
     }
     catch (...)
     {
@@ -2449,9 +2960,9 @@ void HypoDD::evalXCorr(const ClusteringOptions &clustOpt, bool theoretical)
         if (phaseType == Phase::Type::S) sPhaseStats += phStaStats;
         statsByStation[catalogPhase.stationId] += phStaStats;
 
-        const Station &station =
-            _bgCat->getStations().at(catalogPhase.stationId);
-        double stationDistance = computeDistance(event, station);
+        double stationDistance =
+            _bgCat->getEventCoordinates(event.id).distance(
+                _bgCat->getStationCoordinates(catalogPhase.stationId));
         statsByStaDistance[int(stationDistance / STA_DIST_STEP)] += phStaStats;
 
         //
@@ -2463,8 +2974,9 @@ void HypoDD::evalXCorr(const ClusteringOptions &clustOpt, bool theoretical)
         {
           if (neighbours->has(neighEvId, stationId, phaseType))
           {
-            const Event &neighbEv  = catalog->getEvents().at(neighEvId);
-            double interEvDistance = computeDistance(event, neighbEv);
+            double interEvDistance =
+                _bgCat->getEventCoordinates(event.id).distance(
+                    _bgCat->getEventCoordinates(neighEvId));
             XCorrEvalStats &interEvDistStats =
                 tmpStatsByInterEvDistance[int(interEvDistance / EV_DIST_STEP)];
             interEvDistStats.total = 1;
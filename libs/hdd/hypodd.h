@@ -59,6 +59,26 @@ struct Config
     double resampleFreq   = 400;                         // 0 -> no resampling
   } wfFilter;
 
+  // keep the catalog waveforms in memory with single precision samples
+  bool wfCompactCache = false;
+
+  // fetch waveforms in continuous blocks of `blockLen` secs per stream and
+  // serve the requested windows as slices of those (see StripCachedLoader)
+  struct
+  {
+    double blockLen    = 0;   // secs, 0 -> disabled
+    unsigned maxBlocks = 500; // max blocks kept in memory, 0 -> no limit
+  } wfStrip;
+
+  // Catalog waveforms that cannot be loaded (or whose SNR is too low) are
+  // remembered in the waveform cache directory, so that they are not
+  // requested again after a restart. Unavailable waveforms are forgotten
+  // after `unavailableExpiry` secs, since the data might arrive later.
+  struct
+  {
+    double unavailableExpiry = 86400; // secs, 0 -> never expire
+  } wfExclusion;
+
   struct
   {
     double minSnr      = 2; // 0 -> no SNR check
@@ -72,6 +92,8 @@ struct Config
   {
     std::string type  = "LOCSAT";
     std::string model = "iasp91";
+    // LOCSAT/libtau only: interpolate the travel times from a lookup table
+    bool lookupTable = false;
   } ttt;
 };
 
@@ -119,6 +141,8 @@ struct SolverOptions
   bool usePickUncertainty             = false;
   double absTTDiffObsWeight           = 0.5;
   double xcorrObsWeight               = 1.0;
+  double ttMemoMaxMovement            = 0; // km, 0 -> disable tt memoization
+  bool ttMemoFirstOrderCorrection     = false;
 };
 
 DEFINE_SMARTPOINTER(HypoDD);
@@ -130,13 +154,30 @@ public:
   HypoDD(const CatalogCPtr &catalog,
          const Config &cfg,
          const std::string &workingDir);
-  ~HypoDD() {}
+  ~HypoDD() { unloadTTT(); }
 
   void preloadWaveforms();
 
   void unloadWaveforms() { createWaveformCache(); }
 
-  void unloadTTT() { _ttt = nullptr; }
+  void unloadTTT();
+
+  /*
+   * Compute the travel time parameters of the background catalog phases.
+   * In single-event relocation the background events are kept fixed, so
+   * only the travel times of the event to relocate need to be computed.
+   * The results are stored in the working directory and reused until the
+   * catalog or the travel time table change. Return true if the stored
+   * results were reused.
+   */
+  bool precomputeFixedObservationParams();
+
+  /*
+   * Load the parameters stored by precomputeFixedObservationParams(), if
+   * still valid for the current catalog and travel time table. Nothing is
+   * computed. Return true if the stored results were loaded.
+   */
+  bool loadFixedObservationParams();
 
   CatalogCPtr getCatalog() { return _srcCat; }
   void setCatalog(const CatalogCPtr &catalog);
@@ -172,6 +213,11 @@ public:
 private:
   void createWaveformCache();
 
+  std::string fixedObservationParamsFile() const;
+  std::string fixedObservationParamsHash();
+  bool readFixedObservationParams(const std::string &hash);
+  void loadTTT();
+
   std::string generateWorkingSubDir(const Catalog::Event &ev) const;
 
   CatalogPtr relocateEventSingleStep(const CatalogCPtr bgCat,
@@ -188,8 +234,39 @@ private:
                       bool keepNeighboursFixed,
                       const XCorrCache &xcorr) const;
 
+  /*
+   * Travel time parameters of events that don't move during the relocation
+   */
+  struct FixedObservationParams
+  {
+    struct Value
+    {
+      std::string stationId;
+      char phaseType;
+      double travelTime;
+      double takeOfAngleAzim;
+      double takeOfAngleDip;
+      double velocityAtSrc;
+    };
+
+    bool get(unsigned eventId,
+             const std::string &stationId,
+             char phaseType,
+             double &travelTime,
+             double &takeOfAngleAzim,
+             double &takeOfAngleDip,
+             double &velocityAtSrc) const;
+
+    std::unordered_map<unsigned, std::vector<Value>> values; // by event id
+  };
+
   struct ObservationParams
   {
+    ObservationParams(TravelTimeMemo *memo                = nullptr,
+                      const FixedObservationParams *fixed = nullptr)
+        : _memo(memo), _fixed(fixed)
+    {}
+
     struct Entry
     {
       Catalog::Event event;
@@ -207,12 +284,50 @@ private:
              const Catalog::Station &station,
              const Catalog::Phase &phase,
              bool computeEvChanges);
+    // Queue an entry to be computed by `computePending`, which uses one
+    // batch travel time computation per event. `station` must stay valid
+    // until then.
+    void prepare(const Catalog::Event &event,
+                 const Catalog::Station &station,
+                 const Catalog::Phase &phase,
+                 bool computeEvChanges);
+    void computePending(HDD::TravelTimeTablePtr ttt);
     const Entry &
     get(unsigned eventId, const std::string stationId, char phaseType) const;
     void addToSolver(Solver &solver) const;
 
   private:
+    // Return the parameters already available without computing them
+    bool lookup(const std::string &key,
+                const Catalog::Event &event,
+                const Catalog::Station &station,
+                char phaseType,
+                bool computeEvChanges,
+                double &travelTime,
+                double &takeOfAngleAzim,
+                double &takeOfAngleDip,
+                double &velocityAtSrc);
+
+    static std::string
+    makeKey(unsigned eventId, const std::string &stationId, char phaseType)
+    {
+      return std::to_string(eventId) + "@" + stationId + ":" + phaseType;
+    }
+
+    struct PendingEvent
+    {
+      Catalog::Event event;
+      std::vector<const Catalog::Station *> stations;
+      std::vector<std::string> phaseTypes;
+      std::vector<double> observedTravelTimes;
+      std::vector<bool> computeEvChanges;
+    };
+    TravelTimeMemo *_memo;                 // optional
+    const FixedObservationParams *_fixed; // optional
     std::unordered_map<std::string, Entry> _entries;
+    std::unordered_set<std::string> _failed; // entries that cannot be computed
+    std::unordered_set<std::string> _pendingKeys;
+    std::map<unsigned, PendingEvent> _pending; // indexed by event id
   };
 
   void addObservations(Solver &solver,
@@ -336,6 +451,7 @@ private:
 
   CatalogCPtr _srcCat;
   CatalogCPtr _bgCat;
+  EventSpatialIndex _bgCatIndex; // index of `_bgCat` events
 
   const Config _cfg;
 
@@ -347,10 +463,13 @@ private:
 
   HDD::TravelTimeTablePtr _ttt;
 
+  FixedObservationParams _fixedObsParams;
+
   struct
   {
     Waveform::LoaderPtr loader;
     Waveform::DiskCachedLoaderPtr diskCache;
+    Waveform::ProjectionCachedLoaderPtr projCache;
     Waveform::ExtraLenLoaderPtr extraLen;
     Waveform::SnrFilteredLoaderPtr snrFilter;
     Waveform::MemCachedLoaderPtr memCache;
@@ -18,12 +18,18 @@
 #include "utils.h"
 
 #include <array>
+#include <cerrno>
 #include <cstring>
 #include <seiscomp3/core/strings.h>
 #include <seiscomp3/math/math.h>
 #include <seiscomp3/utils/files.h>
 #include <stdexcept>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #define SEISCOMP_COMPONENT HDD
 #include <seiscomp3/logging/log.h>
 
@@ -162,6 +168,118 @@ NllTravelTimeTable::NllTravelTimeTable(const std::string &type,
   }
 }
 
+bool NllTravelTimeTable::isUnloadable(const std::string &gridId)
+{
+  std::lock_guard<std::mutex> lock(_unloadableGridsMtx);
+  return _unloadableGrids.find(gridId) != _unloadableGrids.end();
+}
+
+void NllTravelTimeTable::setUnloadable(const std::string &gridId)
+{
+  std::lock_guard<std::mutex> lock(_unloadableGridsMtx);
+  _unloadableGrids.insert(gridId);
+}
+
+TimeGridPtr NllTravelTimeTable::getTimeGrid(const Catalog::Station &station,
+                                            const std::string &phaseType)
+{
+  string timeGId = "timeGrid:" +
+                   Grid::filePath(_timeGridPath, station, phaseType) +
+                   (_swapBytes ? ":swap" : "");
+
+  // Check if we have already excluded the grid because we couldn't load it
+  if (isUnloadable(timeGId))
+  {
+    string msg = stringify("Time grid (%s) not avaliable", timeGId.c_str());
+    throw runtime_error(msg.c_str());
+  }
+
+  try
+  {
+    GridPtr grid = GridPool::instance().get(timeGId, [&]() {
+      return new TimeGrid(_timeGridPath, station, phaseType, _swapBytes);
+    });
+    return static_cast<TimeGrid *>(grid.get());
+  }
+  catch (exception &e)
+  {
+    setUnloadable(timeGId);
+    throw runtime_error(e.what());
+  }
+}
+
+VelGridPtr NllTravelTimeTable::getVelGrid(const Catalog::Station &station,
+                                          const std::string &phaseType)
+{
+  string velGId = "velGrid:" +
+                  Grid::filePath(_velGridPath, station, phaseType) +
+                  (_swapBytes ? ":swap" : "");
+
+  // Check if we have already excluded the grid because we couldn't load it
+  if (isUnloadable(velGId))
+  {
+    string msg = stringify("Vel grid (%s) not avaliable", velGId.c_str());
+    throw runtime_error(msg.c_str());
+  }
+
+  try
+  {
+    GridPtr grid = GridPool::instance().get(velGId, [&]() {
+      return new VelGrid(_velGridPath, station, phaseType, _swapBytes);
+    });
+    return static_cast<VelGrid *>(grid.get());
+  }
+  catch (exception &e)
+  {
+    setUnloadable(velGId);
+    throw runtime_error(e.what());
+  }
+}
+
+AngleGridPtr NllTravelTimeTable::getAngleGrid(const Catalog::Station &station,
+                                              const std::string &phaseType)
+{
+  string angleGId = "angleGrid:" +
+                    Grid::filePath(_angleGridPath, station, phaseType) +
+                    (_swapBytes ? ":swap" : "");
+
+  // Check if we have already excluded the grid because we couldn't load it
+  if (isUnloadable(angleGId))
+  {
+    return nullptr;
+  }
+
+  try
+  {
+    GridPtr grid = GridPool::instance().get(angleGId, [&]() {
+      return new AngleGrid(_angleGridPath, station, phaseType, _swapBytes);
+    });
+    return static_cast<AngleGrid *>(grid.get());
+  }
+  catch (exception &e)
+  {
+    setUnloadable(angleGId);
+    SEISCOMP_WARNING(
+        "Cannot load angle grid file: using approximated angles (%s)",
+        e.what());
+  }
+  return nullptr;
+}
+
+std::vector<std::string>
+NllTravelTimeTable::dataFiles(const Catalog::Station &station,
+                              const std::string &phaseType)
+{
+  std::vector<std::string> files;
+  for (const string &path : {_velGridPath, _timeGridPath, _angleGridPath})
+  {
+    const string basePath = Grid::filePath(path, station, phaseType);
+    files.push_back(basePath + ".hdr");
+    files.push_back(basePath + ".buf");
+  }
+  return files;
+}
+
 void NllTravelTimeTable::compute(double eventLat,
                                  double eventLon,
                                  double eventDepth,
@@ -169,33 +287,7 @@ void NllTravelTimeTable::compute(double eventLat,
                                  const std::string &phaseType,
                                  double &travelTime)
 {
-  string timeGId =
-      "timeGrid:" + Grid::filePath(_timeGridPath, station, phaseType);
-  auto timeIt = _timeGrids.find(timeGId);
-  if (timeIt == _timeGrids.end())
-  {
-    // Check if we have already excluded the grid because we couldn't load it
-    if (_unloadableGrids.find(timeGId) != _unloadableGrids.end())
-    {
-      string msg = stringify("Time grid (%s) not avaliable", timeGId.c_str());
-      throw runtime_error(msg.c_str());
-    }
-
-    try
-    {
-      TimeGridPtr tg =
-          new TimeGrid(_timeGridPath, station, phaseType, _swapBytes);
-      timeIt =
-          _timeGrids.insert(std::pair<string, TimeGridPtr>(timeGId, tg)).first;
-    }
-    catch (exception &e)
-    {
-      _unloadableGrids.insert(timeGId);
-      throw runtime_error(e.what());
-    }
-  }
-
-  TimeGridPtr timeGrid = timeIt->second;
+  TimeGridPtr timeGrid = getTimeGrid(station, phaseType);
   travelTime           = timeGrid->getTime(eventLat, eventLon, eventDepth);
 }
 
@@ -212,82 +304,245 @@ void NllTravelTimeTable::compute(double eventLat,
   // get travelTime
   compute(eventLat, eventLon, eventDepth, station, phaseType, travelTime);
 
-  string velGId = "velGrid:" + Grid::filePath(_velGridPath, station, phaseType);
-  auto velIt    = _velGrids.find(velGId);
-  if (velIt == _velGrids.end())
-  {
-    // Check if we have already excluded the grid because we couldn't load it
-    if (_unloadableGrids.find(velGId) != _unloadableGrids.end())
-    {
-      string msg = stringify("Vel grid (%s) not avaliable", velGId.c_str());
-      throw runtime_error(msg.c_str());
-    }
+  // set velocityAtSrc
+  VelGridPtr velGrid = getVelGrid(station, phaseType);
+  velocityAtSrc      = velGrid->getVel(eventLat, eventLon, eventDepth);
 
+  // set takeOffAngles
+  takeOffAngleAzim       = std::nan("");
+  takeOffAngleDip        = std::nan("");
+  AngleGridPtr angleGrid = getAngleGrid(station, phaseType);
+  if (angleGrid)
+  {
     try
     {
-      VelGridPtr vg = new VelGrid(_velGridPath, station, phaseType, _swapBytes);
-      velIt = _velGrids.insert(std::pair<string, VelGridPtr>(velGId, vg)).first;
+      angleGrid->getAngles(eventLat, eventLon, eventDepth, takeOffAngleAzim,
+                           takeOffAngleDip);
     }
     catch (exception &e)
     {
-      _unloadableGrids.insert(velGId);
-      throw runtime_error(e.what());
+      SEISCOMP_WARNING(
+          "Error reading angle grid file: using approximated angles (%s)",
+          e.what());
     }
   }
+  // approximate angles if not already provided by the grid
+  computeApproximatedTakeOfAngles(
+      eventLat, eventLon, eventDepth, station, phaseType,
+      std::isfinite(takeOffAngleAzim) ? nullptr : &takeOffAngleAzim,
+      std::isfinite(takeOffAngleDip) ? nullptr : &takeOffAngleDip);
+}
 
-  // set velocityAtSrc
-  VelGridPtr velGrid = velIt->second;
-  velocityAtSrc      = velGrid->getVel(eventLat, eventLon, eventDepth);
+/*
+ * The source is projected once for all the grids sharing the same transform
+ * (usually all the grids of a model) and the grids are fetched from the pool
+ * once per station/phase pair.
+ */
+void NllTravelTimeTable::computeBatch(
+    double eventLat,
+    double eventLon,
+    double eventDepth,
+    const std::vector<const Catalog::Station *> &stations,
+    const std::vector<std::string> &phaseTypes,
+    std::vector<double> &travelTimes,
+    std::vector<double> &takeOffAngleAzims,
+    std::vector<double> &takeOffAngleDips,
+    std::vector<double> &velocitiesAtSrc,
+    std::vector<std::string> &errors)
+{
+  resizeBatchOutputs(stations.size(), travelTimes, takeOffAngleAzims,
+                     takeOffAngleDips, velocitiesAtSrc, errors);
+
+  // keep a reference to the grid owning the last transform, since the pool
+  // might release it in the meantime
+  GridPtr lastGrid;
+  Grid::Location lastLoc;
+  auto sourceLocation = [&](const GridPtr &grid) -> const Grid::Location & {
+    if (!lastGrid ||
+        !lastGrid->info.transform->sameProjection(*grid->info.transform))
+    {
+      lastLoc  = grid->toGridLocation(eventLat, eventLon, eventDepth);
+      lastGrid = grid;
+    }
+    return lastLoc;
+  };
 
-  string angleGId =
-      "angleGrid:" + Grid::filePath(_angleGridPath, station, phaseType);
-  auto angleIt = _angleGrids.find(angleGId);
-  if (angleIt == _angleGrids.end())
+  for (size_t i = 0; i < stations.size(); i++)
   {
-    // Check if we have already excluded the grid because we couldn't load it
-    if (_unloadableGrids.find(angleGId) == _unloadableGrids.end())
+    const Catalog::Station &station = *stations[i];
+    const std::string &phaseType    = phaseTypes[i];
+    try
     {
-      try
-      {
-        AngleGridPtr ag =
-            new AngleGrid(_angleGridPath, station, phaseType, _swapBytes);
-        angleIt =
-            _angleGrids.insert(std::pair<string, AngleGridPtr>(angleGId, ag))
-                .first;
-      }
-      catch (exception &e)
+      TimeGridPtr timeGrid = getTimeGrid(station, phaseType);
+      double travelTime    = timeGrid->getTime(sourceLocation(timeGrid));
+
+      VelGridPtr velGrid = getVelGrid(station, phaseType);
+      velocitiesAtSrc[i] = velGrid->getVel(sourceLocation(velGrid));
+
+      AngleGridPtr angleGrid = getAngleGrid(station, phaseType);
+      if (angleGrid)
       {
-        _unloadableGrids.insert(angleGId);
-        SEISCOMP_WARNING(
-            "Cannot load angle grid file: using approximated angles (%s)",
-            e.what());
+        try
+        {
+          angleGrid->getAngles(sourceLocation(angleGrid),
+                               takeOffAngleAzims[i], takeOffAngleDips[i]);
+        }
+        catch (exception &e)
+        {
+          SEISCOMP_WARNING(
+              "Error reading angle grid file: using approximated angles (%s)",
+              e.what());
+        }
       }
+      // approximate angles if not already provided by the grid
+      computeApproximatedTakeOfAngles(
+          eventLat, eventLon, eventDepth, station, phaseType,
+          std::isfinite(takeOffAngleAzims[i]) ? nullptr : &takeOffAngleAzims[i],
+          std::isfinite(takeOffAngleDips[i]) ? nullptr : &takeOffAngleDips[i]);
+
+      travelTimes[i] = travelTime;
+    }
+    catch (exception &e)
+    {
+      travelTimes[i] = std::nan("");
+      errors[i]      = e.what();
     }
   }
+}
 
-  // set takeOffAngles
-  takeOffAngleAzim = std::nan("");
-  takeOffAngleDip  = std::nan("");
-  if (angleIt != _angleGrids.end())
+void NllTravelTimeTable::computeBatch(
+    double eventLat,
+    double eventLon,
+    double eventDepth,
+    const std::vector<const Catalog::Station *> &stations,
+    const std::vector<std::string> &phaseTypes,
+    std::vector<double> &travelTimes,
+    std::vector<std::string> &errors)
+{
+  travelTimes.assign(stations.size(), std::nan(""));
+  errors.assign(stations.size(), "");
+
+  // keep a reference to the grid owning the last transform, since the pool
+  // might release it in the meantime
+  TimeGridPtr lastGrid;
+  Grid::Location loc;
+
+  for (size_t i = 0; i < stations.size(); i++)
   {
-    AngleGridPtr angleGrid = angleIt->second;
     try
     {
-      angleGrid->getAngles(eventLat, eventLon, eventDepth, takeOffAngleAzim,
-                           takeOffAngleDip);
+      TimeGridPtr timeGrid = getTimeGrid(*stations[i], phaseTypes[i]);
+      if (!lastGrid ||
+          !lastGrid->info.transform->sameProjection(*timeGrid->info.transform))
+      {
+        loc      = timeGrid->toGridLocation(eventLat, eventLon, eventDepth);
+        lastGrid = timeGrid;
+      }
+      travelTimes[i] = timeGrid->getTime(loc);
     }
     catch (exception &e)
     {
-      SEISCOMP_WARNING(
-          "Error reading angle grid file: using approximated angles (%s)",
-          e.what());
+      travelTimes[i] = std::nan("");
+      errors[i]      = e.what();
     }
   }
-  // approximate angles if not already provided by the grid
-  computeApproximatedTakeOfAngles(
-      eventLat, eventLon, eventDepth, station, phaseType,
-      std::isfinite(takeOffAngleAzim) ? nullptr : &takeOffAngleAzim,
-      std::isfinite(takeOffAngleDip) ? nullptr : &takeOffAngleDip);
+}
+
+GridPool &GridPool::instance()
+{
+  static GridPool pool;
+  return pool;
+}
+
+void GridPool::setLimits(size_t maxGrids, size_t maxMappedBytes)
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  _maxGrids       = maxGrids;
+  _maxMappedBytes = maxMappedBytes;
+  evict();
+}
+
+GridPtr GridPool::get(const std::string &key,
+                      const std::function<Grid *()> &factory)
+{
+  std::promise<GridPtr> promise;
+  std::shared_future<GridPtr> loading;
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+
+    auto it = _grids.find(key);
+    if (it != _grids.end())
+    {
+      // mark as most recently used
+      _lru.splice(_lru.begin(), _lru, it->second.lruPos);
+      return it->second.grid;
+    }
+
+    auto loadIt = _loading.find(key);
+    if (loadIt != _loading.end())
+      loading = loadIt->second; // another thread is loading it
+    else
+      _loading.emplace(key, promise.get_future().share());
+  }
+
+  // wait for the other thread (rethrows its exception, if any)
+  if (loading.valid()) return loading.get();
+
+  GridPtr grid;
+  try
+  {
+    grid = factory();
+  }
+  catch (...)
+  {
+    promise.set_exception(std::current_exception());
+    std::lock_guard<std::mutex> lock(_mtx);
+    _loading.erase(key);
+    throw;
+  }
+
+  promise.set_value(grid);
+  std::lock_guard<std::mutex> lock(_mtx);
+  _loading.erase(key);
+  _lru.push_front(key);
+  _grids[key] = {grid, _lru.begin()};
+  evict();
+  return grid;
+}
+
+// Release the least recently used grids until the limits are satisfied. The
+// most recently used grid is always kept. Must be called with the lock held.
+void GridPool::evict()
+{
+  size_t mappedBytes = 0;
+  if (_maxMappedBytes > 0)
+  {
+    for (const auto &kv : _grids) mappedBytes += kv.second.grid->mappedBytes();
+  }
+
+  while (_lru.size() > 1 &&
+         ((_maxGrids > 0 && _grids.size() > _maxGrids) ||
+          (_maxMappedBytes > 0 && mappedBytes > _maxMappedBytes)))
+  {
+    auto it = _grids.find(_lru.back());
+    mappedBytes -= it->second.grid->mappedBytes();
+    SEISCOMP_DEBUG("Releasing grid %s", it->first.c_str());
+    _grids.erase(it);
+    _lru.pop_back();
+  }
+}
+
+void GridPool::clear()
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  _grids.clear();
+  _lru.clear();
+}
+
+size_t GridPool::size() const
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  return _grids.size();
 }
 
 std::string Grid::filePath(const std::string &basePath,
@@ -299,9 +554,9 @@ std::string Grid::filePath(const std::string &basePath,
   static const std::regex reLoc("LOCATION", std::regex::optimize);
   static const std::regex rePha("PHASE", std::regex::optimize);
 
-  string out = std::regex_replace(basePath, reNet, station.networkCode);
-  out        = std::regex_replace(out, reSta, station.stationCode);
-  out        = std::regex_replace(out, reLoc, station.locationCode);
+  string out = std::regex_replace(basePath, reNet, station.networkCode.str());
+  out        = std::regex_replace(out, reSta, station.stationCode.str());
+  out        = std::regex_replace(out, reLoc, station.locationCode.str());
   return std::regex_replace(out, rePha, phaseType);
 }
 
@@ -319,6 +574,13 @@ Grid::Grid(Type gridType,
         stringify("Cannot find grid data file %s", info.bufFilePath.c_str());
     throw runtime_error(msg.c_str());
   }
+
+  mapBufFile(info.useDouble ? sizeof(double) : sizeof(float));
+}
+
+Grid::~Grid()
+{
+  if (_bufData) munmap(const_cast<char *>(_bufData), _bufSize);
 }
 
 Grid::Info
@@ -425,53 +687,65 @@ bool Grid::isIndexInside(unsigned long long ix,
 }
 
 /*
- * This is the function that reads the data from the grid files
  * Since the grid files can vary between hundres of MB to hundreds
  * of GB (even TB) we do not load all the grid files in memory, but
- * we read the data directly from the files, for each value!
- * That might raise concerns on the performance, due to the high I/O
- * involved. However the OS + Filesystem put lots of efforts on
- * caching mechanisms. For exampe when a simple float is read from
- * disk a full page (e.g. 4kB) will be read from disk and stored
- * in memory, so that subsequents reads at close offsets will be
- * fulfilled without additional I/O being involved.
- * In general it is hard to do better than OS+filesystem caching
- * and it might not be worth trying so until real-world scenarios
- * (e.g. grids stored on a network folder) prove an additional
- * caching layer to be necessary
+ * we memory-map them and let the OS + Filesystem load in memory only
+ * the pages actually accessed (and evict them under memory pressure).
+ * Compared to reading the values with seekg + read this avoids two system
+ * calls per value, which used to dominate the travel time computation.
  */
-template <class GRID_FLOAT_TYPE>
-GRID_FLOAT_TYPE Grid::getValueAtIndex(unsigned long long ix,
-                                      unsigned long long iy,
-                                      unsigned long long iz)
+void Grid::mapBufFile(size_t valueSize)
 {
-  if (!isIndexInside(ix, iy, iz))
+  int fd = open(info.bufFilePath.c_str(), O_RDONLY);
+  if (fd < 0)
   {
-    throw runtime_error("Requested index is out of grid boundaries");
+    string msg = stringify("Cannot open grid file %s (%s)",
+                           info.bufFilePath.c_str(), std::strerror(errno));
+    throw runtime_error(msg.c_str());
   }
 
-  if (!_bufReader.is_open())
+  struct stat st;
+  if (fstat(fd, &st) != 0)
   {
-    _bufReader.open(info.bufFilePath, std::ios::binary | std::ios::in);
-    _bufReader.exceptions(std::ios::badbit | std::ios::failbit);
+    close(fd);
+    string msg = stringify("Cannot stat grid file %s (%s)",
+                           info.bufFilePath.c_str(), std::strerror(errno));
+    throw runtime_error(msg.c_str());
   }
 
-  unsigned long pos = sizeof(GRID_FLOAT_TYPE) *
-                      (ix * info.numy * info.numz + iy * info.numz + iz);
-
-  GRID_FLOAT_TYPE value;
-  try
+  const unsigned long long expectedSize =
+      valueSize * info.numx * info.numy * info.numz;
+  if ((unsigned long long)st.st_size < expectedSize)
   {
-    _bufReader.seekg(pos);
-    _bufReader.read(reinterpret_cast<char *>(&value), sizeof(value));
+    close(fd);
+    string msg = stringify("Grid file %s is too small (%llu bytes, expected "
+                           "%llu bytes)",
+                           info.bufFilePath.c_str(),
+                           (unsigned long long)st.st_size, expectedSize);
+    throw runtime_error(msg.c_str());
   }
-  catch (exception &e)
+
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping keeps a reference to the file
+  if (data == MAP_FAILED)
   {
-    _bufReader.close();
-    string msg = stringify("Error while reading grid file %s (%s)",
-                           info.bufFilePath.c_str(), e.what());
+    string msg = stringify("Cannot memory-map grid file %s (%s)",
+                           info.bufFilePath.c_str(), std::strerror(errno));
     throw runtime_error(msg.c_str());
   }
+  // values are accessed scattered around the grid, readahead doesn't help
+  madvise(data, st.st_size, MADV_RANDOM);
+
+  _bufData = static_cast<const char *>(data);
+  _bufSize = st.st_size;
+}
+
+template <class GRID_FLOAT_TYPE>
+GRID_FLOAT_TYPE Grid::readValue(unsigned long long offset) const
+{
+  GRID_FLOAT_TYPE value;
+  std::memcpy(&value, _bufData + offset * sizeof(GRID_FLOAT_TYPE),
+              sizeof(value));
 
   if (info.swapBytes && sizeof(GRID_FLOAT_TYPE) == 4)
   {
@@ -486,6 +760,20 @@ GRID_FLOAT_TYPE Grid::getValueAtIndex(unsigned long long ix,
   return value;
 }
 
+template <class GRID_FLOAT_TYPE>
+GRID_FLOAT_TYPE Grid::getValueAtIndex(unsigned long long ix,
+                                      unsigned long long iy,
+                                      unsigned long long iz)
+{
+  if (!isIndexInside(ix, iy, iz))
+  {
+    throw runtime_error("Requested index is out of grid boundaries");
+  }
+
+  return readValue<GRID_FLOAT_TYPE>(ix * info.numy * info.numz +
+                                    iy * info.numz + iz);
+}
+
 template <class GRID_FLOAT_TYPE>
 void Grid::getValuesAt3DLocation(double xloc,
                                  double yloc,
@@ -537,16 +825,25 @@ void Grid::getValuesAt3DLocation(double xloc,
   ydiff = yoff - iy0;
   zdiff = zoff - iz0;
 
-  /* read vertex values from grid file */
+  /* read vertex values straight from the grid file mapping */
 
-  vval000 = getValueAtIndex<GRID_FLOAT_TYPE>(ix0, iy0, iz0);
-  vval001 = getValueAtIndex<GRID_FLOAT_TYPE>(ix0, iy0, iz1);
-  vval010 = getValueAtIndex<GRID_FLOAT_TYPE>(ix0, iy1, iz0);
-  vval011 = getValueAtIndex<GRID_FLOAT_TYPE>(ix0, iy1, iz1);
-  vval100 = getValueAtIndex<GRID_FLOAT_TYPE>(ix1, iy0, iz0);
-  vval101 = getValueAtIndex<GRID_FLOAT_TYPE>(ix1, iy0, iz1);
-  vval110 = getValueAtIndex<GRID_FLOAT_TYPE>(ix1, iy1, iz0);
-  vval111 = getValueAtIndex<GRID_FLOAT_TYPE>(ix1, iy1, iz1);
+  if (!isIndexInside(ix1, iy1, iz1))
+  {
+    throw runtime_error("Requested index is out of grid boundaries");
+  }
+
+  const unsigned long long strideX = info.numy * info.numz;
+  const unsigned long long strideY = info.numz;
+  const unsigned long long base    = ix0 * strideX + iy0 * strideY + iz0;
+
+  vval000 = readValue<GRID_FLOAT_TYPE>(base);
+  vval001 = readValue<GRID_FLOAT_TYPE>(base + 1);
+  vval010 = readValue<GRID_FLOAT_TYPE>(base + strideY);
+  vval011 = readValue<GRID_FLOAT_TYPE>(base + strideY + 1);
+  vval100 = readValue<GRID_FLOAT_TYPE>(base + strideX);
+  vval101 = readValue<GRID_FLOAT_TYPE>(base + strideX + 1);
+  vval110 = readValue<GRID_FLOAT_TYPE>(base + strideX + strideY);
+  vval111 = readValue<GRID_FLOAT_TYPE>(base + strideX + strideY + 1);
 }
 
 template <class GRID_FLOAT_TYPE>
@@ -593,64 +890,63 @@ void Grid::getValuesAt2DLocation(double yloc,
   ydiff = yoff - iy0;
   zdiff = zoff - iz0;
 
-  /* read vertex values from grid file */
+  /* read vertex values straight from the grid file mapping */
+
+  if (!isIndexInside(ix0, iy1, iz1))
+  {
+    throw runtime_error("Requested index is out of grid boundaries");
+  }
+
+  const unsigned long long strideY = info.numz;
+  const unsigned long long base    = iy0 * strideY + iz0;
 
-  vval00 = getValueAtIndex<GRID_FLOAT_TYPE>(ix0, iy0, iz0);
-  vval01 = getValueAtIndex<GRID_FLOAT_TYPE>(ix0, iy0, iz1);
-  vval10 = getValueAtIndex<GRID_FLOAT_TYPE>(ix0, iy1, iz0);
-  vval11 = getValueAtIndex<GRID_FLOAT_TYPE>(ix0, iy1, iz1);
+  vval00 = readValue<GRID_FLOAT_TYPE>(base);
+  vval01 = readValue<GRID_FLOAT_TYPE>(base + 1);
+  vval10 = readValue<GRID_FLOAT_TYPE>(base + strideY);
+  vval11 = readValue<GRID_FLOAT_TYPE>(base + strideY + 1);
 }
 
-template <class GRID_FLOAT_TYPE>
-GRID_FLOAT_TYPE Grid::getValue(
-    double lat,
-    double lon,
-    double depth,
-    const typename Interpolate3D<GRID_FLOAT_TYPE>::Type &interpolateValues3D,
-    const typename Interpolate2D<GRID_FLOAT_TYPE>::Type &interpolateValues2D)
+Grid::Location Grid::toGridLocation(double lat, double lon, double depth) const
+{
+  Location loc;
+  info.transform->fromLatLon(lat, lon, loc.xLoc, loc.yLoc);
+  loc.depth = depth;
+  return loc;
+}
+
+template <class GRID_FLOAT_TYPE, class POLICY>
+GRID_FLOAT_TYPE Grid::getValue(const Location &loc)
 {
   if (is3D()) // 3D grid
   {
-    return getValue3D<GRID_FLOAT_TYPE>(lat, lon, depth, interpolateValues3D);
+    return getValue3D<GRID_FLOAT_TYPE, POLICY>(loc);
   }
   else // 2D grid (1D model)
   {
-    return getValue2D<GRID_FLOAT_TYPE>(lat, lon, depth, interpolateValues2D);
+    return getValue2D<GRID_FLOAT_TYPE, POLICY>(loc);
   }
 }
 
-template <class GRID_FLOAT_TYPE>
-GRID_FLOAT_TYPE Grid::getValue3D(
-    double lat,
-    double lon,
-    double depth,
-    const typename Interpolate3D<GRID_FLOAT_TYPE>::Type &interpolateValues3D)
+template <class GRID_FLOAT_TYPE, class POLICY>
+GRID_FLOAT_TYPE Grid::getValue3D(const Location &loc)
 {
-  double xLoc, yLoc;
-  info.transform->fromLatLon(lat, lon, xLoc, yLoc);
-
   double xdiff, ydiff, zdiff;
   GRID_FLOAT_TYPE vval000, vval001, vval010, vval011, vval100, vval101, vval110,
       vval111;
 
-  getValuesAt3DLocation<GRID_FLOAT_TYPE>(xLoc, yLoc, depth, xdiff, ydiff, zdiff,
-                                         vval000, vval001, vval010, vval011,
-                                         vval100, vval101, vval110, vval111);
+  getValuesAt3DLocation<GRID_FLOAT_TYPE>(loc.xLoc, loc.yLoc, loc.depth, xdiff,
+                                         ydiff, zdiff, vval000, vval001,
+                                         vval010, vval011, vval100, vval101,
+                                         vval110, vval111);
 
-  return interpolateValues3D(xdiff, ydiff, zdiff, vval000, vval001, vval010,
-                             vval011, vval100, vval101, vval110, vval111);
+  return POLICY::template interpolateValues3D<GRID_FLOAT_TYPE>(
+      xdiff, ydiff, zdiff, vval000, vval001, vval010, vval011, vval100,
+      vval101, vval110, vval111);
 }
 
-template <class GRID_FLOAT_TYPE>
-GRID_FLOAT_TYPE Grid::getValue2D(
-    double lat,
-    double lon,
-    double depth,
-    const typename Interpolate2D<GRID_FLOAT_TYPE>::Type &interpolateValues2D)
+template <class GRID_FLOAT_TYPE, class POLICY>
+GRID_FLOAT_TYPE Grid::getValue2D(const Location &loc)
 {
-  double xLoc, yLoc;
-  info.transform->fromLatLon(lat, lon, xLoc, yLoc);
-
   double ydiff, zdiff;
   GRID_FLOAT_TYPE vval00, vval01, vval10, vval11;
 
@@ -666,13 +962,15 @@ GRID_FLOAT_TYPE Grid::getValue2D(
   }
   else
   {
-    dist = info.transform->distance(xLoc, yLoc, info.srcex, info.srcey);
+    dist = info.transform->distance(loc.xLoc, loc.yLoc, info.srcex,
+                                    info.srcey);
   }
 
-  getValuesAt2DLocation<GRID_FLOAT_TYPE>(dist, depth, ydiff, zdiff, vval00,
+  getValuesAt2DLocation<GRID_FLOAT_TYPE>(dist, loc.depth, ydiff, zdiff, vval00,
                                          vval01, vval10, vval11);
 
-  return interpolateValues2D(ydiff, zdiff, vval00, vval01, vval10, vval11);
+  return POLICY::template interpolateValues2D<GRID_FLOAT_TYPE>(
+      ydiff, zdiff, vval00, vval01, vval10, vval11);
 }
 
 TimeGrid::TimeGrid(const std::string &basePath,
@@ -689,17 +987,15 @@ TimeGrid::TimeGrid(const std::string &basePath,
   }
 }
 
-double TimeGrid::getTime(double lat, double lon, double depth)
+double TimeGrid::getTime(const Location &loc)
 {
   if (info.useDouble)
   {
-    return getValue<double>(lat, lon, depth, interpolateValues3D<double>,
-                            interpolateValues2D<double>);
+    return getValue<double, TimeGrid>(loc);
   }
   else
   {
-    return getValue<float>(lat, lon, depth, interpolateValues3D<float>,
-                           interpolateValues2D<float>);
+    return getValue<float, TimeGrid>(loc);
   }
 }
 
@@ -796,12 +1092,9 @@ AngleGrid::AngleGrid(const std::string &basePath,
   }
 }
 
-void AngleGrid::getAngles(
-    double lat, double lon, double depth, double &azim, double &dip)
+void AngleGrid::getAngles(const Location &loc, double &azim, double &dip)
 {
-  TakeOffAngles angles = getValue<TakeOffAngles>(
-      lat, lon, depth, interpolateValues3D<TakeOffAngles>,
-      interpolateValues2D<TakeOffAngles>);
+  TakeOffAngles angles = getValue<TakeOffAngles, AngleGrid>(loc);
 
   if (angles.quality < QUALITY_CUTOFF)
   {
@@ -897,18 +1190,16 @@ VelGrid::VelGrid(const std::string &basePath,
   }
 }
 
-double VelGrid::getVel(double lat, double lon, double depth)
+double VelGrid::getVel(const Location &loc)
 {
   double velAtSrc;
   if (info.useDouble)
   {
-    velAtSrc = getValue<double>(lat, lon, depth, interpolateValues3D<double>,
-                                interpolateValues2D<double>);
+    velAtSrc = getValue<double, VelGrid>(loc);
   }
   else
   {
-    velAtSrc = getValue<float>(lat, lon, depth, interpolateValues3D<float>,
-                               interpolateValues2D<float>);
+    velAtSrc = getValue<float, VelGrid>(loc);
   }
   // velocity -> [km/sec]
   return convertUnits(velAtSrc);
@@ -1063,6 +1354,13 @@ void Transform::fromLatLon(double lat,
   }
 }
 
+bool Transform::sameProjection(const Transform &other) const
+{
+  return info.type == other.info.type &&
+         info.orig_lat == other.info.orig_lat &&
+         info.orig_long == other.info.orig_long && info.rot == other.info.rot;
+}
+
 void Transform::toLatLon(double xLoc,
                          double yLoc,
                          double &lat,
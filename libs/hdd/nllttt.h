@@ -23,6 +23,10 @@
 #include <seiscomp3/seismology/ttt.h>
 
 #include <fstream>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -43,6 +47,8 @@ struct Transform
   void toLatLon(double xLoc, double yLoc, double &lat, double &lon) const;
   double fromLatLonAngle(double latlonAngle) const;
   double toLatLonAngle(double rectAngle) const;
+  // true when `other` projects lat/lon to the same rectangular coordinates
+  bool sameProjection(const Transform &other) const;
   double distance(double xLoc1, double yLoc1, double xLoc2, double yLoc2) const;
   double distance(double xLoc1,
                   double yLoc1,
@@ -54,14 +60,14 @@ struct Transform
   struct Info
   {
     std::string type;
-    double angle;
-    double cosang;
-    double sinang;
-    double orig_lat;
-    double orig_long;
-    double rot;
-    double sdc_xltkm;
-    double sdc_xlnkm;
+    double angle     = 0;
+    double cosang    = 1;
+    double sinang    = 0;
+    double orig_lat  = 0;
+    double orig_long = 0;
+    double rot       = 0;
+    double sdc_xltkm = 0;
+    double sdc_xlnkm = 0;
   };
   const Info info;
   static Info parse(const std::vector<std::string> &tokens);
@@ -94,7 +100,21 @@ public:
        const Catalog::Station &station,
        const std::string &phaseType,
        bool swapBytes);
-  virtual ~Grid() {}
+  virtual ~Grid();
+
+  // bytes of the grid file currently memory-mapped
+  size_t mappedBytes() const { return _bufSize; }
+
+  // A source location in the grid rectangular coordinates. It depends on the
+  // grid transform only, so it can be shared by the grids with the same
+  // projection (see Transform::sameProjection)
+  struct Location
+  {
+    double xLoc;
+    double yLoc;
+    double depth;
+  };
+  Location toGridLocation(double lat, double lon, double depth) const;
 
   bool isLocationInside(double xloc, double yloc, double zloc) const;
   bool isIndexInside(unsigned long long ix,
@@ -123,56 +143,23 @@ public:
   parse(const std::string &baseFilePath, Type gridType, bool swapBytes);
 
 protected:
-  std::ifstream _bufReader;
-
-  template <typename GRID_FLOAT_TYPE> struct Interpolate2D
-  {
-    typedef std::function<GRID_FLOAT_TYPE(double,
-                                          double,
-                                          GRID_FLOAT_TYPE,
-                                          GRID_FLOAT_TYPE,
-                                          GRID_FLOAT_TYPE,
-                                          GRID_FLOAT_TYPE)>
-        Type;
-  };
-
-  template <typename GRID_FLOAT_TYPE> struct Interpolate3D
-  {
-    typedef std::function<GRID_FLOAT_TYPE(double,
-                                          double,
-                                          double,
-                                          GRID_FLOAT_TYPE,
-                                          GRID_FLOAT_TYPE,
-                                          GRID_FLOAT_TYPE,
-                                          GRID_FLOAT_TYPE,
-                                          GRID_FLOAT_TYPE,
-                                          GRID_FLOAT_TYPE,
-                                          GRID_FLOAT_TYPE,
-                                          GRID_FLOAT_TYPE)>
-        Type;
-  };
+  // The grid data file is memory-mapped (read-only) at construction, after
+  // that the grid is immutable and can be read by multiple threads
+  void mapBufFile(size_t valueSize);
+  const char *_bufData = nullptr;
+  size_t _bufSize      = 0;
 
-  template <typename GRID_FLOAT_TYPE>
-  GRID_FLOAT_TYPE
-  getValue(double lat,
-           double lon,
-           double depth,
-           const typename Interpolate3D<GRID_FLOAT_TYPE>::Type &,
-           const typename Interpolate2D<GRID_FLOAT_TYPE>::Type &);
+  // POLICY is the Grid subclass providing the static interpolateValues3D and
+  // interpolateValues2D templates: the interpolation is resolved at compile
+  // time and it is inlined in the lookup
+  template <typename GRID_FLOAT_TYPE, typename POLICY>
+  GRID_FLOAT_TYPE getValue(const Location &loc);
 
-  template <typename GRID_FLOAT_TYPE>
-  GRID_FLOAT_TYPE
-  getValue3D(double lat,
-             double lon,
-             double depth,
-             const typename Interpolate3D<GRID_FLOAT_TYPE>::Type &);
+  template <typename GRID_FLOAT_TYPE, typename POLICY>
+  GRID_FLOAT_TYPE getValue3D(const Location &loc);
 
-  template <typename GRID_FLOAT_TYPE>
-  GRID_FLOAT_TYPE
-  getValue2D(double lat,
-             double lon,
-             double depth,
-             const typename Interpolate2D<GRID_FLOAT_TYPE>::Type &);
+  template <typename GRID_FLOAT_TYPE, typename POLICY>
+  GRID_FLOAT_TYPE getValue2D(const Location &loc);
 
   template <typename GRID_FLOAT_TYPE>
   void getValuesAt3DLocation(double xloc,
@@ -204,6 +191,10 @@ protected:
   GRID_FLOAT_TYPE getValueAtIndex(unsigned long long ix,
                                   unsigned long long iy,
                                   unsigned long long iz);
+
+  // no boundary checks: `offset` is the value position in the file
+  template <typename GRID_FLOAT_TYPE>
+  GRID_FLOAT_TYPE readValue(unsigned long long offset) const;
 };
 
 class TimeGrid : public Grid
@@ -213,9 +204,15 @@ public:
            const Catalog::Station &station,
            const std::string &phaseType,
            bool swapBytes);
-  double getTime(double lat, double lon, double depth);
+  double getTime(double lat, double lon, double depth)
+  {
+    return getTime(toGridLocation(lat, lon, depth));
+  }
+  double getTime(const Location &loc);
 
 protected:
+  friend class Grid; // interpolation policy
+
   template <class GRID_FLOAT_TYPE>
   static GRID_FLOAT_TYPE interpolateValues2D(double xdiff,
                                              double zdiff,
@@ -245,7 +242,11 @@ public:
             const std::string &phaseType,
             bool swapBytes);
   void
-  getAngles(double lat, double lon, double depth, double &azim, double &dip);
+  getAngles(double lat, double lon, double depth, double &azim, double &dip)
+  {
+    getAngles(toGridLocation(lat, lon, depth), azim, dip);
+  }
+  void getAngles(const Location &loc, double &azim, double &dip);
 
   struct TakeOffAngles
   {
@@ -257,6 +258,8 @@ public:
   static const unsigned QUALITY_CUTOFF = 5;
 
 protected:
+  friend class Grid; // interpolation policy
+
   template <class GRID_FLOAT_TYPE>
   static GRID_FLOAT_TYPE interpolateValues2D(double xdiff,
                                              double zdiff,
@@ -287,9 +290,15 @@ public:
           bool swapBytes);
   virtual bool is3D() const { return info.numx > 2; }
 
-  double getVel(double lat, double lon, double depth);
+  double getVel(double lat, double lon, double depth)
+  {
+    return getVel(toGridLocation(lat, lon, depth));
+  }
+  double getVel(const Location &loc);
 
 protected:
+  friend class Grid; // interpolation policy
+
   template <class GRID_FLOAT_TYPE>
   static GRID_FLOAT_TYPE interpolateValues2D(double xdiff,
                                              double zdiff,
@@ -316,7 +325,53 @@ DEFINE_SMARTPOINTER(Grid);
 DEFINE_SMARTPOINTER(TimeGrid);
 DEFINE_SMARTPOINTER(AngleGrid);
 DEFINE_SMARTPOINTER(VelGrid);
+DEFINE_SMARTPOINTER(NllTravelTimeTable);
+
+/*
+ * Process-wide pool of loaded grids, shared by all NllTravelTimeTable
+ * instances (e.g. multiple profiles using the same model). This allows the
+ * grids to stay loaded across relocations: only the least recently used
+ * grids are released when the pool exceeds `maxGrids` grids or
+ * `maxMappedBytes` bytes of memory-mapped grid files (0 -> no limit).
+ */
+class GridPool
+{
+public:
+  static GridPool &instance();
 
+  void setLimits(size_t maxGrids, size_t maxMappedBytes);
+
+  // Return the grid identified by `key`, or create it via `factory` if it
+  // is not in the pool. Exceptions thrown by `factory` are propagated.
+  // `factory` runs without holding the pool lock, so loading a grid doesn't
+  // block the access to the others; concurrent requests for the same key
+  // wait for the same load.
+  GridPtr get(const std::string &key, const std::function<Grid *()> &factory);
+
+  void clear();
+  size_t size() const;
+
+private:
+  GridPool() = default;
+  void evict();
+
+  struct Entry
+  {
+    GridPtr grid;
+    std::list<std::string>::iterator lruPos;
+  };
+  std::unordered_map<std::string, Entry> _grids;
+  std::unordered_map<std::string, std::shared_future<GridPtr>> _loading;
+  std::list<std::string> _lru; // front = most recently used
+  size_t _maxGrids       = 1000;
+  size_t _maxMappedBytes = 0;
+  mutable std::mutex _mtx;
+};
+
+/*
+ * Safe for concurrent compute() calls: the grids are immutable and shared
+ * through the GridPool.
+ */
 class NllTravelTimeTable : public TravelTimeTable
 {
 public:
@@ -340,15 +395,50 @@ public:
                        double &takeOffAngleDip,
                        double &velocityAtSrc);
 
+  // the Event overloads of the base class
+  using TravelTimeTable::computeBatch;
+
+  virtual void
+  computeBatch(double eventLat,
+               double eventLon,
+               double eventDepth,
+               const std::vector<const Catalog::Station *> &stations,
+               const std::vector<std::string> &phaseTypes,
+               std::vector<double> &travelTimes,
+               std::vector<double> &takeOffAngleAzims,
+               std::vector<double> &takeOffAngleDips,
+               std::vector<double> &velocitiesAtSrc,
+               std::vector<std::string> &errors);
+
+  virtual void
+  computeBatch(double eventLat,
+               double eventLon,
+               double eventDepth,
+               const std::vector<const Catalog::Station *> &stations,
+               const std::vector<std::string> &phaseTypes,
+               std::vector<double> &travelTimes,
+               std::vector<std::string> &errors);
+
+  virtual std::vector<std::string> dataFiles(const Catalog::Station &station,
+                                             const std::string &phaseType);
+
 private:
+  bool isUnloadable(const std::string &gridId);
+  void setUnloadable(const std::string &gridId);
+
+  TimeGridPtr getTimeGrid(const Catalog::Station &station,
+                          const std::string &phaseType);
+  VelGridPtr getVelGrid(const Catalog::Station &station,
+                        const std::string &phaseType);
+  AngleGridPtr getAngleGrid(const Catalog::Station &station,
+                            const std::string &phaseType);
+
   std::string _velGridPath;
   std::string _timeGridPath;
   std::string _angleGridPath;
   bool _swapBytes;
-  std::unordered_map<std::string, VelGridPtr> _velGrids;
-  std::unordered_map<std::string, TimeGridPtr> _timeGrids;
-  std::unordered_map<std::string, AngleGridPtr> _angleGrids;
   std::unordered_set<std::string> _unloadableGrids;
+  std::mutex _unloadableGridsMtx;
 };
 } // namespace NLL
 } // namespace HDD
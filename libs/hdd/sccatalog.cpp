@@ -269,7 +269,7 @@ ScCatalog::add(const std::vector<DataModel::OriginPtr> &origins,
 
       // add station if not already there
       if (searchStation(sta.networkCode, sta.stationCode, sta.locationCode) ==
-          _stations.end())
+          getStations().end())
       {
         DataModel::SensorLocation *loc = findSensorLocation(
             sta.networkCode, sta.stationCode, sta.locationCode, pick->time());
@@ -20,6 +20,11 @@
 #include <seiscomp3/core/strings.h>
 #include <seiscomp3/math/geo.h>
 #include <seiscomp3/math/math.h>
+#include <seiscomp3/system/environment.h>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <cmath>
+#include <limits>
 #include <sstream>
 #include <stdexcept>
 
@@ -29,16 +34,34 @@
 using namespace std;
 using Seiscomp::Core::stringify;
 
+namespace {
+
+// LOCSAT and libtau keep global state, so all the calls to the SeisComP
+// travel time interfaces must be serialized, regardless of the instance
+std::mutex &scInterfaceMutex()
+{
+  static std::mutex mtx;
+  return mtx;
+}
+
+} // namespace
+
 namespace Seiscomp {
 namespace HDD {
 
 ScTravelTimeTable::ScTravelTimeTable(const std::string &type,
                                      const std::string &model,
-                                     double depthVelResolution)
+                                     double depthVelResolution,
+                                     double maxProfileDepth)
     : TravelTimeTable(type, model), _depthVelResolution(depthVelResolution)
 {
-  _ttt = TravelTimeTableInterface::Create(type.c_str());
-  _ttt->setModel(model.c_str());
+  {
+    std::lock_guard<std::mutex> lock(scInterfaceMutex());
+    _ttt = TravelTimeTableInterface::Create(type.c_str());
+    _ttt->setModel(model.c_str());
+  }
+
+  loadDepthVelocityProfiles(maxProfileDepth);
 
   /*
   for (int i = 0; i < 500; i++)
@@ -56,6 +79,139 @@ ScTravelTimeTable::ScTravelTimeTable(const std::string &type,
   */
 }
 
+void ScTravelTimeTable::enableLookupTable(const LookupTableOptions &options)
+{
+  if (options.distanceStep <= 0 || options.depthStep <= 0 ||
+      options.maxDistance < options.distanceStep ||
+      options.maxDepth < options.depthStep)
+  {
+    throw runtime_error("Invalid travel time lookup table options");
+  }
+  _useLookupTable = true;
+  _lookupOptions  = options;
+
+  // the lookup table sources need the velocity down to the table depth
+  loadDepthVelocityProfiles(options.maxDepth);
+
+  _lookupNumDist  = std::floor(options.maxDistance / options.distanceStep) + 1;
+  _lookupNumDepth = std::floor(options.maxDepth / options.depthStep) + 1;
+
+  _lookupTables.clear();
+  const size_t numNodes = _lookupNumDist * _lookupNumDepth;
+  for (const string &phaseType : options.phaseTypes)
+  {
+    LookupTable *table = new LookupTable;
+    table->nodes.reset(new LookupNode[numNodes]);
+    table->ready.reset(new std::atomic<bool>[numNodes]);
+    for (size_t i = 0; i < numNodes; i++) table->ready[i] = false;
+    _lookupTables[phaseType].reset(table);
+  }
+}
+
+TravelTime ScTravelTimeTable::scCompute(const std::string &phaseType,
+                                        double lat1,
+                                        double lon1,
+                                        double dep1,
+                                        double lat2,
+                                        double lon2,
+                                        double alt2,
+                                        int ellc)
+{
+  std::lock_guard<std::mutex> lock(scInterfaceMutex());
+  return _ttt->compute(phaseType.c_str(), lat1, lon1, dep1, lat2, lon2, alt2,
+                       ellc);
+}
+
+const ScTravelTimeTable::LookupNode &
+ScTravelTimeTable::lookupNode(LookupTable &table,
+                              const std::string &phaseType,
+                              size_t ix,
+                              size_t iz)
+{
+  // the elevation slope is computed from this elevation and sea level
+  static constexpr double REF_ELEVATION = 1000; // meter
+
+  const size_t idx = ix * _lookupNumDepth + iz;
+  LookupNode &node = table.nodes[idx];
+  if (table.ready[idx].load(std::memory_order_acquire)) return node;
+
+  std::lock_guard<std::mutex> lock(_lookupMtx);
+  if (!table.ready[idx].load(std::memory_order_relaxed))
+  {
+    const double distance = ix * _lookupOptions.distanceStep;
+    const double depth    = iz * _lookupOptions.depthStep;
+    try
+    {
+      // same ellipticity correction as the direct computation
+      TravelTime tt0 = scCompute(phaseType, 0, 0, depth, 0, distance, 0);
+      TravelTime ttElev =
+          scCompute(phaseType, 0, 0, depth, 0, distance, REF_ELEVATION);
+      node.time           = tt0.time;
+      node.elevationSlope = (ttElev.time - tt0.time) / REF_ELEVATION;
+      node.takeOff        = tt0.takeoff;
+    }
+    catch (exception &e)
+    {
+      // phase not available: the travel time is computed directly
+      node.time = std::numeric_limits<double>::infinity();
+    }
+    table.ready[idx].store(true, std::memory_order_release);
+  }
+  return node;
+}
+
+void ScTravelTimeTable::travelTime(double eventLat,
+                                   double eventLon,
+                                   double depth,
+                                   const Catalog::Station &station,
+                                   const std::string &phaseType,
+                                   double &time,
+                                   double &takeOff)
+{
+  auto tableIt = _lookupTables.find(phaseType);
+  if (_useLookupTable && tableIt != _lookupTables.end())
+  {
+    double distance, az, baz;
+    Math::Geo::delazi(eventLat, eventLon, station.latitude, station.longitude,
+                      &distance, &az, &baz);
+
+    const double fx = distance / _lookupOptions.distanceStep;
+    const double fz = depth / _lookupOptions.depthStep;
+    const size_t ix = fx;
+    const size_t iz = fz;
+
+    if (ix + 1 < _lookupNumDist && iz + 1 < _lookupNumDepth)
+    {
+      LookupTable &table = *tableIt->second;
+      const LookupNode &n00 = lookupNode(table, phaseType, ix, iz);
+      const LookupNode &n01 = lookupNode(table, phaseType, ix, iz + 1);
+      const LookupNode &n10 = lookupNode(table, phaseType, ix + 1, iz);
+      const LookupNode &n11 = lookupNode(table, phaseType, ix + 1, iz + 1);
+
+      if (std::isfinite(n00.time) && std::isfinite(n01.time) &&
+          std::isfinite(n10.time) && std::isfinite(n11.time))
+      {
+        const double xdiff = fx - ix;
+        const double zdiff = fz - iz;
+        auto interpolate   = [&](double LookupNode::*value) {
+          return (n00.*value * (1 - zdiff) + n01.*value * zdiff) * (1 - xdiff) +
+                 (n10.*value * (1 - zdiff) + n11.*value * zdiff) * xdiff;
+        };
+        time = interpolate(&LookupNode::time) +
+               station.elevation * interpolate(&LookupNode::elevationSlope);
+        takeOff = interpolate(&LookupNode::takeOff);
+        return;
+      }
+    }
+  }
+
+  TravelTime tt = scCompute(phaseType, eventLat, eventLon, depth,
+                            station.latitude, station.longitude,
+                            station.elevation);
+  time    = tt.time;
+  takeOff = tt.takeoff;
+}
+
 void ScTravelTimeTable::compute(double eventLat,
                                 double eventLon,
                                 double eventDepth,
@@ -64,10 +220,9 @@ void ScTravelTimeTable::compute(double eventLat,
                                 double &travelTime)
 {
   double depth = eventDepth > 0 ? eventDepth : 0;
-  TravelTime tt =
-      _ttt->compute(phaseType.c_str(), eventLat, eventLon, depth,
-                    station.latitude, station.longitude, station.elevation);
-  travelTime = tt.time;
+  double takeOff;
+  this->travelTime(eventLat, eventLon, depth, station, phaseType, travelTime,
+                   takeOff);
 }
 
 void ScTravelTimeTable::compute(double eventLat,
@@ -81,52 +236,256 @@ void ScTravelTimeTable::compute(double eventLat,
                                 double &velocityAtSrc)
 {
   double depth = eventDepth > 0 ? eventDepth : 0;
-  TravelTime tt =
-      _ttt->compute(phaseType.c_str(), eventLat, eventLon, depth,
-                    station.latitude, station.longitude, station.elevation);
-  travelTime = tt.time;
+  double takeOff;
+  this->travelTime(eventLat, eventLon, depth, station, phaseType, travelTime,
+                   takeOff);
   computeApproximatedTakeOfAngles(eventLat, eventLon, eventDepth, station,
                                   phaseType, &takeOffAngleAzim,
                                   &takeOffAngleDip);
   // tt.takeoff is not computed for LOCSAT
   if (type == "libtau")
   {
-    takeOffAngleDip = deg2rad(tt.takeoff);
+    takeOffAngleDip = deg2rad(takeOff);
   }
   velocityAtSrc = velocityAtSource(depth, phaseType);
 }
 
-// Since the seiscomp travel time API doesn't offer the velocity at source we
-// need to reverse-engineer that information.
+/*
+ * The velocity at source depends on the source depth and phase type only, so
+ * it is computed once per phase type. The same station/phase pair is computed
+ * only once too.
+ */
+void ScTravelTimeTable::computeBatch(
+    double eventLat,
+    double eventLon,
+    double eventDepth,
+    const std::vector<const Catalog::Station *> &stations,
+    const std::vector<std::string> &phaseTypes,
+    std::vector<double> &travelTimes,
+    std::vector<double> &takeOffAngleAzims,
+    std::vector<double> &takeOffAngleDips,
+    std::vector<double> &velocitiesAtSrc,
+    std::vector<std::string> &errors)
+{
+  resizeBatchOutputs(stations.size(), travelTimes, takeOffAngleAzims,
+                     takeOffAngleDips, velocitiesAtSrc, errors);
+
+  const double depth = eventDepth > 0 ? eventDepth : 0;
+
+  unordered_map<string, double> velByPhase;
+  unordered_map<string, size_t> computed; // station/phase -> batch index
+
+  for (size_t i = 0; i < stations.size(); i++)
+  {
+    const Catalog::Station &station = *stations[i];
+    const std::string &phaseType    = phaseTypes[i];
+
+    const string key = station.id + ":" + phaseType;
+    auto it          = computed.find(key);
+    if (it != computed.end())
+    {
+      const size_t j       = it->second;
+      travelTimes[i]       = travelTimes[j];
+      takeOffAngleAzims[i] = takeOffAngleAzims[j];
+      takeOffAngleDips[i]  = takeOffAngleDips[j];
+      velocitiesAtSrc[i]   = velocitiesAtSrc[j];
+      errors[i]            = errors[j];
+      continue;
+    }
+    computed.emplace(key, i);
+
+    try
+    {
+      double time, takeOff;
+      travelTime(eventLat, eventLon, depth, station, phaseType, time, takeOff);
+      computeApproximatedTakeOfAngles(eventLat, eventLon, eventDepth, station,
+                                      phaseType, &takeOffAngleAzims[i],
+                                      &takeOffAngleDips[i]);
+      // tt.takeoff is not computed for LOCSAT
+      if (type == "libtau")
+      {
+        takeOffAngleDips[i] = deg2rad(takeOff);
+      }
+
+      auto velIt = velByPhase.find(phaseType);
+      if (velIt == velByPhase.end())
+      {
+        velIt = velByPhase
+                    .emplace(phaseType, velocityAtSource(depth, phaseType))
+                    .first;
+      }
+      velocitiesAtSrc[i] = velIt->second;
+      travelTimes[i]     = time;
+    }
+    catch (exception &e)
+    {
+      travelTimes[i] = std::nan("");
+      errors[i]      = e.what();
+    }
+  }
+}
+
+void ScTravelTimeTable::computeBatch(
+    double eventLat,
+    double eventLon,
+    double eventDepth,
+    const std::vector<const Catalog::Station *> &stations,
+    const std::vector<std::string> &phaseTypes,
+    std::vector<double> &travelTimes,
+    std::vector<std::string> &errors)
+{
+  travelTimes.assign(stations.size(), std::nan(""));
+  errors.assign(stations.size(), "");
+
+  const double depth = eventDepth > 0 ? eventDepth : 0;
+
+  unordered_map<string, size_t> computed; // station/phase -> batch index
+
+  for (size_t i = 0; i < stations.size(); i++)
+  {
+    const Catalog::Station &station = *stations[i];
+    const string key                = station.id + ":" + phaseTypes[i];
+    auto it                         = computed.find(key);
+    if (it != computed.end())
+    {
+      travelTimes[i] = travelTimes[it->second];
+      errors[i]      = errors[it->second];
+      continue;
+    }
+    computed.emplace(key, i);
+
+    try
+    {
+      double takeOff;
+      travelTime(eventLat, eventLon, depth, station, phaseTypes[i],
+                 travelTimes[i], takeOff);
+    }
+    catch (exception &e)
+    {
+      travelTimes[i] = std::nan("");
+      errors[i]      = e.what();
+    }
+  }
+}
+
+std::vector<std::string>
+ScTravelTimeTable::dataFiles(const Catalog::Station &station,
+                             const std::string &phaseType)
+{
+  // e.g. share/locsat/tables/iasp91.P or share/ttt/iasp91.hed
+  const boost::filesystem::path dir =
+      boost::filesystem::path(Environment::Instance()->shareDir()) /
+      (type == "LOCSAT" ? "locsat/tables" : "ttt");
+
+  std::vector<std::string> files;
+  boost::system::error_code ec;
+  for (boost::filesystem::directory_iterator it(dir, ec), end;
+       !ec && it != end; it.increment(ec))
+  {
+    if (it->path().filename().string().find(model + ".") == 0)
+    {
+      files.push_back(it->path().string());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
 double ScTravelTimeTable::velocityAtSource(double eventDepth,
                                            const std::string &phaseType)
 {
   if (eventDepth < 0) eventDepth = 0;
 
-  const unsigned bin         = std::floor(eventDepth / _depthVelResolution);
-  const double binStartDepth = bin * _depthVelResolution;
-  const double binEndDepth   = (bin + 1) * _depthVelResolution;
+  const size_t bin = std::floor(eventDepth / _depthVelResolution);
 
-  //
-  // first check if we have alrady computed the velocity for this phase/depth
-  //
-  auto it1 = _depthVel.find(phaseType);
-  if (it1 != _depthVel.end())
+  auto it = _depthVel.find(phaseType);
+  if (it == _depthVel.end() || bin >= it->second->size())
   {
-    const auto &phaseDepthVel = it1->second;
-    auto it2                  = phaseDepthVel.find(bin);
-    if (it2 != phaseDepthVel.end()) return it2->second;
+    return computeBinVelocity(phaseType, bin);
   }
 
-  //
-  // this is a new phase/depth pair
-  //
-  double tt1 =
-      (binStartDepth == 0)
-          ? 0
-          : _ttt->compute(phaseType.c_str(), 0, 0, binStartDepth, 0, 0, 0).time;
-  double tt2 =
-      _ttt->compute(phaseType.c_str(), 0, 0, binEndDepth, 0, 0, 0).time;
+  const double binVelocity = (*it->second)[bin];
+  if (!std::isfinite(binVelocity))
+  {
+    throw runtime_error("Unable to compute velocity at source");
+  }
+  return binVelocity;
+}
+
+void ScTravelTimeTable::loadDepthVelocityProfiles(double maxDepth)
+{
+  const size_t numBins = std::ceil(maxDepth / _depthVelResolution);
+  for (const string phaseType : {"P", "S"})
+  {
+    auto it = _depthVel.find(phaseType);
+    if (it != _depthVel.end() && it->second->size() >= numBins) continue;
+    _depthVel[phaseType] = depthVelocityProfile(phaseType, numBins);
+  }
+}
+
+std::shared_ptr<const ScTravelTimeTable::DepthVelocityProfile>
+ScTravelTimeTable::depthVelocityProfile(const std::string &phaseType,
+                                        size_t numBins)
+{
+  // The depth/velocity profiles are shared by all the tables with the same
+  // type and model, so they are computed once per process (or again when a
+  // deeper profile is needed)
+  static std::mutex profilesMtx;
+  static std::unordered_map<string, std::shared_ptr<const DepthVelocityProfile>>
+      profiles;
+
+  const string key = stringify("%s|%s|%s|%g", type.c_str(), model.c_str(),
+                               phaseType.c_str(), _depthVelResolution);
+
+  std::lock_guard<std::mutex> lock(profilesMtx);
+  auto it = profiles.find(key);
+  if (it != profiles.end() && it->second->size() >= numBins) return it->second;
+
+  // same as computeBinVelocity for each bin, but the travel time at the
+  // bottom of a bin is reused for the top of the next one
+  auto profile =
+      std::make_shared<DepthVelocityProfile>(numBins, std::nan(""));
+  double prevTime = 0; // travel time from the top of the bin
+  bool prevValid  = true;
+  for (size_t bin = 0; bin < numBins; bin++)
+  {
+    double time;
+    bool valid = true;
+    try
+    {
+      time = scCompute(phaseType, 0, 0, (bin + 1) * _depthVelResolution, 0, 0,
+                       0)
+                 .time;
+    }
+    catch (exception &e)
+    {
+      valid = false;
+    }
+    if (valid && prevValid)
+    {
+      (*profile)[bin] = _depthVelResolution / (time - prevTime);
+    }
+    prevTime  = time;
+    prevValid = valid;
+  }
+
+  profiles[key] = profile;
+  return profile;
+}
+
+// Since the seiscomp travel time API doesn't offer the velocity at source we
+// need to reverse-engineer that information: the velocity of a depth bin is
+// derived from the travel times to the surface from the bin boundaries
+double ScTravelTimeTable::computeBinVelocity(const std::string &phaseType,
+                                             size_t bin)
+{
+  const double binStartDepth = bin * _depthVelResolution;
+  const double binEndDepth   = (bin + 1) * _depthVelResolution;
+
+  double tt1 = (bin == 0)
+                   ? 0
+                   : scCompute(phaseType, 0, 0, binStartDepth, 0, 0, 0).time;
+  double tt2 = scCompute(phaseType, 0, 0, binEndDepth, 0, 0, 0).time;
 
   double binVelocity = _depthVelResolution / (tt2 - tt1); // [km/sec]
 
@@ -134,10 +493,6 @@ double ScTravelTimeTable::velocityAtSource(double eventDepth,
   {
     throw runtime_error("Unable to compute velocity at source");
   }
-
-  // store the value
-  _depthVel[phaseType][bin] = binVelocity;
-
   return binVelocity;
 }
 
@@ -22,19 +22,63 @@
 #include <seiscomp3/core/baseobject.h>
 #include <seiscomp3/seismology/ttt.h>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 namespace Seiscomp {
 namespace HDD {
 
+DEFINE_SMARTPOINTER(ScTravelTimeTable);
+
+/*
+ * Safe for concurrent compute() calls. The SeisComP travel time interfaces
+ * (LOCSAT, libtau) are not reentrant, so the calls to them are serialized
+ * process-wide: the lookup table avoids most of them.
+ */
 class ScTravelTimeTable : public TravelTimeTable
 {
 public:
+  /*
+   * The velocity at source is derived from a depth/velocity profile computed
+   * at construction down to `maxProfileDepth` (or the lookup table maximum
+   * depth if deeper) with `depthVelResolution` bins. The profiles are shared
+   * by all the tables with the same type and model. Deeper sources are
+   * computed directly.
+   */
   ScTravelTimeTable(const std::string &type,
                     const std::string &model,
-                    double depthVelResolution = 0.1);
+                    double depthVelResolution = 0.1,
+                    double maxProfileDepth    = 100);
   virtual ~ScTravelTimeTable() {}
 
+  /*
+   * Optional lookup table. For a 1D model the travel time depends only on the
+   * epicentral distance, the source depth and the station elevation, so for
+   * each phase the travel times (and take-off angles) are stored on a regular
+   * distance/depth grid and bilinearly interpolated. The elevation
+   * correction is linear in the elevation and it is stored as a slope per
+   * node. The nodes are computed lazily, the first time they are needed.
+   * Sources outside the table are computed directly. The nodes include the
+   * ellipticity correction of the direct computation, evaluated along the
+   * node path (source on the equator, station due east), so its dependency
+   * on the source latitude and azimuth is neglected.
+   */
+  struct LookupTableOptions
+  {
+    double distanceStep = 0.01; // degree
+    double maxDistance  = 10;   // degree
+    double depthStep    = 0.5;  // km
+    double maxDepth     = 100;  // km
+
+    // other phases are always computed directly
+    std::vector<std::string> phaseTypes = {"P", "S"};
+  };
+  // Not thread-safe: call it before the first compute()
+  void enableLookupTable(const LookupTableOptions &options);
+
   virtual void compute(double eventLat,
                        double eventLon,
                        double eventDepth,
@@ -52,13 +96,93 @@ public:
                        const std::string &phaseType,
                        double &travelTime);
 
+  // the Event overloads of the base class
+  using TravelTimeTable::computeBatch;
+
+  virtual void
+  computeBatch(double eventLat,
+               double eventLon,
+               double eventDepth,
+               const std::vector<const Catalog::Station *> &stations,
+               const std::vector<std::string> &phaseTypes,
+               std::vector<double> &travelTimes,
+               std::vector<double> &takeOffAngleAzims,
+               std::vector<double> &takeOffAngleDips,
+               std::vector<double> &velocitiesAtSrc,
+               std::vector<std::string> &errors);
+
+  virtual void
+  computeBatch(double eventLat,
+               double eventLon,
+               double eventDepth,
+               const std::vector<const Catalog::Station *> &stations,
+               const std::vector<std::string> &phaseTypes,
+               std::vector<double> &travelTimes,
+               std::vector<std::string> &errors);
+
+  // the model files in the SeisComP share directory
+  virtual std::vector<std::string> dataFiles(const Catalog::Station &station,
+                                             const std::string &phaseType);
+
 private:
   double velocityAtSource(double eventDepth, const std::string &phaseType);
 
+  // velocity [km/sec] at source indexed by depth bin (depth/resolution),
+  // nan where the model doesn't provide it
+  using DepthVelocityProfile = std::vector<double>;
+  void loadDepthVelocityProfiles(double maxDepth);
+  std::shared_ptr<const DepthVelocityProfile>
+  depthVelocityProfile(const std::string &phaseType, size_t numBins);
+  double computeBinVelocity(const std::string &phaseType, size_t bin);
+
+  // travel time and take-off angle (degree) from the lookup table when
+  // enabled and the source is inside it, otherwise from a direct computation
+  void travelTime(double eventLat,
+                  double eventLon,
+                  double depth,
+                  const Catalog::Station &station,
+                  const std::string &phaseType,
+                  double &time,
+                  double &takeOff);
+
+  TravelTime scCompute(const std::string &phaseType,
+                       double lat1,
+                       double lon1,
+                       double dep1,
+                       double lat2,
+                       double lon2,
+                       double alt2,
+                       int ellc = 1);
+
+  struct LookupNode
+  {
+    double time;           // sec, station at sea level (inf: not available)
+    double elevationSlope; // sec/meter
+    double takeOff;        // degree
+  };
+  struct LookupTable
+  {
+    std::unique_ptr<LookupNode[]> nodes;        // distance major
+    std::unique_ptr<std::atomic<bool>[]> ready; // node already computed
+  };
+  const LookupNode &lookupNode(LookupTable &table,
+                               const std::string &phaseType,
+                               size_t ix,
+                               size_t iz);
+
+  bool _useLookupTable = false;
+  LookupTableOptions _lookupOptions;
+  size_t _lookupNumDist  = 0;
+  size_t _lookupNumDepth = 0;
+  // key = phase type. The map is not modified after enableLookupTable()
+  std::unordered_map<std::string, std::unique_ptr<LookupTable>> _lookupTables;
+  std::mutex _lookupMtx; // serializes the computation of the nodes
+
   TravelTimeTableInterfacePtr _ttt;
   const double _depthVelResolution; // km
-  // key 1 = phase type. key 2 = depth bin
-  std::unordered_map<std::string, std::unordered_map<int, double>> _depthVel;
+  // key = phase type. The map is not modified after enableLookupTable()
+  std::unordered_map<std::string, std::shared_ptr<const DepthVelocityProfile>>
+      _depthVel;
 };
 
 } // namespace HDD
@@ -488,32 +488,20 @@ multimap<double, unsigned> Solver::computeInterEventDistance() const
     return multimap<double, unsigned>();
   }
 
-  map<string, double> distCache;
   multimap<double, unsigned> dists;
 
+  // The event coordinates have already been projected in the local Cartesian
+  // frame by computePartialDerivatives(), so avoid geodesic computations
   for (const auto &kw : _observations)
   {
-    unsigned obIdx           = kw.first;
-    const Observation &obsrv = kw.second;
-
-    double interEvDistance;
-
-    string key = obsrv.ev1Idx < obsrv.ev2Idx
-                     ? to_string(obsrv.ev1Idx) + "-" + to_string(obsrv.ev2Idx)
-                     : to_string(obsrv.ev2Idx) + "-" + to_string(obsrv.ev1Idx);
-
-    auto it = distCache.find(key);
-    if (it != distCache.end())
-    {
-      interEvDistance = it->second;
-    }
-    else
-    {
-      const EventParams &ev1Prm = _eventParams.at(obsrv.ev1Idx);
-      const EventParams &ev2Prm = _eventParams.at(obsrv.ev2Idx);
-      interEvDistance = computeDistance(ev1Prm.lat, ev1Prm.lon, ev1Prm.depth,
-                                        ev2Prm.lat, ev2Prm.lon, ev2Prm.depth);
-    }
+    unsigned obIdx            = kw.first;
+    const Observation &obsrv  = kw.second;
+    const EventParams &ev1Prm = _eventParams.at(obsrv.ev1Idx);
+    const EventParams &ev2Prm = _eventParams.at(obsrv.ev2Idx);
+
+    double interEvDistance =
+        std::sqrt(square(ev1Prm.x - ev2Prm.x) + square(ev1Prm.y - ev2Prm.y) +
+                  square(ev1Prm.z - ev2Prm.z));
 
     dists.emplace(interEvDistance, obIdx);
   }
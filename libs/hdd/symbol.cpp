@@ -0,0 +1,61 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU LESSER GENERAL PUBLIC LICENSE as          *
+ * published by the Free Software Foundation, either version 3 of the      *
+ * License, or (at your option) any later version.                         *
+ *                                                                         *
+ * This software is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/
+
+#include "symbol.h"
+
+#include <mutex>
+#include <unordered_set>
+
+using namespace std;
+
+namespace {
+
+// The table only grows: the interned strings live until the program exits.
+// The elements of an unordered_set are never moved, so their addresses stay
+// valid across rehashing.
+std::mutex tableMutex;
+unordered_set<string> &table()
+{
+  static unordered_set<string> symbols;
+  return symbols;
+}
+
+const string &emptyString()
+{
+  static const string empty;
+  return empty;
+}
+
+} // namespace
+
+namespace Seiscomp {
+namespace HDD {
+
+Symbol::Symbol() : _str(&emptyString()) {}
+
+Symbol::Symbol(const string &str) : _str(intern(str)) {}
+
+Symbol::Symbol(const char *str) : _str(intern(str)) {}
+
+const string *Symbol::intern(const string &str)
+{
+  if (str.empty()) return &emptyString();
+  lock_guard<std::mutex> lock(tableMutex);
+  return &*table().insert(str).first;
+}
+
+} // namespace HDD
+} // namespace Seiscomp
@@ -0,0 +1,123 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU LESSER GENERAL PUBLIC LICENSE as          *
+ * published by the Free Software Foundation, either version 3 of the      *
+ * License, or (at your option) any later version.                         *
+ *                                                                         *
+ * This software is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ *                                                                         *
+ *   Developed by Luca Scarabello <luca.scarabello@sed.ethz.ch>            *
+ ***************************************************************************/
+
+#ifndef __HDD_SYMBOL_H__
+#define __HDD_SYMBOL_H__
+
+#include <ostream>
+#include <string>
+
+namespace Seiscomp {
+namespace HDD {
+
+/*
+ * Interned string: equal strings share the same storage, which is never
+ * released. Meant for the small set of codes repeated in every station and
+ * phase record (network, station, location and channel codes, phase types):
+ * a Symbol has the size of a pointer, its copies don't allocate and two
+ * Symbols are compared by address.
+ */
+class Symbol
+{
+public:
+  Symbol();
+  Symbol(const std::string &str);
+  Symbol(const char *str);
+
+  operator const std::string &() const { return *_str; }
+  const std::string &str() const { return *_str; }
+  const char *c_str() const { return _str->c_str(); }
+  std::string::size_type size() const { return _str->size(); }
+  bool empty() const { return _str->empty(); }
+
+  bool operator==(const Symbol &other) const { return _str == other._str; }
+  bool operator!=(const Symbol &other) const { return _str != other._str; }
+
+private:
+  static const std::string *intern(const std::string &str);
+
+  const std::string *_str;
+};
+
+inline bool operator==(const Symbol &lhs, const std::string &rhs)
+{
+  return lhs.str() == rhs;
+}
+inline bool operator==(const std::string &lhs, const Symbol &rhs)
+{
+  return lhs == rhs.str();
+}
+inline bool operator==(const Symbol &lhs, const char *rhs)
+{
+  return lhs.str() == rhs;
+}
+inline bool operator==(const char *lhs, const Symbol &rhs)
+{
+  return lhs == rhs.str();
+}
+
+inline bool operator!=(const Symbol &lhs, const std::string &rhs)
+{
+  return !(lhs == rhs);
+}
+inline bool operator!=(const std::string &lhs, const Symbol &rhs)
+{
+  return !(lhs == rhs);
+}
+inline bool operator!=(const Symbol &lhs, const char *rhs)
+{
+  return !(lhs == rhs);
+}
+inline bool operator!=(const char *lhs, const Symbol &rhs)
+{
+  return !(lhs == rhs);
+}
+
+inline bool operator<(const Symbol &lhs, const Symbol &rhs)
+{
+  return lhs.str() < rhs.str();
+}
+
+inline std::string operator+(const Symbol &lhs, const Symbol &rhs)
+{
+  return lhs.str() + rhs.str();
+}
+inline std::string operator+(const Symbol &lhs, const std::string &rhs)
+{
+  return lhs.str() + rhs;
+}
+inline std::string operator+(const std::string &lhs, const Symbol &rhs)
+{
+  return lhs + rhs.str();
+}
+inline std::string operator+(const Symbol &lhs, const char *rhs)
+{
+  return lhs.str() + rhs;
+}
+inline std::string operator+(const char *lhs, const Symbol &rhs)
+{
+  return lhs + rhs.str();
+}
+
+inline std::ostream &operator<<(std::ostream &os, const Symbol &symbol)
+{
+  return os << symbol.str();
+}
+
+} // namespace HDD
+} // namespace Seiscomp
+
+#endif
@@ -0,0 +1,746 @@
+#define SEISCOMP_TEST_MODULE hdd
+#include <seiscomp/unittest/unittests.h>
+#include <boost/test/data/monomorphic.hpp>
+#include <boost/test/data/test_case.hpp>
+
+#include "bincatalog.h"
+#include "catalog.h"
+#include "csvreader.h"
+#include "symbol.h"
+#include "utils.h"
+#include <seiscomp/logging/log.h>
+#include <seiscomp3/math/geo.h>
+#include <seiscomp3/math/math.h>
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <thread>
+
+using namespace std;
+using namespace Seiscomp;
+using Seiscomp::Core::stringify;
+using Event     = HDD::Catalog::Event;
+using Phase     = HDD::Catalog::Phase;
+using Station   = HDD::Catalog::Station;
+namespace bdata = boost::unit_test::data;
+
+namespace {
+
+void addStationsToCatalog(HDD::CatalogPtr cat,
+                          double lat,
+                          double lon,
+                          double distance)
+{
+  distance = Math::Geo::km2deg(distance);
+
+  Station sta;
+  double staLat, staLon;
+
+  Math::Geo::delandaz2coord(distance, 0, lat, lon, &staLat, &staLon);
+  sta = {"NET.ST01", staLat, staLon, 250, "NET", "ST01", ""};
+  cat->addStation(sta);
+  Math::Geo::delandaz2coord(distance, 90, lat, lon, &staLat, &staLon);
+  sta = {"NET.ST02", staLat, staLon, 295, "NET", "ST02", ""};
+  cat->addStation(sta);
+  Math::Geo::delandaz2coord(distance, 180, lat, lon, &staLat, &staLon);
+  sta = {"NET.ST03", staLat, staLon, 301, "NET", "ST03", ""};
+  cat->addStation(sta);
+  Math::Geo::delandaz2coord(distance, 270, lat, lon, &staLat, &staLon);
+  sta = {"NET.ST04", staLat, staLon, 395, "NET", "ST04", ""};
+  cat->addStation(sta);
+}
+
+void addEventToCatalog(HDD::CatalogPtr cat,
+                       double lat,
+                       double lon,
+                       double depth)
+{
+  Event ev{0};
+  ev.latitude            = lat;
+  ev.longitude           = lon;
+  ev.depth               = depth;
+  const unsigned eventId = cat->addEvent(ev);
+
+  for (const auto &kv : cat->getStations())
+  {
+    const Station &sta = kv.second;
+
+    Phase ph;
+    ph.eventId          = eventId;
+    ph.stationId        = sta.id;
+    ph.lowerUncertainty = 0;
+    ph.upperUncertainty = 0;
+    ph.type             = "P";
+    ph.networkCode      = sta.networkCode;
+    ph.stationCode      = sta.stationCode;
+    ph.locationCode     = sta.locationCode;
+    ph.channelCode      = "";
+    ph.isManual         = true;
+    cat->addPhase(ph);
+  }
+}
+
+void addNeighboursToCatalog(HDD::CatalogPtr cat,
+                            const Event &event,
+                            const vector<double> neighDist)
+{
+  for (double distance : neighDist)
+  {
+    distance     = Math::Geo::km2deg(distance);
+    double depth = event.depth;
+
+    double neighbourLat, neighbourLon;
+    Math::Geo::delandaz2coord(distance, 45, event.latitude, event.longitude,
+                              &neighbourLat, &neighbourLon);
+    addEventToCatalog(cat, neighbourLat, neighbourLon, depth);
+    Math::Geo::delandaz2coord(distance, 135, event.latitude, event.longitude,
+                              &neighbourLat, &neighbourLon);
+    addEventToCatalog(cat, neighbourLat, neighbourLon, depth);
+    Math::Geo::delandaz2coord(distance, 225, event.latitude, event.longitude,
+                              &neighbourLat, &neighbourLon);
+    addEventToCatalog(cat, neighbourLat, neighbourLon, depth);
+    Math::Geo::delandaz2coord(distance, 315, event.latitude, event.longitude,
+                              &neighbourLat, &neighbourLon);
+    addEventToCatalog(cat, neighbourLat, neighbourLon, depth);
+  }
+}
+
+HDD::CatalogPtr buildCatalog(double lat,
+                             double lon,
+                             double depth,
+                             double stationsDistance,
+                             const vector<double> neighDist)
+{
+  HDD::CatalogPtr cat(new HDD::Catalog());
+  addStationsToCatalog(cat, lat, lon, stationsDistance);
+  addEventToCatalog(cat, lat, lon, depth);
+  const Event &event = cat->getEvents().begin()->second;
+  addNeighboursToCatalog(cat, event, neighDist);
+  return HDD::Catalog::filterPhasesAndSetWeights(*cat, Phase::Source::CATALOG,
+                                                 {"P"}, {"S"});
+}
+
+const vector<unsigned> benchmarkPhases = {10000, 100000, 1000000};
+
+// catalog of `numPhases` phases: 20 stations, each event has a P phase at
+// every station
+HDD::CatalogPtr buildLargeCatalog(unsigned numPhases)
+{
+  const unsigned numStations = 20;
+  unordered_map<string, Station> stations;
+  for (unsigned s = 0; s < numStations; s++)
+  {
+    Station sta;
+    sta.stationCode  = stringify("ST%02u", s);
+    sta.networkCode  = "NET";
+    sta.locationCode = "";
+    sta.id           = "NET." + sta.stationCode + ".";
+    sta.latitude     = 46 + s * 0.05;
+    sta.longitude    = 8 + s * 0.05;
+    sta.elevation    = 500;
+    stations[sta.id] = sta;
+  }
+
+  map<unsigned, Event> events;
+  unordered_multimap<unsigned, Phase> phases;
+  for (unsigned id = 1; id <= numPhases / numStations; id++)
+  {
+    Event ev;
+    ev.id        = id;
+    ev.time      = Core::Time(1600000000 + id * 60, 0);
+    ev.latitude  = 46.5 + (id % 100) * 0.001;
+    ev.longitude = 8.5 + (id % 97) * 0.001;
+    ev.depth     = 5 + (id % 10) * 0.1;
+    ev.magnitude = 1.5;
+    ev.rms       = 0.1;
+    events[id]   = ev;
+
+    for (const auto &kv : stations)
+    {
+      Phase ph;
+      ph.eventId          = id;
+      ph.stationId        = kv.second.id;
+      ph.time             = ev.time + Core::TimeSpan(2.5);
+      ph.lowerUncertainty = 0.05;
+      ph.upperUncertainty = 0.05;
+      ph.type             = "Pg";
+      ph.networkCode      = kv.second.networkCode;
+      ph.stationCode      = kv.second.stationCode;
+      ph.locationCode     = kv.second.locationCode;
+      ph.channelCode      = "HHZ";
+      ph.isManual         = true;
+      phases.emplace(id, ph);
+    }
+  }
+  return new HDD::Catalog(std::move(stations), std::move(events),
+                          std::move(phases));
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_catalog_phase_index)
+{
+  HDD::CatalogPtr cat = buildCatalog(46, 8, 3, 50, {0.5, 1.5, 3.0});
+
+  auto checkIndex = [](const HDD::Catalog &cat) {
+    for (const auto &kv : cat.getPhases())
+    {
+      const Phase &phase = kv.second;
+      auto it = cat.searchPhase(phase.eventId, phase.stationId,
+                                phase.procInfo.type);
+      BOOST_REQUIRE(it != cat.getPhases().end());
+      BOOST_CHECK(it->second == phase);
+      BOOST_CHECK_EQUAL(cat.searchEventsWithPhase(phase.stationId,
+                                                  phase.procInfo.type)
+                            .count(phase.eventId),
+                        1);
+    }
+  };
+  checkIndex(*cat);
+
+  // every event has a P phase at every station
+  for (const auto &kv : cat->getStations())
+  {
+    BOOST_CHECK_EQUAL(
+        cat->searchEventsWithPhase(kv.first, Phase::Type::P).size(),
+        cat->getEvents().size());
+    BOOST_CHECK(cat->searchEventsWithPhase(kv.first, Phase::Type::S).empty());
+    BOOST_CHECK(cat->searchPhase(1, kv.first, Phase::Type::S) ==
+                cat->getPhases().end());
+  }
+  BOOST_CHECK(cat->searchEventsWithPhase("NET.ST99", Phase::Type::P).empty());
+
+  // the indices follow the catalog changes
+  cat->removePhase(1, "NET.ST01.", Phase::Type::P);
+  BOOST_CHECK(cat->searchPhase(1, "NET.ST01.", Phase::Type::P) ==
+              cat->getPhases().end());
+  BOOST_CHECK_EQUAL(
+      cat->searchEventsWithPhase("NET.ST01.", Phase::Type::P).count(1), 0);
+
+  cat->removeEvent(2);
+  for (const auto &kv : cat->getStations())
+  {
+    BOOST_CHECK(cat->searchPhase(2, kv.first, Phase::Type::P) ==
+                cat->getPhases().end());
+    BOOST_CHECK_EQUAL(
+        cat->searchEventsWithPhase(kv.first, Phase::Type::P).count(2), 0);
+  }
+
+  Phase phase = cat->searchPhase(3, "NET.ST02.", Phase::Type::P)->second;
+  phase.time  = phase.time + Core::TimeSpan(1.5);
+  BOOST_CHECK(cat->updatePhase(phase));
+  BOOST_CHECK(cat->searchPhase(3, "NET.ST02.", Phase::Type::P)->second ==
+              phase);
+
+  phase.procInfo.type = Phase::Type::S;
+  BOOST_CHECK(!cat->updatePhase(phase, true));
+  BOOST_CHECK(cat->searchPhase(3, "NET.ST02.", Phase::Type::S) !=
+              cat->getPhases().end());
+  BOOST_CHECK_EQUAL(
+      cat->searchEventsWithPhase("NET.ST02.", Phase::Type::S).size(), 1);
+  checkIndex(*cat);
+
+  // the copies have their own indices
+  HDD::CatalogPtr copy = new HDD::Catalog(*cat);
+  cat->removeEvent(3);
+  checkIndex(*copy);
+  BOOST_CHECK(copy->searchPhase(3, "NET.ST02.", Phase::Type::S) !=
+              copy->getPhases().end());
+}
+
+BOOST_AUTO_TEST_CASE(test_catalog_copy_on_write)
+{
+  HDD::CatalogCPtr cat = buildCatalog(46, 8, 3, 50, {0.5, 1.5, 3.0});
+  HDD::CatalogPtr copy = new HDD::Catalog(*cat);
+
+  // copies share the data until modified
+  BOOST_CHECK(&copy->getStations() == &cat->getStations());
+  BOOST_CHECK(&copy->getEvents() == &cat->getEvents());
+  BOOST_CHECK(&copy->getPhases() == &cat->getPhases());
+
+  Event ev = copy->getEvents().at(1);
+  ev.depth = ev.depth + 1;
+  copy->updateEvent(ev);
+  BOOST_CHECK(&copy->getEvents() != &cat->getEvents());
+  BOOST_CHECK(&copy->getPhases() == &cat->getPhases());
+  BOOST_CHECK_EQUAL(copy->getEvents().at(1).depth, ev.depth);
+  BOOST_CHECK_EQUAL(cat->getEvents().at(1).depth, ev.depth - 1);
+  BOOST_CHECK_NE(copy->getEventCoordinates(1).z,
+                 cat->getEventCoordinates(1).z);
+
+  Phase phase = copy->searchPhase(2, "NET.ST01.", Phase::Type::P)->second;
+  phase.time  = phase.time + Core::TimeSpan(1.5);
+  copy->updatePhase(phase);
+  copy->removeEvent(3);
+  BOOST_CHECK(&copy->getPhases() != &cat->getPhases());
+  BOOST_CHECK(copy->searchPhase(2, "NET.ST01.", Phase::Type::P)->second ==
+              phase);
+  BOOST_CHECK(cat->searchPhase(2, "NET.ST01.", Phase::Type::P)->second !=
+              phase);
+  BOOST_CHECK(copy->searchPhase(3, "NET.ST01.", Phase::Type::P) ==
+              copy->getPhases().end());
+  BOOST_CHECK(cat->searchPhase(3, "NET.ST01.", Phase::Type::P) !=
+              cat->getPhases().end());
+  BOOST_CHECK_EQUAL(
+      cat->searchEventsWithPhase("NET.ST01.", Phase::Type::P).count(3), 1);
+
+  // the stations were never modified
+  BOOST_CHECK(&copy->getStations() == &cat->getStations());
+}
+
+BOOST_AUTO_TEST_CASE(test_catalog_search_event)
+{
+  HDD::CatalogPtr cat = buildCatalog(46, 8, 3, 50, {0.5, 1.5, 3.0});
+
+  for (const auto &kv : cat->getEvents())
+    BOOST_CHECK_EQUAL(cat->searchEvent(kv.second)->first, kv.first);
+
+  Event ev = cat->getEvents().at(2);
+  ev.depth = ev.depth + 1;
+  BOOST_CHECK(cat->searchEvent(ev) == cat->getEvents().end());
+
+  // the index follows the catalog changes
+  HDD::CatalogPtr copy = new HDD::Catalog(*cat);
+  const Event oldEv    = cat->getEvents().at(2);
+  cat->updateEvent(ev);
+  BOOST_CHECK_EQUAL(cat->searchEvent(ev)->first, 2);
+  BOOST_CHECK(cat->searchEvent(oldEv) == cat->getEvents().end());
+  BOOST_CHECK_EQUAL(copy->searchEvent(oldEv)->first, 2);
+  BOOST_CHECK(copy->searchEvent(ev) == copy->getEvents().end());
+
+  cat->removeEvent(2);
+  BOOST_CHECK(cat->searchEvent(ev) == cat->getEvents().end());
+
+  // events with the same values: the lowest id is returned
+  const unsigned newId = cat->addEvent(cat->getEvents().at(3));
+  BOOST_CHECK_NE(newId, 3);
+  BOOST_CHECK_EQUAL(cat->searchEvent(cat->getEvents().at(3))->first, 3);
+  cat->removeEvent(3);
+  BOOST_CHECK_EQUAL(cat->searchEvent(cat->getEvents().at(newId))->first,
+                    newId);
+
+  // merging a catalog with itself doesn't duplicate events and phases
+  HDD::CatalogPtr merged = new HDD::Catalog(*copy);
+  merged->add(*copy, false);
+  BOOST_CHECK_EQUAL(merged->getEvents().size(), copy->getEvents().size());
+  BOOST_CHECK_EQUAL(merged->getPhases().size(), copy->getPhases().size());
+
+  HDD::CatalogCPtr other = buildCatalog(47, 9, 3, 50, {0.5, 1.5});
+  merged->add(*other, false);
+  BOOST_CHECK_EQUAL(merged->getEvents().size(),
+                    copy->getEvents().size() + other->getEvents().size());
+  BOOST_CHECK_EQUAL(merged->getPhases().size(),
+                    copy->getPhases().size() + other->getPhases().size());
+  for (const auto &kv : other->getEvents())
+    BOOST_CHECK(merged->searchEvent(kv.second) != merged->getEvents().end());
+
+  // a single event is always added with a new id, even when an event with
+  // the same values exists (e.g. an origin to relocate identical to one of
+  // its neighbours must not be merged into it)
+  HDD::CatalogPtr neighbourCat = copy->extractEvent(4, true);
+  HDD::CatalogCPtr origin      = copy->extractEvent(4, false);
+  const size_t numPhases       = neighbourCat->getPhases().size();
+  const unsigned originId =
+      neighbourCat->add(origin->getEvents().begin()->first, *origin, false);
+  BOOST_CHECK_NE(originId, 4);
+  BOOST_CHECK_EQUAL(neighbourCat->getEvents().size(), 2);
+  BOOST_CHECK(neighbourCat->getEvents().at(originId) ==
+              neighbourCat->getEvents().at(4));
+  BOOST_CHECK_EQUAL(neighbourCat->getPhases().count(4), numPhases);
+  BOOST_CHECK_EQUAL(neighbourCat->getPhases().count(originId), numPhases);
+}
+
+BOOST_AUTO_TEST_CASE(test_binary_catalog)
+{
+  HDD::CatalogPtr cat = buildCatalog(46, 8, 3, 50, {0.5, 1.5, 3.0});
+
+  Event ev                            = cat->getEvents().at(2);
+  ev.time                             = Core::Time(1600000000, 123456);
+  ev.relocInfo.isRelocated            = true;
+  ev.relocInfo.startRms               = 0.25;
+  ev.relocInfo.neighbours.amount      = 3;
+  ev.relocInfo.ddObs.numCCs           = 7;
+  ev.relocInfo.ddObs.finalResidualMAD = 0.012;
+  cat->updateEvent(ev);
+
+  Phase phase = cat->searchPhase(2, "NET.ST03.", Phase::Type::P)->second;
+
+  phase.isManual               = false;
+  phase.procInfo.weight        = 0.8;
+  phase.relocInfo->isRelocated = true;
+  phase.relocInfo->finalWeight = 0.6;
+  phase.relocInfo->numCCObs    = 5;
+  cat->updatePhase(phase);
+
+  const string filename = "test_binary_catalog.bin";
+  if (boost::filesystem::exists(filename)) boost::filesystem::remove(filename);
+  cat->writeToFile(filename);
+  BOOST_REQUIRE(HDD::BinaryCatalog::isBinaryCatalog(filename));
+
+  HDD::CatalogCPtr loaded  = new HDD::Catalog(filename, true);
+  HDD::CatalogCPtr noReloc = new HDD::Catalog(filename, false);
+  boost::filesystem::remove(filename);
+
+  BOOST_REQUIRE_EQUAL(loaded->getStations().size(), cat->getStations().size());
+  for (const auto &kv : cat->getStations())
+  {
+    const Station &sta = loaded->getStations().at(kv.first);
+    BOOST_CHECK(sta == kv.second);
+    BOOST_CHECK(sta.id == kv.second.id);
+  }
+
+  BOOST_REQUIRE_EQUAL(loaded->getEvents().size(), cat->getEvents().size());
+  for (const auto &kv : cat->getEvents())
+    BOOST_CHECK(loaded->getEvents().at(kv.first) == kv.second);
+
+  BOOST_REQUIRE_EQUAL(loaded->getPhases().size(), cat->getPhases().size());
+  for (const auto &kv : cat->getPhases())
+  {
+    auto range = loaded->getPhases().equal_range(kv.first);
+    BOOST_CHECK(std::any_of(
+        range.first, range.second,
+        [&kv](const pair<const unsigned, Phase> &p) {
+          return p.second == kv.second &&
+                 p.second.stationId == kv.second.stationId;
+        }));
+  }
+
+  const Event &loadedEv = loaded->getEvents().at(2);
+  BOOST_CHECK(loadedEv.time == ev.time);
+  BOOST_CHECK(loadedEv.relocInfo.isRelocated);
+  BOOST_CHECK_EQUAL(loadedEv.relocInfo.startRms, 0.25);
+  BOOST_CHECK_EQUAL(loadedEv.relocInfo.neighbours.amount, 3);
+  BOOST_CHECK_EQUAL(loadedEv.relocInfo.ddObs.numCCs, 7);
+  BOOST_CHECK_EQUAL(loadedEv.relocInfo.ddObs.finalResidualMAD, 0.012);
+  BOOST_CHECK(!loaded->getEvents().at(1).relocInfo.isRelocated);
+  BOOST_CHECK(!noReloc->getEvents().at(2).relocInfo.isRelocated);
+
+  unsigned relocatedPhases = 0;
+  for (const auto &kv : loaded->getPhases())
+  {
+    const Phase &ph = kv.second;
+    if (!ph.relocInfo->isRelocated) continue;
+    relocatedPhases++;
+    BOOST_CHECK(ph == phase);
+    BOOST_CHECK_EQUAL(ph.procInfo.weight, 0.8);
+    BOOST_CHECK_EQUAL(ph.relocInfo->finalWeight, 0.6);
+    BOOST_CHECK_EQUAL(ph.relocInfo->numCCObs, 5);
+  }
+  BOOST_CHECK_EQUAL(relocatedPhases, 1);
+
+  // phases read from file have default processing info, so the phase index
+  // is well defined before filterPhasesAndSetWeights
+  for (const auto &kv : loaded->getPhases())
+  {
+    BOOST_CHECK(kv.second.procInfo.type == Phase::Type::P);
+    BOOST_CHECK(
+        loaded->searchPhase(kv.first, kv.second.stationId, Phase::Type::P) !=
+        loaded->getPhases().end());
+  }
+  for (const auto &kv : noReloc->getPhases())
+    BOOST_CHECK(!kv.second.relocInfo.isSet());
+
+  // a csv file is not a binary catalog
+  const string csvFile = "test_binary_catalog.csv";
+  ofstream(csvFile) << "id,latitude,longitude" << endl;
+  BOOST_CHECK(!HDD::BinaryCatalog::isBinaryCatalog(csvFile));
+  BOOST_CHECK_THROW(HDD::Catalog csvCat(csvFile), std::runtime_error);
+  boost::filesystem::remove(csvFile);
+}
+
+BOOST_AUTO_TEST_CASE(test_csv_reader)
+{
+  const string filename = "test_csv_reader.csv";
+
+  // quoted fields, rows shorter and longer than the header and no trailing
+  // newline
+  ofstream(filename) << "id,name,value\n"
+                     << "1,\"a, b\",1.5\n"
+                     << "2,\"say \"\"hi\"\"\",\"\"\n"
+                     << "3,short\n"
+                     << "4,long,2.5,extra1,extra2\n"
+                     << "5,,\n"
+                     << "6,last,3.5";
+  {
+    HDD::CSV::Reader reader(filename);
+    BOOST_CHECK(reader.header() == vector<string>({"id", "name", "value"}));
+    const int id    = reader.requiredColumn("id");
+    const int name  = reader.requiredColumn("name");
+    const int value = reader.requiredColumn("value");
+    BOOST_CHECK_EQUAL(reader.column("missing"), -1);
+    BOOST_CHECK_THROW(reader.requiredColumn("missing"), std::runtime_error);
+
+    vector<vector<string>> rows;
+    while (reader.next())
+    {
+      rows.push_back({reader.field(id).str(), reader.field(name).str(),
+                      reader.field(value).str()});
+    }
+    const vector<vector<string>> expected = {
+        {"1", "a, b", "1.5"},    {"2", "say \"hi\"", ""}, {"3", "short", ""},
+        {"4", "long", "2.5"},    {"5", "", ""},           {"6", "last", "3.5"},
+    };
+    BOOST_CHECK(rows == expected);
+
+    // same result as the container based reader
+    const vector<unordered_map<string, string>> containerRows =
+        HDD::CSV::readWithHeader(filename);
+    BOOST_REQUIRE_EQUAL(containerRows.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+      BOOST_CHECK_EQUAL(containerRows[i].at("id"), expected[i][0]);
+      BOOST_CHECK_EQUAL(containerRows[i].at("name"), expected[i][1]);
+      BOOST_CHECK_EQUAL(containerRows[i].at("value"), expected[i][2]);
+    }
+  }
+
+  // empty file: no header and no rows
+  ofstream(filename, ios::trunc);
+  {
+    HDD::CSV::Reader reader(filename);
+    BOOST_CHECK(reader.header().empty());
+    BOOST_CHECK_THROW(reader.requiredColumn("id"), std::runtime_error);
+    BOOST_CHECK(!reader.next());
+  }
+
+  // header only
+  ofstream(filename, ios::trunc) << "id,name";
+  {
+    HDD::CSV::Reader reader(filename);
+    BOOST_CHECK_EQUAL(reader.header().size(), 2);
+    BOOST_CHECK(!reader.next());
+  }
+
+  boost::filesystem::remove(filename);
+  BOOST_CHECK_THROW(HDD::CSV::Reader reader(filename), std::runtime_error);
+
+  // the field conversions follow std::stod and std::stoul
+  for (const char *s :
+       {"0", "1", "-1", "+2", "1.5", "-0.25", "1e3", "  7", "3abc", "0x10",
+        "inf", "nan", "abc", "", "-", "1e999", "18446744073709551615",
+        "18446744073709551616", "4294967295", "12345678901234567890123"})
+  {
+    const string str(s);
+    const HDD::CSV::Field field(str.data(), str.size());
+
+    bool stdThrows = false;
+    double stdDouble;
+    try
+    {
+      stdDouble = std::stod(str);
+    }
+    catch (std::exception &)
+    {
+      stdThrows = true;
+    }
+    if (stdThrows)
+      BOOST_CHECK_THROW(field.toDouble(), std::runtime_error);
+    else if (std::isnan(stdDouble))
+      BOOST_CHECK(std::isnan(field.toDouble()));
+    else
+      BOOST_CHECK_EQUAL(field.toDouble(), stdDouble);
+
+    stdThrows = false;
+    unsigned long stdUnsigned;
+    try
+    {
+      stdUnsigned = std::stoul(str);
+    }
+    catch (std::exception &)
+    {
+      stdThrows = true;
+    }
+    if (stdThrows)
+      BOOST_CHECK_THROW(field.toUnsigned(), std::runtime_error);
+    else
+      BOOST_CHECK_EQUAL(field.toUnsigned(), stdUnsigned);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_symbol)
+{
+  // equal strings share the same storage
+  const HDD::Symbol a("ST01"), b(string("ST01")), c("ST02");
+  BOOST_CHECK(&a.str() == &b.str());
+  BOOST_CHECK(&a.str() != &c.str());
+  BOOST_CHECK(a == b);
+  BOOST_CHECK(a != c);
+  BOOST_CHECK(a == "ST01");
+  BOOST_CHECK(string("ST01") == a);
+  BOOST_CHECK(c != "ST01");
+  BOOST_CHECK(a < c);
+
+  HDD::Symbol copy = a;
+  BOOST_CHECK(&copy.str() == &a.str());
+  copy = c;
+  BOOST_CHECK(copy == c);
+  BOOST_CHECK(a == "ST01");
+
+  // the default value is the empty string
+  const HDD::Symbol empty;
+  BOOST_CHECK(empty.empty());
+  BOOST_CHECK(empty == HDD::Symbol(""));
+  BOOST_CHECK(&empty.str() == &HDD::Symbol("").str());
+
+  // concurrent interning returns the same storage to every thread
+  const unsigned numThreads = 8, numStrings = 1000;
+  vector<vector<const string *>> interned(numThreads);
+  vector<std::thread> threads;
+  for (unsigned t = 0; t < numThreads; t++)
+  {
+    threads.emplace_back([&interned, t]() {
+      for (unsigned i = 0; i < numStrings; i++)
+      {
+        // each thread starts from a different string
+        const unsigned idx = (i + t * numStrings / numThreads) % numStrings;
+        interned[t].push_back(
+            &HDD::Symbol(stringify("test_symbol_%u", idx)).str());
+      }
+      std::rotate(interned[t].begin(),
+                  interned[t].end() - t * numStrings / numThreads,
+                  interned[t].end());
+    });
+  }
+  for (std::thread &thread : threads) thread.join();
+
+  for (unsigned i = 0; i < numStrings; i++)
+  {
+    BOOST_CHECK_EQUAL(*interned[0][i], stringify("test_symbol_%u", i));
+    for (unsigned t = 1; t < numThreads; t++)
+      BOOST_CHECK(interned[t][i] == interned[0][i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_cold_data)
+{
+  // reading doesn't allocate
+  Phase phase{};
+  const Phase &constPhase = phase;
+  BOOST_CHECK(!constPhase.relocInfo->isRelocated);
+  BOOST_CHECK(!phase.relocInfo.isSet());
+
+  phase.relocInfo->isRelocated = true;
+  phase.relocInfo->finalWeight = 0.6;
+  BOOST_CHECK(phase.relocInfo.isSet());
+
+  // copies share the data until modified
+  Phase copy             = phase;
+  const Phase &constCopy = copy;
+  BOOST_CHECK(&*constCopy.relocInfo == &*constPhase.relocInfo);
+  BOOST_CHECK_EQUAL(constCopy.relocInfo->finalWeight, 0.6);
+
+  copy.relocInfo->finalWeight = 0.3;
+  BOOST_CHECK(&*constCopy.relocInfo != &*constPhase.relocInfo);
+  BOOST_CHECK_EQUAL(constCopy.relocInfo->finalWeight, 0.3);
+  BOOST_CHECK_EQUAL(constPhase.relocInfo->finalWeight, 0.6);
+  BOOST_CHECK(constCopy.relocInfo->isRelocated);
+
+  copy.relocInfo.reset();
+  BOOST_CHECK(!copy.relocInfo.isSet());
+  BOOST_CHECK(!constCopy.relocInfo->isRelocated);
+  BOOST_CHECK(constPhase.relocInfo->isRelocated);
+
+  // the same in the catalog: a copy is detached when its phase is updated
+  HDD::CatalogPtr cat      = buildCatalog(46, 8, 3, 50, {0.5, 1.5, 3.0});
+  Event ev                 = cat->getEvents().at(2);
+  ev.relocInfo.isRelocated = true;
+  cat->updateEvent(ev);
+  Phase relocPhase = cat->searchPhase(2, "NET.ST03.", Phase::Type::P)->second;
+  relocPhase.relocInfo->isRelocated   = true;
+  relocPhase.relocInfo->startResidual = 0.125;
+  relocPhase.relocInfo->finalWeight   = 0.6;
+  relocPhase.relocInfo->numCCObs      = 5;
+  cat->updatePhase(relocPhase);
+
+  HDD::CatalogPtr catCopy = new HDD::Catalog(*cat);
+  Phase copyPhase =
+      catCopy->searchPhase(2, "NET.ST03.", Phase::Type::P)->second;
+  copyPhase.relocInfo->numCCObs = 6;
+  catCopy->updatePhase(copyPhase);
+  BOOST_CHECK_EQUAL(
+      cat->searchPhase(2, "NET.ST03.", Phase::Type::P)->second.relocInfo
+          ->numCCObs,
+      5);
+  BOOST_CHECK_EQUAL(
+      catCopy->searchPhase(2, "NET.ST03.", Phase::Type::P)->second.relocInfo
+          ->numCCObs,
+      6);
+
+  // write/read round trip: only the relocated phase has the data
+  const string prefix = "test_cold_data_";
+  cat->writeToFile(prefix + "event.csv", prefix + "phase.csv",
+                   prefix + "station.csv");
+  cat->writeToFile(prefix + "catalog.bin");
+  HDD::CatalogCPtr csvCat = new HDD::Catalog(
+      prefix + "station.csv", prefix + "event.csv", prefix + "phase.csv", true);
+  HDD::CatalogCPtr binCat = new HDD::Catalog(prefix + "catalog.bin", true);
+  for (const char *file :
+       {"event.csv", "phase.csv", "station.csv", "catalog.bin"})
+    boost::filesystem::remove(prefix + file);
+
+  for (const HDD::CatalogCPtr &loaded : {csvCat, binCat})
+  {
+    BOOST_REQUIRE_EQUAL(loaded->getPhases().size(), cat->getPhases().size());
+    unsigned relocatedPhases = 0;
+    for (const auto &kv : loaded->getPhases())
+    {
+      const Phase &ph = kv.second;
+      if (!ph.relocInfo.isSet()) continue;
+      relocatedPhases++;
+      BOOST_CHECK(ph == relocPhase);
+      BOOST_CHECK(ph.relocInfo->isRelocated);
+      BOOST_CHECK_EQUAL(ph.relocInfo->startResidual, 0.125);
+      BOOST_CHECK_EQUAL(ph.relocInfo->finalWeight, 0.6);
+      BOOST_CHECK_EQUAL(ph.relocInfo->numCCObs, 5);
+    }
+    BOOST_CHECK_EQUAL(relocatedPhases, 1);
+  }
+}
+
+/*
+ * Load time of a catalog from csv files vs a binary catalog file, with up to
+ * 1M phases. The files are written to the system temporary directory. Skipped
+ * by default, run it with:
+ * --run_test=benchmark_load_catalog --log_level=message
+ */
+BOOST_TEST_DECORATOR(*boost::unit_test::disabled())
+BOOST_DATA_TEST_CASE(benchmark_load_catalog,
+                     bdata::xrange(benchmarkPhases.size()),
+                     sizeIdx)
+{
+  const unsigned numPhases = benchmarkPhases[sizeIdx];
+  HDD::CatalogPtr cat      = buildLargeCatalog(numPhases);
+
+  const boost::filesystem::path tmpDir =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("benchmark_load_catalog_%%%%%%%%");
+  boost::filesystem::create_directories(tmpDir);
+  const string prefix = (tmpDir / stringify("%u-", numPhases)).string();
+  cat->writeToFile(prefix + "event.csv", prefix + "phase.csv",
+                   prefix + "station.csv");
+  cat->writeToFile(prefix + "catalog.bin");
+
+  auto start = std::chrono::steady_clock::now();
+  HDD::CatalogPtr csvCat = new HDD::Catalog(
+      prefix + "station.csv", prefix + "event.csv", prefix + "phase.csv");
+  auto csvElapsed = std::chrono::steady_clock::now() - start;
+
+  start                  = std::chrono::steady_clock::now();
+  HDD::CatalogPtr binCat = new HDD::Catalog(prefix + "catalog.bin");
+  auto binElapsed        = std::chrono::steady_clock::now() - start;
+
+  BOOST_TEST_MESSAGE(stringify(
+      "Catalog load: %u phases, csv files %.1f ms, binary file %.1f ms",
+      numPhases, std::chrono::duration<double, std::milli>(csvElapsed).count(),
+      std::chrono::duration<double, std::milli>(binElapsed).count()));
+
+  BOOST_CHECK_EQUAL(csvCat->getPhases().size(), numPhases);
+  BOOST_CHECK_EQUAL(binCat->getPhases().size(), numPhases);
+  BOOST_CHECK_EQUAL(csvCat->getEvents().size(), cat->getEvents().size());
+  BOOST_CHECK_EQUAL(binCat->getEvents().size(), cat->getEvents().size());
+
+  boost::filesystem::remove_all(tmpDir);
+}
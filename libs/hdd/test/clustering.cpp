@@ -5,10 +5,14 @@
 
 #include "catalog.h"
 #include "clustering.h"
+#include "utils.h"
 #include <seiscomp/logging/log.h>
 #include <seiscomp3/math/geo.h>
 #include <seiscomp3/math/math.h>
 
+#include <algorithm>
+#include <chrono>
+
 using namespace std;
 using namespace Seiscomp;
 using Seiscomp::Core::stringify;
@@ -127,6 +131,32 @@ vector<Origin> orgList = {
   {30, -179.99, 5}
 };
 
+// `numEvents` events organized in clusters of `clusterSize` consecutive ids,
+// each event has the following `numNeighbours` events of its cluster as
+// neighbours, plus the previous one (symmetric pairs)
+list<HDD::NeighboursPtr> buildNeighbours(unsigned numEvents,
+                                         unsigned clusterSize,
+                                         unsigned numNeighbours)
+{
+  list<HDD::NeighboursPtr> neighboursList;
+  for (unsigned id = 1; id <= numEvents; id++)
+  {
+    HDD::NeighboursPtr neighbours(new HDD::Neighbours());
+    neighbours->refEvId    = id;
+    const unsigned cluster = (id - 1) / clusterSize;
+    for (unsigned n = id - 1; n <= id + numNeighbours; n++)
+    {
+      if (n == id || n < 1 || n > numEvents) continue;
+      if ((n - 1) / clusterSize != cluster) continue;
+      neighbours->add(n, "NET.ST01.", Phase::Type::P);
+    }
+    neighboursList.push_back(neighbours);
+  }
+  return neighboursList;
+}
+
+const vector<unsigned> benchmarkSizes = {1000, 10000, 50000};
+
 } // namespace
 
 BOOST_DATA_TEST_CASE(test_clustering1, bdata::xrange(orgList.size()), orgIdx)
@@ -565,3 +595,240 @@ BOOST_DATA_TEST_CASE(test_clustering2, bdata::xrange(orgList.size()), orgIdx)
   }
 }
 
+
+BOOST_DATA_TEST_CASE(test_spatial_index, bdata::xrange(orgList.size()), orgIdx)
+{
+  const Origin &org = orgList[orgIdx];
+  HDD::CatalogPtr cat =
+      buildCatalog(org.lat, org.lon, org.depth, 70,
+                   {0.5, 0.5, 0.6, 1.5, 1.5, 1.6, 3.0, 3.0, 3.1, 4.5, 7});
+
+  HDD::EventSpatialIndex index(*cat);
+  BOOST_CHECK_EQUAL(index.size(), cat->getEvents().size());
+
+  // the index must not change the selected neighbours
+  for (unsigned maxNumNeigh : {0, 8, 24})
+  {
+    for (const auto &kv : cat->getEvents())
+    {
+      const Event &event = kv.second;
+      HDD::NeighboursPtr neighbours, indexNeighbours;
+      try
+      {
+        neighbours = HDD::selectNeighbouringEvents(
+            cat, event, cat, 0, 0, -1, 0, 1, 0, 1, maxNumNeigh, 3, 4, false);
+      }
+      catch (...)
+      {}
+      try
+      {
+        indexNeighbours = HDD::selectNeighbouringEvents(
+            cat, event, cat, 0, 0, -1, 0, 1, 0, 1, maxNumNeigh, 3, 4, false,
+            &index);
+      }
+      catch (...)
+      {}
+      BOOST_REQUIRE_EQUAL(bool(neighbours), bool(indexNeighbours));
+      if (!neighbours) continue;
+      BOOST_CHECK(neighbours->ids == indexNeighbours->ids);
+      BOOST_CHECK(neighbours->phases == indexNeighbours->phases);
+    }
+  }
+
+  // the candidates must include every event within the distance
+  const Event &event = cat->getEvents().at(1);
+  vector<unsigned> candidates =
+      index.candidates(event.latitude, event.longitude, event.depth, 3.5, 1);
+  for (const auto &kv : cat->getEvents())
+  {
+    const bool inRange =
+        HDD::computeDistance(event.latitude, event.longitude,
+                             kv.second.latitude, kv.second.longitude) <= 3.5;
+    const bool found = std::find(candidates.begin(), candidates.end(),
+                                 kv.first) != candidates.end();
+    if (inRange) BOOST_CHECK(found);
+  }
+
+  // keep the index in sync with the catalog
+  cat->removeEvent(2);
+  index.remove(2);
+  BOOST_CHECK_EQUAL(index.size(), cat->getEvents().size());
+  candidates =
+      index.candidates(event.latitude, event.longitude, event.depth, 3.5, 1);
+  BOOST_CHECK(std::find(candidates.begin(), candidates.end(), 2) ==
+              candidates.end());
+}
+
+BOOST_DATA_TEST_CASE(test_catalog_neighbours,
+                     bdata::xrange(orgList.size()),
+                     orgIdx)
+{
+  const Origin &org = orgList[orgIdx];
+  HDD::CatalogPtr cat = buildCatalog(org.lat, org.lon, org.depth, 70,
+                                     {0.5, 1.5, 1.6, 3.0, 3.1, 6});
+
+  // events without phases are discarded and so are the events that
+  // are left without enough neighbours
+  Event ev{0};
+  ev.latitude  = org.lat;
+  ev.longitude = org.lon;
+  ev.depth     = org.depth + 0.1;
+  cat->addEvent(ev);
+  ev.depth = org.depth - 0.1;
+  cat->addEvent(ev);
+
+  const list<HDD::NeighboursPtr> neighboursList =
+      HDD::selectNeighbouringEventsCatalog(cat, 0, 0, -1, 0, 1, 0, 4, 8, 3, 4,
+                                           false);
+
+  // The result must be the same as selecting the neighbours directly from
+  // the catalog without the discarded events
+  HDD::CatalogPtr finalCat = new HDD::Catalog(*cat);
+  unordered_set<unsigned> validIds;
+  for (const HDD::NeighboursPtr &n : neighboursList)
+    validIds.insert(n->refEvId);
+  for (const auto &kv : cat->getEvents())
+  {
+    if (validIds.count(kv.first) == 0) finalCat->removeEvent(kv.first);
+  }
+  BOOST_CHECK_LT(finalCat->getEvents().size(), cat->getEvents().size());
+
+  for (const HDD::NeighboursPtr &n : neighboursList)
+  {
+    for (unsigned id : n->ids) BOOST_CHECK(validIds.count(id) != 0);
+
+    const Event &event = finalCat->getEvents().at(n->refEvId);
+    HDD::NeighboursPtr expected = HDD::selectNeighbouringEvents(
+        finalCat, event, finalCat, 0, 0, -1, 0, 1, 0, 4, 8, 3, 4, false);
+    BOOST_CHECK(n->ids == expected->ids);
+    BOOST_CHECK(n->phases == expected->phases);
+  }
+}
+
+BOOST_DATA_TEST_CASE(test_local_coordinates,
+                     bdata::xrange(orgList.size()),
+                     orgIdx)
+{
+  const Origin &org   = orgList[orgIdx];
+  HDD::CatalogPtr cat = new HDD::Catalog();
+
+  // events within 100 km from the catalog origin (the first event) and
+  // stations up to 300 km away
+  addEventToCatalog(cat, org.lat, org.lon, org.depth);
+  for (double distance : {1., 5., 10., 25., 50., 100.})
+  {
+    for (double azimuth = 0; azimuth < 360; azimuth += 30)
+    {
+      double lat, lon;
+      Math::Geo::delandaz2coord(Math::Geo::km2deg(distance), azimuth, org.lat,
+                                org.lon, &lat, &lon);
+      addEventToCatalog(cat, lat, lon, org.depth + distance / 10);
+    }
+  }
+  addStationsToCatalog(cat, org.lat, org.lon, 300);
+
+  // the approximation error must be far below the relocation precision
+  for (const auto &kv1 : cat->getEvents())
+  {
+    const HDD::Catalog::Coordinates &coords1 =
+        cat->getEventCoordinates(kv1.first);
+    for (const auto &kv2 : cat->getEvents())
+    {
+      double distance = coords1.distance(cat->getEventCoordinates(kv2.first));
+      BOOST_CHECK_SMALL(distance - HDD::computeDistance(kv1.second, kv2.second),
+                        0.01);
+    }
+    for (const auto &kv2 : cat->getStations())
+    {
+      double distance = coords1.distance(cat->getStationCoordinates(kv2.first));
+      double geoDistance = HDD::computeDistance(kv1.second, kv2.second);
+      BOOST_CHECK_SMALL((distance - geoDistance) / geoDistance, 0.001);
+    }
+  }
+
+  // the coordinates follow the event changes
+  Event ev = cat->getEvents().at(2);
+  ev.depth = ev.depth + 1;
+  cat->updateEvent(ev);
+  BOOST_CHECK_SMALL(
+      cat->getEventCoordinates(2).distance(cat->getEventCoordinates(1)) -
+          HDD::computeDistance(ev, cat->getEvents().at(1)),
+      0.01);
+  cat->removeEvent(2);
+  BOOST_CHECK_THROW(cat->getEventCoordinates(2), std::out_of_range);
+
+  // and the origin
+  cat->setOrigin(ev.latitude, ev.longitude);
+  const HDD::Catalog::Coordinates coords = cat->toLocalCoordinates(ev);
+  BOOST_CHECK_SMALL(coords.x, 1e-6);
+  BOOST_CHECK_SMALL(coords.y, 1e-6);
+  BOOST_CHECK_SMALL(cat->getEventCoordinates(3).distance(coords) -
+                        HDD::computeDistance(cat->getEvents().at(3), ev),
+                    0.01);
+}
+
+BOOST_AUTO_TEST_CASE(test_clusterize)
+{
+  const unsigned numEvents = 100, clusterSize = 10;
+  list<HDD::NeighboursPtr> neighboursList =
+      buildNeighbours(numEvents, clusterSize, 3);
+
+  // count the pairs before the de-duplication
+  set<pair<unsigned, unsigned>> pairs;
+  for (const HDD::NeighboursPtr &n : neighboursList)
+    for (unsigned id : n->ids)
+      pairs.emplace(std::min(id, n->refEvId), std::max(id, n->refEvId));
+
+  deque<list<HDD::NeighboursPtr>> clusters =
+      HDD::clusterizeNeighbouringEvents(neighboursList);
+
+  BOOST_REQUIRE_EQUAL(clusters.size(), numEvents / clusterSize);
+  set<pair<unsigned, unsigned>> clusterPairs;
+  unsigned numPairs = 0;
+  for (const list<HDD::NeighboursPtr> &cluster : clusters)
+  {
+    BOOST_REQUIRE_EQUAL(cluster.size(), clusterSize);
+    const unsigned clusterId = (cluster.front()->refEvId - 1) / clusterSize;
+    for (const HDD::NeighboursPtr &n : cluster)
+    {
+      BOOST_CHECK_EQUAL((n->refEvId - 1) / clusterSize, clusterId);
+      for (unsigned id : n->ids)
+      {
+        BOOST_CHECK(n->phases.count(id) != 0);
+        clusterPairs.emplace(std::min(id, n->refEvId),
+                             std::max(id, n->refEvId));
+        numPairs++;
+      }
+      BOOST_CHECK_EQUAL(n->phases.size(), n->ids.size());
+    }
+  }
+  // every pair is reported once
+  BOOST_CHECK(clusterPairs == pairs);
+  BOOST_CHECK_EQUAL(numPairs, pairs.size());
+}
+
+/*
+ * Timing of clusterizeNeighbouringEvents on large catalogs, skipped by
+ * default as it takes a while. Run it explicitly with:
+ * --run_test=benchmark_clusterize --log_level=message
+ */
+BOOST_TEST_DECORATOR(*boost::unit_test::disabled())
+BOOST_DATA_TEST_CASE(benchmark_clusterize,
+                     bdata::xrange(benchmarkSizes.size()),
+                     sizeIdx)
+{
+  const unsigned numEvents = benchmarkSizes[sizeIdx];
+  list<HDD::NeighboursPtr> neighboursList =
+      buildNeighbours(numEvents, 500, 20);
+
+  auto start = std::chrono::steady_clock::now();
+  deque<list<HDD::NeighboursPtr>> clusters =
+      HDD::clusterizeNeighbouringEvents(neighboursList);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  BOOST_TEST_MESSAGE(stringify(
+      "clusterizeNeighbouringEvents: %u events, %zu clusters, %.1f ms",
+      numEvents, clusters.size(),
+      std::chrono::duration<double, std::milli>(elapsed).count()));
+  BOOST_CHECK_EQUAL(clusters.size(), (numEvents + 499) / 500);
+}
@@ -6,6 +6,7 @@
 
 #include "catalog.h"
 #include "hypodd.h"
+#include "nllttt.h"
 #include "ttt.h"
 
 #include <seiscomp/logging/log.h>
@@ -278,7 +279,8 @@ HDD::CatalogPtr relocateCatalog(const HDD::CatalogCPtr cat,
 HDD::CatalogCPtr relocateSingleEvent(const HDD::CatalogCPtr bgCat,
                                      HDD::TravelTimeTablePtr &ttt,
                                      const string &workingDir,
-                                     const HDD::CatalogCPtr &realTimeCat)
+                                     const HDD::CatalogCPtr &realTimeCat,
+                                     bool precomputeFixedObsParams = false)
 {
   HDD::Config ddCfg;
   ddCfg.ttt.type  = ttt->type;
@@ -290,6 +292,7 @@ HDD::CatalogCPtr relocateSingleEvent(const HDD::CatalogCPtr bgCat,
   hypodd->setWaveformCacheAll(false);
   hypodd->setWaveformDebug(false);
   hypodd->setUseArtificialPhases(false);
+  if (precomputeFixedObsParams) hypodd->precomputeFixedObservationParams();
 
   HDD::ClusteringOptions clusterCfg;
   clusterCfg.numEllipsoids    = 5;
@@ -323,6 +326,25 @@ HDD::CatalogCPtr relocateSingleEvent(const HDD::CatalogCPtr bgCat,
   return relocCat;
 }
 
+void copyDirectory(const boost::filesystem::path &from,
+                   const boost::filesystem::path &to)
+{
+  namespace fs = boost::filesystem;
+  fs::create_directories(to);
+  for (const auto &entry : fs::recursive_directory_iterator(from))
+  {
+    const fs::path dest = to / fs::relative(entry.path(), from);
+    if (fs::is_directory(entry.path()))
+    {
+      fs::create_directories(dest);
+    }
+    else
+    {
+      fs::copy_file(entry.path(), dest);
+    }
+  }
+}
+
 void testCatalogEqual(const HDD::CatalogCPtr cat1, const HDD::CatalogCPtr cat2)
 {
   for (const auto &kv : cat1->getEvents())
@@ -497,3 +519,152 @@ BOOST_DATA_TEST_CASE(test_dd_single_event,
   relocCat   = relocateSingleEvent(backgroundCat, ttt, workingDir, realTimeCat);
   testCatalogEqual(realTimeCat, relocCat);
 }
+
+BOOST_DATA_TEST_CASE(test_dd_single_event_duplicate,
+                     bdata::xrange(tttList.size()),
+                     tttIdx)
+{
+  HDD::TravelTimeTablePtr ttt =
+      HDD::TravelTimeTable::create(tttList[tttIdx].type, tttList[tttIdx].model);
+
+  const Core::Time clusterTime = Core::Time::FromString("2001-01-02", "%F");
+  const HDD::CatalogCPtr backgroundCat =
+      buildBackgroundCatalog(ttt, 8, clusterTime, 47.0, 8.5, 5, 21, 1.0);
+
+  // origins identical to a background event: they are relocated as new
+  // events, not merged into the identical neighbour
+  HDD::CatalogPtr realTimeCat(new HDD::Catalog());
+  for (unsigned evId : {1, 8, 15})
+    realTimeCat->add(*backgroundCat->extractEvent(evId, false), false);
+  BOOST_REQUIRE_EQUAL(realTimeCat->getEvents().size(), 3);
+
+  const string workingDir =
+      stringify("./data/test_dd_single_event_duplicate_%d", tttIdx);
+  HDD::CatalogCPtr relocCat =
+      relocateSingleEvent(backgroundCat, ttt, workingDir, realTimeCat);
+  BOOST_CHECK_EQUAL(relocCat->getEvents().size(), 3);
+  testCatalogEqual(realTimeCat, relocCat);
+}
+
+BOOST_DATA_TEST_CASE(test_dd_single_event_fixed_obs_params,
+                     bdata::xrange(tttList.size()),
+                     tttIdx)
+{
+  HDD::TravelTimeTablePtr ttt =
+      HDD::TravelTimeTable::create(tttList[tttIdx].type, tttList[tttIdx].model);
+
+  const Core::Time clusterTime = Core::Time::FromString("2001-01-02", "%F");
+  const HDD::CatalogCPtr backgroundCat =
+      buildBackgroundCatalog(ttt, 8, clusterTime, 47.0, 8.5, 5, 21, 1.0);
+
+  HDD::CatalogPtr realTimeCat =
+      buildCatalog(ttt, 8, clusterTime, 47.0, 8.5, 5, 12, 1.0);
+  HDD::NormalRandomer latDist(0.006, 0.02, 0x1001);
+  HDD::NormalRandomer lonDist(-0.012, 0.04, 0x1002);
+  HDD::NormalRandomer depthDist(-0.6, 2.0, 0x1003); // km
+  for (const auto &kv : realTimeCat->getEvents())
+  {
+    Event ev = kv.second;
+    ev.latitude += latDist.next();
+    ev.longitude += lonDist.next();
+    ev.depth += depthDist.next();
+    realTimeCat->updateEvent(ev);
+  }
+
+  // the precomputed background travel times must not change the solutions
+  const string workingDir =
+      stringify("./data/test_dd_single_event_fixed_obs_params_%d", tttIdx);
+  HDD::CatalogCPtr relocCat =
+      relocateSingleEvent(backgroundCat, ttt, workingDir, realTimeCat, false);
+  HDD::CatalogCPtr relocCatFixed =
+      relocateSingleEvent(backgroundCat, ttt, workingDir, realTimeCat, true);
+
+  BOOST_REQUIRE_EQUAL(relocCat->getEvents().size(),
+                      relocCatFixed->getEvents().size());
+  for (const auto &kv : relocCat->getEvents())
+  {
+    const Event &ev1 = kv.second;
+    BOOST_REQUIRE_EQUAL(relocCatFixed->getEvents().count(ev1.id), 1);
+    const Event &ev2 = relocCatFixed->getEvents().at(ev1.id);
+    BOOST_CHECK_SMALL((ev1.time - ev2.time).length(), 1e-6);
+    BOOST_CHECK_SMALL(ev1.latitude - ev2.latitude, 1e-7);
+    BOOST_CHECK_SMALL(ev1.longitude - ev2.longitude, 1e-7);
+    BOOST_CHECK_SMALL(ev1.depth - ev2.depth, 1e-5);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_fixed_obs_params_cache)
+{
+  // work on a copy of the grids, so that they can be modified
+  const string gridDir    = "./data/test_fixed_obs_params_cache_nll";
+  const string workingDir = "./data/test_fixed_obs_params_cache";
+  boost::filesystem::remove_all(gridDir);
+  boost::filesystem::remove_all(workingDir);
+  copyDirectory("./data/nll/iasp91_2D_simple", gridDir);
+
+  HDD::Config ddCfg;
+  ddCfg.ttt.type  = "NonLinLoc";
+  ddCfg.ttt.model = gridDir + "/model/iasp91.PHASE.mod;" + gridDir +
+                    "/time/iasp91.PHASE.STATION.time;" + gridDir +
+                    "/time/iasp91.PHASE.STATION.angle";
+
+  HDD::TravelTimeTablePtr ttt =
+      HDD::TravelTimeTable::create(ddCfg.ttt.type, ddCfg.ttt.model);
+  const Core::Time time      = Core::Time::FromString("2001-01-02", "%F");
+  const HDD::CatalogCPtr cat = buildBackgroundCatalog(ttt, 8, time, 47.0, 8.5,
+                                                      5, 6, 1.0);
+
+  // nothing stored yet
+  HDD::HypoDDPtr hypodd = new HDD::HypoDD(cat, ddCfg, workingDir);
+  BOOST_CHECK(!hypodd->precomputeFixedObservationParams());
+  BOOST_CHECK(hypodd->precomputeFixedObservationParams());
+
+  // the stored values are reused by a new instance too, also when only
+  // loading them
+  hypodd = new HDD::HypoDD(cat, ddCfg, workingDir);
+  BOOST_CHECK(hypodd->loadFixedObservationParams());
+  BOOST_CHECK(hypodd->precomputeFixedObservationParams());
+
+  // an event moved
+  HDD::CatalogPtr movedCat = new HDD::Catalog(*cat);
+  Event ev                 = movedCat->getEvents().begin()->second;
+  ev.depth += 1;
+  movedCat->updateEvent(ev);
+  hypodd->setCatalog(movedCat);
+  BOOST_CHECK(!hypodd->loadFixedObservationParams());
+  BOOST_CHECK(!hypodd->precomputeFixedObservationParams());
+  BOOST_CHECK(hypodd->loadFixedObservationParams());
+  BOOST_CHECK(hypodd->precomputeFixedObservationParams());
+
+  // the same catalog built in a different order
+  HDD::CatalogPtr reorderedCat = new HDD::Catalog();
+  vector<unsigned> eventIds;
+  for (const auto &kv : movedCat->getEvents()) eventIds.push_back(kv.first);
+  for (auto it = eventIds.rbegin(); it != eventIds.rend(); ++it)
+    reorderedCat->add(*movedCat->extractEvent(*it, true), true);
+  BOOST_REQUIRE_EQUAL(reorderedCat->getEvents().size(),
+                      movedCat->getEvents().size());
+  hypodd->setCatalog(reorderedCat);
+  BOOST_CHECK(hypodd->loadFixedObservationParams());
+
+  // a grid replaced in place: same path, different modification time
+  const string grid =
+      HDD::NLL::Grid::filePath(gridDir + "/time/iasp91.PHASE.STATION.time",
+                               stationList[0], "P") +
+      ".hdr";
+  boost::filesystem::last_write_time(
+      grid, boost::filesystem::last_write_time(grid) + 10);
+  BOOST_CHECK(!hypodd->precomputeFixedObservationParams());
+  BOOST_CHECK(hypodd->precomputeFixedObservationParams());
+
+  // a different travel time table
+  ddCfg.ttt.type  = "LOCSAT";
+  ddCfg.ttt.model = "iasp91";
+  hypodd          = new HDD::HypoDD(movedCat, ddCfg, workingDir);
+  BOOST_CHECK(!hypodd->precomputeFixedObservationParams());
+  BOOST_CHECK(hypodd->precomputeFixedObservationParams());
+
+  // comment this for debugging
+  boost::filesystem::remove_all(workingDir);
+  boost::filesystem::remove_all(gridDir);
+}
@@ -4,9 +4,17 @@
 #include <boost/test/data/test_case.hpp>
 
 #include "catalog.h"
+#include "nllttt.h"
+#include "scttt.h"
 #include "ttt.h"
+#include "utils.h"
 
+#include <seiscomp3/math/geo.h>
 #include <seiscomp3/math/math.h>
+#include <atomic>
+#include <chrono>
+#include <regex>
+#include <thread>
 #include <vector>
 
 using namespace std;
@@ -155,6 +163,261 @@ vector<Delta> deltaList = {
     {0, -0.7, 16},
 };
 
+struct TTTResult
+{
+  double travelTime;
+  double takeOffAngleAzim;
+  double takeOffAngleDip;
+  double velocityAtSrc;
+};
+
+// The velocity at source as computed before the depth/velocity profile was
+// cached: travel times to the surface from the boundaries of the depth bin
+double referenceVelocityAtSource(TravelTimeTableInterface &ttt,
+                                 const string &phaseType,
+                                 double depth,
+                                 double resolution)
+{
+  const unsigned bin         = std::floor(depth / resolution);
+  const double binStartDepth = bin * resolution;
+  const double binEndDepth   = (bin + 1) * resolution;
+
+  double tt1 =
+      (binStartDepth == 0)
+          ? 0
+          : ttt.compute(phaseType.c_str(), 0, 0, binStartDepth, 0, 0, 0).time;
+  double tt2 = ttt.compute(phaseType.c_str(), 0, 0, binEndDepth, 0, 0, 0).time;
+
+  double binVelocity = resolution / (tt2 - tt1);
+  if (!std::isfinite(binVelocity))
+  {
+    throw runtime_error("Unable to compute velocity at source");
+  }
+  return binVelocity;
+}
+
+// Constant velocity and straight rays: the exact travel time is known for any
+// source, which makes it a reference for the travel time approximations
+class HomogeneousTTT : public HDD::TravelTimeTable
+{
+public:
+  HomogeneousTTT(double velocity)
+      : TravelTimeTable("homogeneous", ""), _velocity(velocity)
+  {}
+
+  virtual void compute(double eventLat,
+                       double eventLon,
+                       double eventDepth,
+                       const HDD::Catalog::Station &station,
+                       const std::string &phaseType,
+                       double &travelTime,
+                       double &takeOffAngleAzim,
+                       double &takeOffAngleDip,
+                       double &velocityAtSrc)
+  {
+    compute(eventLat, eventLon, eventDepth, station, phaseType, travelTime);
+    computeApproximatedTakeOfAngles(eventLat, eventLon, eventDepth, station,
+                                    phaseType, &takeOffAngleAzim,
+                                    &takeOffAngleDip);
+    velocityAtSrc = _velocity;
+  }
+
+  virtual void compute(double eventLat,
+                       double eventLon,
+                       double eventDepth,
+                       const HDD::Catalog::Station &station,
+                       const std::string &phaseType,
+                       double &travelTime)
+  {
+    travelTime = HDD::computeDistance(eventLat, eventLon, eventDepth,
+                                      station.latitude, station.longitude,
+                                      -(station.elevation / 1000.)) /
+                 _velocity;
+  }
+
+private:
+  const double _velocity; // km/sec
+};
+
+HDD::Catalog::Event moveEvent(const HDD::Catalog::Event &event,
+                              double distance, // km
+                              double azimuth,  // degree
+                              double depthChange)
+{
+  HDD::Catalog::Event moved = event;
+  Math::Geo::delandaz2coord(Math::Geo::km2deg(distance), azimuth,
+                            event.latitude, event.longitude, &moved.latitude,
+                            &moved.longitude);
+  moved.depth += depthChange;
+  return moved;
+}
+
+// No Boost checks here, this runs in multiple threads
+vector<TTTResult> computeAll(HDD::TravelTimeTable &ttt)
+{
+  vector<TTTResult> results;
+  for (const Delta &delta : deltaList)
+  {
+    for (const auto &station : stationList)
+    {
+      const double stationDepth = -(station.elevation / 1000.);
+      for (const string phase : {"P", "S"})
+      {
+        TTTResult r;
+        try
+        {
+          ttt.compute(station.latitude + delta.lat,
+                      station.longitude + delta.lon,
+                      stationDepth + delta.depth, station, phase, r.travelTime,
+                      r.takeOffAngleAzim, r.takeOffAngleDip, r.velocityAtSrc);
+        }
+        catch (exception &e)
+        {
+          r = {-1, -1, -1, -1};
+        }
+        results.push_back(r);
+      }
+    }
+  }
+  return results;
+}
+
+void checkConcurrentCompute(HDD::TravelTimeTable &ttt,
+                            HDD::TravelTimeTable &refTtt)
+{
+  const unsigned numThreads = 8;
+
+  const vector<TTTResult> expected = computeAll(refTtt);
+
+  vector<vector<TTTResult>> results(numThreads);
+  vector<std::thread> threads;
+  for (unsigned t = 0; t < numThreads; t++)
+  {
+    threads.emplace_back(
+        [&ttt, &results, t]() { results[t] = computeAll(ttt); });
+  }
+  for (std::thread &thread : threads) thread.join();
+
+  auto same = [](double x, double y) {
+    return x == y || (std::isnan(x) && std::isnan(y));
+  };
+
+  for (const vector<TTTResult> &res : results)
+  {
+    BOOST_REQUIRE_EQUAL(res.size(), expected.size());
+    for (size_t i = 0; i < res.size(); i++)
+    {
+      BOOST_CHECK(same(res[i].travelTime, expected[i].travelTime));
+      BOOST_CHECK(same(res[i].takeOffAngleAzim, expected[i].takeOffAngleAzim));
+      BOOST_CHECK(same(res[i].takeOffAngleDip, expected[i].takeOffAngleDip));
+      BOOST_CHECK(same(res[i].velocityAtSrc, expected[i].velocityAtSrc));
+    }
+  }
+}
+
+// computeBatch() must give the results of compute() (within `ttTolerance`
+// seconds and `dipTolerance` degree when compared to a different table) and
+// report the errors of the pairs that compute() fails on. The sources are
+// the deltaList offsets from each station, the pairs include an unknown phase
+// and a station the grid based tables don't have
+template <class TTT>
+void checkBatch(TTT &ttt,
+                HDD::TravelTimeTable &refTtt,
+                double ttTolerance,
+                double dipTolerance)
+{
+  const HDD::Catalog::Station unknownStation = {
+      "NET.ST99", 47.0, 8.5, 300, "NET", "ST99", ""};
+
+  vector<const HDD::Catalog::Station *> allStations;
+  for (const auto &station : stationList) allStations.push_back(&station);
+  allStations.push_back(&unknownStation);
+
+  vector<const HDD::Catalog::Station *> stations;
+  vector<string> phaseTypes;
+  for (const HDD::Catalog::Station *station : allStations)
+  {
+    for (const char *phase : {"P", "S", "X"})
+    {
+      stations.push_back(station);
+      phaseTypes.push_back(phase);
+    }
+  }
+
+  auto close = [](double x, double y, double tolerance) {
+    return std::abs(x - y) <= tolerance || (std::isnan(x) && std::isnan(y));
+  };
+
+  for (const Delta &delta : deltaList)
+  {
+    for (const auto &refStation : stationList)
+    {
+      HDD::Catalog::Event event;
+      event.latitude  = refStation.latitude + delta.lat;
+      event.longitude = refStation.longitude + delta.lon;
+      event.depth     = -(refStation.elevation / 1000.) + delta.depth;
+
+      vector<double> travelTimes, azims, dips, vels, ttOnly;
+      vector<string> errors, ttOnlyErrors;
+      ttt.computeBatch(event, stations, phaseTypes, travelTimes, azims, dips,
+                       vels, errors);
+      ttt.computeBatch(event, stations, phaseTypes, ttOnly, ttOnlyErrors);
+      BOOST_REQUIRE_EQUAL(travelTimes.size(), stations.size());
+      BOOST_REQUIRE_EQUAL(azims.size(), stations.size());
+      BOOST_REQUIRE_EQUAL(dips.size(), stations.size());
+      BOOST_REQUIRE_EQUAL(vels.size(), stations.size());
+      BOOST_REQUIRE_EQUAL(errors.size(), stations.size());
+      BOOST_REQUIRE_EQUAL(ttOnly.size(), stations.size());
+      BOOST_REQUIRE_EQUAL(ttOnlyErrors.size(), stations.size());
+
+      for (size_t i = 0; i < stations.size(); i++)
+      {
+        BOOST_TEST_MESSAGE(stringify("Testing station %s phase %s",
+                                     stations[i]->id.c_str(),
+                                     phaseTypes[i].c_str()));
+        double tt, azim, dip, vel;
+        try
+        {
+          refTtt.compute(event, *stations[i], phaseTypes[i], tt, azim, dip,
+                         vel);
+        }
+        catch (exception &e)
+        {
+          BOOST_CHECK(std::isnan(travelTimes[i]));
+          BOOST_CHECK(!errors[i].empty());
+          BOOST_CHECK(std::isnan(ttOnly[i]));
+          BOOST_CHECK(!ttOnlyErrors[i].empty());
+          continue;
+        }
+        BOOST_CHECK(errors[i].empty());
+        BOOST_CHECK(close(travelTimes[i], tt, ttTolerance));
+        BOOST_CHECK(close(rad2deg(dips[i]), rad2deg(dip), dipTolerance));
+        BOOST_CHECK(close(azims[i], azim, 0));
+        BOOST_CHECK(close(vels[i], vel, 0));
+
+        BOOST_CHECK(ttOnlyErrors[i].empty());
+        BOOST_CHECK(close(ttOnly[i], travelTimes[i], 0));
+      }
+    }
+  }
+}
+
+const string nllTimeGridPath =
+    "./data/nll/iasp91_2D_simple/time/iasp91.PHASE.STATION.time";
+
+// GridPool factory of the `station` P time grid, counting the loads
+std::function<HDD::NLL::Grid *()>
+timeGridFactory(const HDD::Catalog::Station &station,
+                std::atomic<unsigned> &loads,
+                unsigned delayMs = 0)
+{
+  return [&station, &loads, delayMs]() -> HDD::NLL::Grid * {
+    loads++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+    return new HDD::NLL::TimeGrid(nllTimeGridPath, station, "P", false);
+  };
+}
+
 } // namespace
 
 BOOST_DATA_TEST_CASE(test_ttt, bdata::xrange(deltaList.size()), deltaIdx)
@@ -235,3 +498,668 @@ BOOST_DATA_TEST_CASE(test_ttt, bdata::xrange(deltaList.size()), deltaIdx)
     }
   }
 }
+
+BOOST_DATA_TEST_CASE(test_sc_lookup_table,
+                     bdata::xrange(deltaList.size()),
+                     deltaIdx)
+{
+  const Delta &delta = deltaList[deltaIdx];
+
+  for (const string type : {"LOCSAT", "libtau"})
+  {
+    HDD::ScTravelTimeTablePtr direct =
+        new HDD::ScTravelTimeTable(type, "iasp91");
+    HDD::ScTravelTimeTablePtr lookup =
+        new HDD::ScTravelTimeTable(type, "iasp91");
+    lookup->enableLookupTable(HDD::ScTravelTimeTable::LookupTableOptions());
+
+    for (auto station : stationList)
+    {
+      const double stationDepth = -(station.elevation / 1000.);
+      const double lat          = station.latitude + delta.lat;
+      const double lon          = station.longitude + delta.lon;
+      const double depth        = stationDepth + delta.depth;
+
+      for (const string phase : {"P", "S"})
+      {
+        double ttD, azimD, dipD, velD;
+        double ttL, azimL, dipL, velL;
+        BOOST_CHECK_NO_THROW(direct->compute(lat, lon, depth, station, phase,
+                                             ttD, azimD, dipD, velD));
+        BOOST_CHECK_NO_THROW(lookup->compute(lat, lon, depth, station, phase,
+                                             ttL, azimL, dipL, velL));
+
+        BOOST_TEST_MESSAGE(stringify(
+            "TTT %s station %s phase %s direct %.4f lookup %.4f",
+            type.c_str(), station.id.c_str(), phase.c_str(), ttD, ttL));
+
+        // interpolation error bounds
+        BOOST_CHECK_SMALL(ttL - ttD, 0.01);
+        BOOST_CHECK_SMALL(rad2deg(dipL - dipD), 5.);
+        BOOST_CHECK_EQUAL(azimL, azimD);
+        BOOST_CHECK_EQUAL(velL, velD);
+
+        double ttOnly;
+        BOOST_CHECK_NO_THROW(
+            lookup->compute(lat, lon, depth, station, phase, ttOnly));
+        BOOST_CHECK_EQUAL(ttOnly, ttL);
+      }
+    }
+
+    // sources outside the table are computed directly
+    const HDD::Catalog::Station &station = stationList.front();
+    double ttD, ttL;
+    BOOST_CHECK_NO_THROW(direct->compute(station.latitude + 15,
+                                         station.longitude, delta.depth,
+                                         station, "P", ttD));
+    BOOST_CHECK_NO_THROW(lookup->compute(station.latitude + 15,
+                                         station.longitude, delta.depth,
+                                         station, "P", ttL));
+    BOOST_CHECK_EQUAL(ttL, ttD);
+  }
+}
+
+// The table nodes must include the same ellipticity correction as the direct
+// computation: the two have to agree within the interpolation error at any
+// latitude and azimuth, not only along the equatorial node path
+BOOST_AUTO_TEST_CASE(test_sc_lookup_table_ellipticity)
+{
+  for (const string type : {"LOCSAT", "libtau"})
+  {
+    HDD::ScTravelTimeTablePtr direct =
+        new HDD::ScTravelTimeTable(type, "iasp91");
+    HDD::ScTravelTimeTablePtr lookup =
+        new HDD::ScTravelTimeTable(type, "iasp91");
+    lookup->enableLookupTable(HDD::ScTravelTimeTable::LookupTableOptions());
+
+    for (double stationLat : {-60., 0., 30., 47., 75.})
+    {
+      const HDD::Catalog::Station station = {
+          "NET.ELL", stationLat, 10, 500, "NET", "ELL", ""};
+      for (double azimuth = 0; azimuth < 360; azimuth += 45)
+      {
+        for (double distance : {0.05, 0.3, 1.})
+        {
+          double lat, lon;
+          Math::Geo::delandaz2coord(distance, azimuth, station.latitude,
+                                    station.longitude, &lat, &lon);
+          for (double depth : {2., 12.3, 45.})
+          {
+            for (const string phase : {"P", "S"})
+            {
+              double ttD, ttL;
+              BOOST_CHECK_NO_THROW(
+                  direct->compute(lat, lon, depth, station, phase, ttD));
+              BOOST_CHECK_NO_THROW(
+                  lookup->compute(lat, lon, depth, station, phase, ttL));
+              BOOST_TEST_MESSAGE(stringify(
+                  "TTT %s lat %.2f az %.0f dist %.2f depth %.1f phase %s "
+                  "direct %.4f lookup %.4f",
+                  type.c_str(), stationLat, azimuth, distance, depth,
+                  phase.c_str(), ttD, ttL));
+              BOOST_CHECK_SMALL(ttL - ttD, 0.01);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_sc_velocity_at_source)
+{
+  const double resolution = 0.1; // ScTravelTimeTable default
+
+  for (const string type : {"LOCSAT", "libtau"})
+  {
+    TravelTimeTableInterfacePtr ref =
+        TravelTimeTableInterface::Create(type.c_str());
+    ref->setModel("iasp91");
+    // the profile is precomputed down to 100 km, deeper sources are computed
+    // directly
+    HDD::ScTravelTimeTablePtr ttt =
+        new HDD::ScTravelTimeTable(type, "iasp91", resolution, 100);
+
+    const HDD::Catalog::Station &station = stationList.front();
+    for (double depth : {0., 0.05, 3.72, 12.34, 35., 99.95, 100.03, 120.5,
+                         410.01, 799.95, 800.03, 850.5, 1200.})
+    {
+      for (const string phase : {"P", "S"})
+      {
+        bool refOk = true;
+        double refVel;
+        try
+        {
+          refVel = referenceVelocityAtSource(*ref, phase, depth, resolution);
+        }
+        catch (exception &e)
+        {
+          refOk = false;
+        }
+
+        // twice: the result doesn't depend on previous calls
+        for (int i = 0; i < 2; i++)
+        {
+          double tt, azim, dip, vel;
+          if (refOk)
+          {
+            BOOST_CHECK_NO_THROW(ttt->compute(station.latitude,
+                                              station.longitude, depth,
+                                              station, phase, tt, azim, dip,
+                                              vel));
+            BOOST_CHECK_CLOSE(vel, refVel, 1e-9);
+          }
+          else
+          {
+            // no clamping to the deepest available velocity
+            BOOST_CHECK_THROW(ttt->compute(station.latitude,
+                                           station.longitude, depth, station,
+                                           phase, tt, azim, dip, vel),
+                              std::exception);
+          }
+        }
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_ttt_memo)
+{
+  HDD::TravelTimeTablePtr ttt = new HomogeneousTTT(6.0);
+  const HDD::Catalog::Station &station = stationList.front();
+  HDD::Catalog::Event anchor;
+  anchor.latitude  = 47.0;
+  anchor.longitude = 8.5;
+  anchor.depth     = 8;
+
+  const double maxMovement = 1; // km
+
+  for (bool correction : {false, true})
+  {
+    HDD::TravelTimeMemo memo(maxMovement, correction);
+
+    double tt, azim, dip, vel;
+    BOOST_CHECK(!memo.get("key", anchor, tt, azim, dip, vel));
+    ttt->compute(anchor, station, "P", tt, azim, dip, vel);
+    memo.set("key", anchor, tt, azim, dip, vel);
+
+    for (double azimuth = 0; azimuth < 360; azimuth += 45)
+    {
+      for (double distance : {0., 0.2, 0.5, 0.8})
+      {
+        for (double depthChange : {-0.5, 0., 0.5})
+        {
+          const HDD::Catalog::Event ev =
+              moveEvent(anchor, distance, azimuth, depthChange);
+
+          double memoTT, memoAzim, memoDip, memoVel;
+          BOOST_REQUIRE(
+              memo.get("key", ev, memoTT, memoAzim, memoDip, memoVel));
+          double directTT;
+          ttt->compute(ev, station, "P", directTT);
+
+          const double movement =
+              std::sqrt(HDD::square(distance) + HDD::square(depthChange));
+          // without correction the error is bounded by the movement, with
+          // the correction only the second order error is left
+          BOOST_CHECK_SMALL(memoTT - directTT,
+                            correction ? 0.01 : movement / 6.0 + 1e-6);
+          BOOST_CHECK_EQUAL(memoAzim, azim);
+          BOOST_CHECK_EQUAL(memoDip, dip);
+          BOOST_CHECK_EQUAL(memoVel, vel);
+        }
+      }
+    }
+
+    // too far from the stored location
+    BOOST_CHECK(!memo.get("key", moveEvent(anchor, 1.5, 90, 0), tt, azim,
+                          dip, vel));
+    BOOST_CHECK(!memo.get("key", moveEvent(anchor, 0, 0, 1.5), tt, azim, dip,
+                          vel));
+    BOOST_CHECK(!memo.get("other", anchor, tt, azim, dip, vel));
+  }
+
+  // An event moving by small steps: the values are not re-anchored on every
+  // hit, so the error doesn't accumulate and it is recomputed as soon as it
+  // is more than `maxMovement` away from the last computed location
+  HDD::TravelTimeMemo memo(maxMovement, true);
+  HDD::Catalog::Event ev = anchor;
+  const double step      = 0.3; // km
+  for (unsigned s = 0; s < 40; s++)
+  {
+    double tt, azim, dip, vel;
+    double directTT, directAzim, directDip, directVel;
+    ttt->compute(ev, station, "P", directTT, directAzim, directDip, directVel);
+    if (memo.get("key", ev, tt, azim, dip, vel))
+    {
+      BOOST_CHECK_SMALL(tt - directTT, 0.01);
+    }
+    else
+    {
+      memo.set("key", ev, directTT, directAzim, directDip, directVel);
+    }
+    ev = moveEvent(ev, step, 225, 0);
+  }
+  // recomputed every 4 steps (1.2 km)
+  BOOST_CHECK_EQUAL(memo.recomputes, 10);
+  BOOST_CHECK_EQUAL(memo.hits, 30);
+}
+
+BOOST_DATA_TEST_CASE(test_ttt_concurrency, bdata::xrange(tttList.size()), idx)
+{
+  BOOST_TEST_MESSAGE(stringify("Testing concurrent access to TTT %s %s",
+                               tttList[idx].type.c_str(),
+                               tttList[idx].model.c_str()));
+
+  HDD::TravelTimeTablePtr ttt =
+      HDD::TravelTimeTable::create(tttList[idx].type, tttList[idx].model);
+  HDD::TravelTimeTablePtr refTtt =
+      HDD::TravelTimeTable::create(tttList[idx].type, tttList[idx].model);
+  checkConcurrentCompute(*ttt, *refTtt);
+}
+
+BOOST_AUTO_TEST_CASE(test_sc_lookup_table_concurrency)
+{
+  for (const string type : {"LOCSAT", "libtau"})
+  {
+    HDD::ScTravelTimeTablePtr ttt = new HDD::ScTravelTimeTable(type, "iasp91");
+    ttt->enableLookupTable(HDD::ScTravelTimeTable::LookupTableOptions());
+    HDD::ScTravelTimeTablePtr refTtt =
+        new HDD::ScTravelTimeTable(type, "iasp91");
+    refTtt->enableLookupTable(HDD::ScTravelTimeTable::LookupTableOptions());
+    checkConcurrentCompute(*ttt, *refTtt);
+  }
+}
+
+BOOST_DATA_TEST_CASE(test_ttt_batch, bdata::xrange(tttList.size()), idx)
+{
+  BOOST_TEST_MESSAGE(stringify("Testing computeBatch of TTT %s %s",
+                               tttList[idx].type.c_str(),
+                               tttList[idx].model.c_str()));
+
+  HDD::TravelTimeTablePtr refTtt =
+      HDD::TravelTimeTable::create(tttList[idx].type, tttList[idx].model);
+  if (tttList[idx].type == "NonLinLoc")
+  {
+    HDD::NLL::NllTravelTimeTablePtr ttt =
+        new HDD::NLL::NllTravelTimeTable(tttList[idx].type, tttList[idx].model);
+    checkBatch(*ttt, *ttt, 0, 0);
+    checkBatch(*ttt, *refTtt, 0, 0);
+  }
+  else
+  {
+    HDD::ScTravelTimeTablePtr ttt =
+        new HDD::ScTravelTimeTable(tttList[idx].type, tttList[idx].model);
+    checkBatch(*ttt, *ttt, 0, 0);
+    checkBatch(*ttt, *refTtt, 0, 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_sc_lookup_table_batch)
+{
+  for (const string type : {"LOCSAT", "libtau"})
+  {
+    HDD::ScTravelTimeTablePtr lookup =
+        new HDD::ScTravelTimeTable(type, "iasp91");
+    lookup->enableLookupTable(HDD::ScTravelTimeTable::LookupTableOptions());
+    HDD::ScTravelTimeTablePtr direct =
+        new HDD::ScTravelTimeTable(type, "iasp91");
+    checkBatch(*lookup, *lookup, 0, 0);
+    // interpolation error bounds, see test_sc_lookup_table
+    checkBatch(*lookup, *direct, 0.01, 5);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_nll_grid_pool)
+{
+  HDD::NLL::GridPool &pool = HDD::NLL::GridPool::instance();
+  pool.clear();
+  pool.setLimits(3, 0);
+
+  std::atomic<unsigned> loads(0);
+  auto get = [&pool, &loads](size_t idx) {
+    return pool.get(stringify("test:%zu", idx),
+                    timeGridFactory(stationList.at(idx), loads));
+  };
+
+  // eviction by number of grids, the least recently used first
+  get(0);
+  get(1);
+  get(2);
+  BOOST_CHECK_EQUAL(loads, 3);
+  BOOST_CHECK_EQUAL(pool.size(), 3);
+  get(0); // 1 is the least recently used now
+  BOOST_CHECK_EQUAL(loads, 3);
+  get(3); // drops 1
+  BOOST_CHECK_EQUAL(pool.size(), 3);
+  get(0);
+  get(2);
+  get(3);
+  BOOST_CHECK_EQUAL(loads, 4);
+  get(1); // drops 0
+  BOOST_CHECK_EQUAL(loads, 5);
+  get(2);
+  get(3);
+  BOOST_CHECK_EQUAL(loads, 5);
+  get(0);
+  BOOST_CHECK_EQUAL(loads, 6);
+
+  // setLimits applies the new limits straight away, the most recently used
+  // grid is always kept
+  pool.setLimits(1, 0);
+  BOOST_CHECK_EQUAL(pool.size(), 1);
+  get(0);
+  BOOST_CHECK_EQUAL(loads, 6);
+
+  // no limits
+  pool.setLimits(0, 0);
+  for (size_t i = 0; i < stationList.size(); i++) get(i);
+  BOOST_CHECK_EQUAL(pool.size(), stationList.size());
+  BOOST_CHECK_EQUAL(loads, 6 + stationList.size() - 1);
+
+  // eviction by mapped bytes
+  const size_t gridBytes = get(0)->mappedBytes();
+  BOOST_REQUIRE(gridBytes > 0);
+  pool.setLimits(0, gridBytes * 2.5);
+  BOOST_CHECK_EQUAL(pool.size(), 2);
+  get(stationList.size() - 1);
+  get(0);
+  BOOST_CHECK_EQUAL(loads, 6 + stationList.size() - 1);
+  get(1); // drops the last station
+  BOOST_CHECK_EQUAL(pool.size(), 2);
+  get(0);
+  BOOST_CHECK_EQUAL(loads, 6 + stationList.size());
+  pool.setLimits(0, gridBytes * 3);
+  get(2);
+  get(3); // drops 1
+  BOOST_CHECK_EQUAL(pool.size(), 3);
+  get(0);
+  BOOST_CHECK_EQUAL(loads, 6 + stationList.size() + 2);
+  pool.setLimits(0, 1);
+  BOOST_CHECK_EQUAL(pool.size(), 1);
+
+  // both limits, the stricter one applies
+  pool.setLimits(2, gridBytes * 10);
+  get(1);
+  get(2);
+  get(3);
+  BOOST_CHECK_EQUAL(pool.size(), 2);
+  pool.setLimits(10, gridBytes * 2);
+  for (size_t i = 0; i < stationList.size(); i++) get(i);
+  BOOST_CHECK_EQUAL(pool.size(), 2);
+
+  pool.clear();
+  BOOST_CHECK_EQUAL(pool.size(), 0);
+  pool.setLimits(1000, 0); // defaults
+}
+
+BOOST_AUTO_TEST_CASE(test_nll_grid_pool_concurrency)
+{
+  HDD::NLL::GridPool &pool = HDD::NLL::GridPool::instance();
+  pool.clear();
+
+  const unsigned numThreads = 8;
+  vector<std::thread> threads;
+
+  // concurrent requests of the same grid wait for a single load
+  std::atomic<unsigned> loads(0);
+  vector<HDD::NLL::GridPtr> grids(numThreads);
+  for (unsigned t = 0; t < numThreads; t++)
+  {
+    threads.emplace_back([&pool, &grids, &loads, t]() {
+      grids[t] = pool.get("test:concurrent",
+                          timeGridFactory(stationList[0], loads, 100));
+    });
+  }
+  for (std::thread &thread : threads) thread.join();
+  threads.clear();
+  BOOST_CHECK_EQUAL(loads, 1);
+  BOOST_CHECK_EQUAL(pool.size(), 1);
+  for (const HDD::NLL::GridPtr &grid : grids)
+  {
+    BOOST_CHECK(grid && grid == grids[0]);
+  }
+
+  // a failed load is reported to all the waiting requests and it is not
+  // stored, so the next request tries again
+  loads = 0;
+
+  auto failingLoad = [&loads]() -> HDD::NLL::Grid * {
+    loads++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    throw runtime_error("Cannot load grid");
+  };
+  vector<unsigned> failures(numThreads, 0);
+  for (unsigned t = 0; t < numThreads; t++)
+  {
+    threads.emplace_back([&pool, &failures, &failingLoad, t]() {
+      try
+      {
+        pool.get("test:failing", failingLoad);
+      }
+      catch (runtime_error &e)
+      {
+        failures[t]++;
+      }
+    });
+  }
+  for (std::thread &thread : threads) thread.join();
+  threads.clear();
+  BOOST_CHECK_EQUAL(loads, 1);
+  for (unsigned failed : failures) BOOST_CHECK_EQUAL(failed, 1);
+  BOOST_CHECK_EQUAL(pool.size(), 1);
+  BOOST_CHECK_THROW(pool.get("test:failing", failingLoad), runtime_error);
+  BOOST_CHECK_EQUAL(loads, 2);
+
+  pool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(test_nll_grid_pool_evicted_in_use)
+{
+  HDD::NLL::GridPool &pool = HDD::NLL::GridPool::instance();
+  pool.clear();
+  pool.setLimits(1, 0);
+
+  const HDD::Catalog::Station &station = stationList[0];
+  const double lat                     = station.latitude + 0.05;
+  const double lon                     = station.longitude + 0.1;
+  const double depth                   = 5;
+
+  HDD::TravelTimeTablePtr ttt =
+      HDD::TravelTimeTable::create(tttList[2].type, tttList[2].model);
+  double refTT;
+  BOOST_REQUIRE_NO_THROW(ttt->compute(lat, lon, depth, station, "P", refTT));
+
+  // a grid evicted while in use stays valid until released
+  std::atomic<unsigned> loads(0);
+  HDD::NLL::GridPtr grid =
+      pool.get("test:in_use", timeGridFactory(station, loads));
+  HDD::NLL::TimeGrid *timeGrid = static_cast<HDD::NLL::TimeGrid *>(grid.get());
+  BOOST_CHECK_EQUAL(timeGrid->getTime(lat, lon, depth), refTT);
+  double tt;
+  BOOST_CHECK_NO_THROW(
+      ttt->compute(lat, lon, depth, stationList[1], "P", tt)); // evicts it
+  BOOST_CHECK_EQUAL(pool.size(), 1);
+  pool.clear();
+  BOOST_CHECK_EQUAL(timeGrid->getTime(lat, lon, depth), refTT);
+
+  // the table reloads the evicted grids
+  BOOST_CHECK_NO_THROW(ttt->compute(lat, lon, depth, station, "P", tt));
+  BOOST_CHECK_EQUAL(tt, refTT);
+
+  // tables computing concurrently keep evicting the grids the other threads
+  // are using
+  HDD::TravelTimeTablePtr refTtt =
+      HDD::TravelTimeTable::create(tttList[2].type, tttList[2].model);
+  pool.setLimits(1, 0);
+  checkConcurrentCompute(*ttt, *refTtt);
+
+  pool.clear();
+  pool.setLimits(1000, 0); // defaults
+}
+
+BOOST_AUTO_TEST_CASE(test_ttt_registry)
+{
+  HDD::TravelTimeTableRegistry &registry =
+      HDD::TravelTimeTableRegistry::instance();
+
+  HDD::TravelTimeTablePtr ttt1 = registry.get("LOCSAT", "iasp91", false);
+  HDD::TravelTimeTablePtr ttt2 = registry.get("LOCSAT", "iasp91", false);
+  HDD::TravelTimeTablePtr ttt3 = registry.get("libtau", "iasp91", false);
+  HDD::TravelTimeTablePtr ttt4 = registry.get("LOCSAT", "iasp91", true);
+  BOOST_CHECK(ttt1 == ttt2);
+  BOOST_CHECK(ttt1 != ttt3);
+  BOOST_CHECK(ttt1 != ttt4);
+  BOOST_CHECK_EQUAL(registry.size(), 3);
+
+  // the shared table must give the same results of a private one
+  HDD::TravelTimeTablePtr refTtt =
+      HDD::TravelTimeTable::create("LOCSAT", "iasp91");
+  checkConcurrentCompute(*ttt1, *refTtt);
+
+  // a table is destroyed only when its last user releases it
+  registry.release(ttt1);
+  BOOST_CHECK(!ttt1);
+  BOOST_CHECK_EQUAL(registry.size(), 3);
+  registry.release(ttt2);
+  BOOST_CHECK_EQUAL(registry.size(), 2);
+  registry.release(ttt3);
+  registry.release(ttt4);
+  BOOST_CHECK_EQUAL(registry.size(), 0);
+}
+
+// Timing of the NonLinLoc grid lookups. Disabled by default, run it with
+// --run_test=benchmark_nll_ttt --log_level=message
+BOOST_TEST_DECORATOR(*boost::unit_test::disabled())
+BOOST_DATA_TEST_CASE(benchmark_nll_ttt, bdata::xrange(tttList.size()), idx)
+{
+  if (tttList[idx].type != "NonLinLoc") return;
+
+  HDD::TravelTimeTablePtr ttt =
+      HDD::TravelTimeTable::create(tttList[idx].type, tttList[idx].model);
+
+  computeAll(*ttt); // load the grids
+
+  const unsigned rounds = 50;
+  size_t numCalls       = 0;
+  double checksum       = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned r = 0; r < rounds; r++)
+  {
+    for (const Delta &delta : deltaList)
+    {
+      for (const auto &station : stationList)
+      {
+        const double stationDepth = -(station.elevation / 1000.);
+        for (const string phase : {"P", "S"})
+        {
+          double travelTime;
+          ttt->compute(station.latitude + delta.lat,
+                       station.longitude + delta.lon,
+                       stationDepth + delta.depth, station, phase, travelTime);
+          checksum += travelTime;
+          numCalls++;
+        }
+      }
+    }
+  }
+  auto ttOnlyElapsed = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (unsigned r = 0; r < rounds; r++) computeAll(*ttt);
+  auto fullElapsed = std::chrono::steady_clock::now() - start;
+
+  auto nsPerCall = [&numCalls](std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::nano>(d).count() / numCalls;
+  };
+
+  BOOST_TEST_MESSAGE(stringify(
+      "NLL grids %s: travel time %.0f ns/call, travel time + velocity + "
+      "angles %.0f ns/call (%zu calls, checksum %.3f)",
+      tttList[idx].model.c_str(), nsPerCall(ttOnlyElapsed),
+      nsPerCall(fullElapsed), numCalls, checksum));
+  BOOST_CHECK(std::isfinite(checksum));
+
+  // The grid lookups alone (interpolation included), without the grid
+  // retrieval done by compute() for every call
+  const vector<string> paths =
+      HDD::splitString(tttList[idx].model, std::regex(";"));
+  BOOST_REQUIRE_GE(paths.size(), 3);
+  struct Lookup
+  {
+    HDD::NLL::TimeGridPtr time;
+    HDD::NLL::VelGridPtr vel;
+    HDD::NLL::AngleGridPtr angle;
+    vector<HDD::NLL::Grid::Location> locations;
+  };
+  vector<Lookup> lookups;
+  for (const auto &station : stationList)
+  {
+    const double stationDepth = -(station.elevation / 1000.);
+    for (const string phase : {"P", "S"})
+    {
+      Lookup l;
+      l.time  = new HDD::NLL::TimeGrid(paths[1], station, phase, false);
+      l.vel   = new HDD::NLL::VelGrid(paths[0], station, phase, false);
+      l.angle = new HDD::NLL::AngleGrid(paths[2], station, phase, false);
+      for (const Delta &delta : deltaList)
+      {
+        l.locations.push_back(l.time->toGridLocation(
+            station.latitude + delta.lat, station.longitude + delta.lon,
+            stationDepth + delta.depth));
+      }
+      lookups.push_back(std::move(l));
+    }
+  }
+
+  const unsigned lookupRounds = 1000;
+  numCalls                    = 0;
+  checksum                    = 0;
+  start                       = std::chrono::steady_clock::now();
+  for (unsigned r = 0; r < lookupRounds; r++)
+  {
+    for (Lookup &l : lookups)
+    {
+      for (const HDD::NLL::Grid::Location &loc : l.locations)
+      {
+        checksum += l.time->getTime(loc);
+        numCalls++;
+      }
+    }
+  }
+  auto timeElapsed = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (unsigned r = 0; r < lookupRounds; r++)
+  {
+    for (Lookup &l : lookups)
+    {
+      for (const HDD::NLL::Grid::Location &loc : l.locations)
+        checksum += l.vel->getVel(loc);
+    }
+  }
+  auto velElapsed = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (unsigned r = 0; r < lookupRounds; r++)
+  {
+    for (Lookup &l : lookups)
+    {
+      for (const HDD::NLL::Grid::Location &loc : l.locations)
+      {
+        double azim, dip;
+        l.angle->getAngles(loc, azim, dip);
+        checksum += dip + (std::isfinite(azim) ? azim : 0); // nan for 2D
+      }
+    }
+  }
+  auto angleElapsed = std::chrono::steady_clock::now() - start;
+
+  BOOST_TEST_MESSAGE(stringify(
+      "NLL grids %s: time grid %.1f ns/lookup, velocity grid %.1f ns/lookup, "
+      "angle grid %.1f ns/lookup (%zu lookups, checksum %.3f)",
+      tttList[idx].model.c_str(), nsPerCall(timeElapsed),
+      nsPerCall(velElapsed), nsPerCall(angleElapsed), numCalls, checksum));
+  BOOST_CHECK(std::isfinite(checksum));
+}
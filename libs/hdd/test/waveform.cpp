@@ -5,10 +5,19 @@
 
 #include "waveform.h"
 #include <boost/filesystem.hpp>
+#include <chrono>
 #include <cstring>
+#include <fstream>
+#include <seiscomp3/client/inventory.h>
 #include <seiscomp3/core/genericrecord.h>
 #include <seiscomp3/core/strings.h>
 #include <seiscomp3/core/typedarray.h>
+#include <seiscomp3/datamodel/inventory.h>
+#include <seiscomp3/datamodel/network.h>
+#include <seiscomp3/datamodel/sensorlocation.h>
+#include <seiscomp3/datamodel/station.h>
+#include <seiscomp3/datamodel/stream.h>
+#include <thread>
 
 using namespace std;
 using namespace Seiscomp;
@@ -287,6 +296,577 @@ void testSnrSynthetic(const GenericRecordCPtr &trace)
   BOOST_CHECK(snr < 2);
 }
 
+// Loader returning always the same trace
+class TraceLoader : public HDD::Waveform::Loader
+{
+public:
+  TraceLoader(const GenericRecordCPtr &trace) : Loader(""), _trace(trace) {}
+
+  virtual GenericRecordCPtr get(const Core::TimeWindow &tw,
+                                const HDD::Catalog::Phase &ph,
+                                const HDD::Catalog::Event &ev)
+  {
+    return _trace;
+  }
+
+private:
+  GenericRecordCPtr _trace;
+};
+
+// Loader fetching from a fake RecordStream that returns `trace` (if any)
+DEFINE_SMARTPOINTER(StreamLoader);
+class StreamLoader : public HDD::Waveform::Loader
+{
+public:
+  StreamLoader(const GenericRecordCPtr &trace)
+      : Loader("fake://"), _trace(trace)
+  {}
+
+  unsigned _fetches = 0;
+
+protected:
+  virtual GenericRecordCPtr readWaveform(const Core::TimeWindow &tw,
+                                         const std::string &networkCode,
+                                         const std::string &stationCode,
+                                         const std::string &locationCode,
+                                         const std::string &channelCode)
+  {
+    _fetches++;
+    if (!_trace) throw runtime_error("Data could not be loaded");
+    return _trace;
+  }
+
+private:
+  GenericRecordCPtr _trace;
+};
+
+HDD::Catalog::Phase phaseFromTrace(const GenericRecordCPtr &trace)
+{
+  HDD::Catalog::Phase ph;
+  ph.networkCode  = trace->networkCode();
+  ph.stationCode  = trace->stationCode();
+  ph.locationCode = trace->locationCode();
+  ph.channelCode  = trace->channelCode();
+  ph.time = trace->startTime() + TimeSpan(trace->timeWindow().length() / 2);
+  return ph;
+}
+
+void testUnavailableList(const GenericRecordCPtr &trace)
+{
+  const string unavailableFile = "test_unavailable.csv";
+  const string snrFile         = "test_snr_low.csv";
+  boost::filesystem::remove(unavailableFile);
+  boost::filesystem::remove(snrFile);
+
+  const HDD::Catalog::Phase ph = phaseFromTrace(trace);
+  const Core::TimeWindow tw(ph.time - TimeSpan(0.5), ph.time + TimeSpan(0.5));
+  HDD::Catalog::Event ev;
+
+  // data not available: persisted
+  {
+    StreamLoaderPtr ldr = new StreamLoader(nullptr);
+    ldr->setExclusionList(new HDD::Waveform::ExclusionList(unavailableFile));
+    BOOST_CHECK(!ldr->get(tw, ph, ev, false, "", 0));
+    BOOST_CHECK_EQUAL(ldr->_fetches, 1);
+  }
+  {
+    StreamLoaderPtr ldr = new StreamLoader(trace);
+    HDD::Waveform::ExclusionListPtr list =
+        new HDD::Waveform::ExclusionList(unavailableFile);
+    BOOST_CHECK(list->has(HDD::Waveform::waveformId(ph, tw)));
+    ldr->setExclusionList(list);
+    BOOST_CHECK(!ldr->get(tw, ph, ev, false, "", 0));
+    BOOST_CHECK_EQUAL(ldr->_fetches, 0); // not requested again
+  }
+
+  // entries older than the expiry are requested again
+  {
+    std::ofstream ofs(unavailableFile, std::ios::trunc);
+    ofs << (Core::Time::GMT() - TimeSpan(7200)).iso() << ","
+        << HDD::Waveform::waveformId(ph, tw) << std::endl;
+  }
+  BOOST_CHECK_EQUAL(HDD::Waveform::ExclusionList(unavailableFile).size(), 1);
+  {
+    StreamLoaderPtr ldr = new StreamLoader(trace);
+    HDD::Waveform::ExclusionListPtr list =
+        new HDD::Waveform::ExclusionList(unavailableFile, 3600);
+    BOOST_CHECK_EQUAL(list->size(), 0);
+    ldr->setExclusionList(list);
+    BOOST_CHECK(ldr->get(tw, ph, ev, false, "", 0));
+    BOOST_CHECK_EQUAL(ldr->_fetches, 1);
+  }
+
+  // low SNR: the data is available, so it goes in the SNR list only
+  boost::filesystem::remove(unavailableFile);
+  {
+    StreamLoaderPtr ldr = new StreamLoader(trace);
+    HDD::Waveform::ExclusionListPtr unavailable =
+        new HDD::Waveform::ExclusionList(unavailableFile);
+    HDD::Waveform::ExclusionListPtr snrLow =
+        new HDD::Waveform::ExclusionList(snrFile);
+    ldr->setExclusionList(unavailable);
+    HDD::Waveform::SnrFilteredLoaderPtr snrLdr =
+        new HDD::Waveform::SnrFilteredLoader(ldr, 2, -3, -0.350, -0.350,
+                                             0.350);
+    snrLdr->setExclusionList(snrLow);
+    BOOST_CHECK(!snrLdr->get(tw, ph, ev, false, "", 0));
+    BOOST_CHECK_EQUAL(snrLdr->_counters_wf_snr_low, 1);
+    BOOST_CHECK_EQUAL(unavailable->size(), 0);
+    BOOST_CHECK_EQUAL(snrLow->size(), 1);
+  }
+  BOOST_CHECK_EQUAL(HDD::Waveform::ExclusionList(unavailableFile).size(), 0);
+
+  boost::filesystem::remove(unavailableFile);
+  boost::filesystem::remove(snrFile);
+}
+
+void testCompactMemCache(const GenericRecordCPtr &trace)
+{
+  HDD::Catalog::Phase ph;
+  ph.networkCode  = trace->networkCode();
+  ph.stationCode  = trace->stationCode();
+  ph.locationCode = trace->locationCode();
+  ph.channelCode  = trace->channelCode();
+  ph.time         = trace->startTime();
+  HDD::Catalog::Event ev;
+
+  HDD::Waveform::MemCachedLoaderPtr cache =
+      new HDD::Waveform::MemCachedLoader(new TraceLoader(trace), true);
+
+  GenericRecordCPtr tr1 = cache->get(trace->timeWindow(), ph, ev, false, "", 0);
+  GenericRecordCPtr tr2 = cache->get(trace->timeWindow(), ph, ev, false, "", 0);
+
+  BOOST_CHECK_EQUAL(cache->_counters_wf_cached, 1);
+  BOOST_CHECK_EQUAL(cache->_counters_wf_mem_saved,
+                    trace->data()->size() * (sizeof(double) - sizeof(float)));
+
+  // the first load and the cached ones must return the same data
+  testTracesEqual(tr1, tr2);
+
+  BOOST_REQUIRE_EQUAL(tr1->dataType(), Array::DOUBLE);
+  BOOST_REQUIRE_EQUAL(tr1->data()->size(), trace->data()->size());
+  const double *orig    = DoubleArray::ConstCast(trace->data())->typedData();
+  const double *compact = DoubleArray::ConstCast(tr1->data())->typedData();
+  for (int i = 0; i < trace->data()->size(); i++)
+  {
+    BOOST_CHECK_CLOSE(orig[i], compact[i], 1e-4);
+  }
+}
+
+// 70 sec trace starting 5 sec before a multiple of 10 sec (the strip blocks
+// boundaries in the tests), each sample value is its index
+GenericRecordPtr buildIndexTrace()
+{
+  GenericRecordPtr tr = new GenericRecord(
+      "N1", "ST1", "", "EHZ", Core::Time(2020, 1, 1, 0, 0, 0) - TimeSpan(5),
+      100, 10, Array::DOUBLE);
+  DoubleArray *samples = new DoubleArray(tr->samplingFrequency() * 70);
+  for (int i = 0; i < samples->size(); i++) samples->set(i, i);
+  tr->setData(samples);
+  return tr;
+}
+
+// Check that `slice` is the `tw` portion of a trace built by buildIndexTrace
+void checkIndexTraceSlice(const GenericRecordCPtr &slice,
+                          const GenericRecordCPtr &source,
+                          const Core::TimeWindow &tw)
+{
+  BOOST_REQUIRE(slice);
+  BOOST_REQUIRE_EQUAL(slice->dataType(), Array::DOUBLE);
+  const double samplingInterval = 1. / source->samplingFrequency();
+  BOOST_CHECK_SMALL(double(slice->startTime() - tw.startTime()),
+                    samplingInterval);
+  BOOST_CHECK_SMALL(double(slice->endTime() - tw.endTime()),
+                    samplingInterval);
+
+  const double *data = DoubleArray::ConstCast(slice->data())->typedData();
+  const int size     = slice->data()->size();
+  BOOST_REQUIRE(size > 0);
+  const double firstIndex =
+      double(slice->startTime() - source->startTime()) *
+      source->samplingFrequency();
+  BOOST_CHECK_SMALL(data[0] - firstIndex, 1e-3);
+  bool contiguous = true;
+  for (int i = 1; i < size; i++) contiguous &= (data[i] == data[0] + i);
+  BOOST_CHECK(contiguous);
+}
+
+// StripCachedLoader fetching the blocks from `trace` instead of from a
+// RecordStream. The trace is split in 0.7 sec records, so that some of them
+// cross the block boundaries. The records overlapping [gapStart, gapEnd] are
+// not available
+DEFINE_SMARTPOINTER(TraceStripLoader);
+class TraceStripLoader : public HDD::Waveform::StripCachedLoader
+{
+public:
+  TraceStripLoader(const GenericRecordCPtr &trace,
+                   double blockLen,
+                   unsigned maxBlocks,
+                   double incompleteBlockRetry = 300)
+      : StripCachedLoader("fake://", blockLen, maxBlocks, incompleteBlockRetry)
+  {
+    const int recordLen = trace->samplingFrequency() * 0.7;
+    const double *data  = DoubleArray::ConstCast(trace->data())->typedData();
+    for (int start = 0; start < trace->data()->size(); start += recordLen)
+    {
+      const int len = std::min(recordLen, trace->data()->size() - start);
+      GenericRecordPtr rec = new GenericRecord(
+          trace->networkCode(), trace->stationCode(), trace->locationCode(),
+          trace->channelCode(),
+          trace->startTime() + TimeSpan(start / trace->samplingFrequency()),
+          trace->samplingFrequency(), trace->timingQuality(), Array::DOUBLE);
+      rec->setData(new DoubleArray(len, data + start));
+      _records.push_back(rec);
+    }
+  }
+
+  Core::Time gapStart, gapEnd;
+  std::vector<Core::TimeWindow> _fetches;
+
+protected:
+  virtual std::shared_ptr<TimeWindowBuffer>
+  fetchBlock(const Core::TimeWindow &blockTw,
+             const std::string &networkCode,
+             const std::string &stationCode,
+             const std::string &locationCode,
+             const std::string &channelCode)
+  {
+    _fetches.push_back(blockTw);
+    std::shared_ptr<TimeWindowBuffer> seq(
+        new TimeWindowBuffer(blockTw, _tolerance));
+    for (const GenericRecordCPtr &rec : _records)
+    {
+      if (gapStart.valid() && rec->endTime() > gapStart &&
+          rec->startTime() < gapEnd)
+        continue;
+      seq->feed(rec.get());
+    }
+    return seq;
+  }
+
+private:
+  std::vector<GenericRecordCPtr> _records;
+};
+
+void testStripCache()
+{
+  const GenericRecordCPtr trace = buildIndexTrace();
+  const Core::Time t0           = trace->startTime() + TimeSpan(5);
+  const HDD::Catalog::Phase ph  = phaseFromTrace(trace);
+  HDD::Catalog::Event ev;
+
+  auto window = [&t0](double start, double end) {
+    return Core::TimeWindow(t0 + TimeSpan(start), t0 + TimeSpan(end));
+  };
+
+  // the blocks are aligned to multiples of the block length and a window
+  // across a block boundary is extracted from both blocks
+  TraceStripLoaderPtr ldr = new TraceStripLoader(trace, 10, 0);
+  Core::TimeWindow tw     = window(8, 13);
+  checkIndexTraceSlice(ldr->get(tw, ph, ev), trace, tw);
+  BOOST_REQUIRE_EQUAL(ldr->_fetches.size(), 2);
+  BOOST_CHECK(ldr->_fetches[0] == window(0, 10));
+  BOOST_CHECK(ldr->_fetches[1] == window(10, 20));
+  BOOST_CHECK_EQUAL(ldr->_counters_wf_downloaded, 2);
+
+  // windows within the cached blocks are extracted without fetching
+  for (const Core::TimeWindow &cachedTw :
+       {window(1, 3), window(9.5, 10.5), window(0.5, 19.5),
+        window(12.34, 19.9)})
+  {
+    checkIndexTraceSlice(ldr->get(cachedTw, ph, ev), trace, cachedTw);
+  }
+  BOOST_CHECK_EQUAL(ldr->_fetches.size(), 2);
+  BOOST_CHECK_EQUAL(ldr->_counters_wf_downloaded, 2);
+
+  // a different block length, the alignment doesn't depend on the request
+  ldr = new TraceStripLoader(trace, 4, 0);
+  tw  = window(5, 13);
+  checkIndexTraceSlice(ldr->get(tw, ph, ev), trace, tw);
+  BOOST_REQUIRE_EQUAL(ldr->_fetches.size(), 3);
+  BOOST_CHECK(ldr->_fetches[0] == window(4, 8));
+  BOOST_CHECK(ldr->_fetches[1] == window(8, 12));
+  BOOST_CHECK(ldr->_fetches[2] == window(12, 16));
+}
+
+void testStripCacheIncompleteBlocks()
+{
+  const GenericRecordCPtr trace = buildIndexTrace();
+  const Core::Time t0           = trace->startTime() + TimeSpan(5);
+  const HDD::Catalog::Phase ph  = phaseFromTrace(trace);
+  HDD::Catalog::Event ev;
+
+  auto window = [&t0](double start, double end) {
+    return Core::TimeWindow(t0 + TimeSpan(start), t0 + TimeSpan(end));
+  };
+
+  // block [30, 40] misses some data (availability < 99.9%) but the
+  // requested windows are available
+  const Core::TimeWindow tw = window(35, 37);
+
+  // before the retry time the incomplete block is reused
+  TraceStripLoaderPtr ldr = new TraceStripLoader(trace, 10, 0, 300);
+  ldr->gapStart           = t0 + TimeSpan(32);
+  ldr->gapEnd             = t0 + TimeSpan(33);
+  checkIndexTraceSlice(ldr->get(tw, ph, ev), trace, tw);
+  checkIndexTraceSlice(ldr->get(tw, ph, ev), trace, tw);
+  BOOST_CHECK_EQUAL(ldr->_fetches.size(), 1);
+  BOOST_CHECK(!ldr->get(window(31, 34), ph, ev)); // not enough data
+  BOOST_CHECK_EQUAL(ldr->_fetches.size(), 1);
+
+  // after the retry time the incomplete block is fetched again, while the
+  // complete ones never expire
+  ldr           = new TraceStripLoader(trace, 10, 0, 0);
+  ldr->gapStart = t0 + TimeSpan(32);
+  ldr->gapEnd   = t0 + TimeSpan(33);
+  checkIndexTraceSlice(ldr->get(tw, ph, ev), trace, tw);
+  checkIndexTraceSlice(ldr->get(window(15, 17), ph, ev), trace,
+                       window(15, 17));
+  BOOST_CHECK_EQUAL(ldr->_fetches.size(), 2);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  checkIndexTraceSlice(ldr->get(tw, ph, ev), trace, tw);
+  checkIndexTraceSlice(ldr->get(window(15, 17), ph, ev), trace,
+                       window(15, 17));
+  BOOST_REQUIRE_EQUAL(ldr->_fetches.size(), 3);
+  BOOST_CHECK(ldr->_fetches[2] == window(30, 40));
+
+  // the data became available in the meantime
+  ldr->gapStart = Core::Time();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  checkIndexTraceSlice(ldr->get(window(31, 34), ph, ev), trace,
+                       window(31, 34));
+  BOOST_CHECK_EQUAL(ldr->_fetches.size(), 4);
+  // now it is complete and doesn't expire anymore
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  checkIndexTraceSlice(ldr->get(tw, ph, ev), trace, tw);
+  BOOST_CHECK_EQUAL(ldr->_fetches.size(), 4);
+}
+
+void testStripCacheEviction()
+{
+  const GenericRecordCPtr trace = buildIndexTrace();
+  const Core::Time t0           = trace->startTime() + TimeSpan(5);
+  const HDD::Catalog::Phase ph  = phaseFromTrace(trace);
+  HDD::Catalog::Event ev;
+
+  auto blockWindow = [&t0](int idx) {
+    return Core::TimeWindow(t0 + TimeSpan(idx * 10 + 2),
+                            t0 + TimeSpan(idx * 10 + 5));
+  };
+
+  TraceStripLoaderPtr ldr = new TraceStripLoader(trace, 10, 2);
+
+  // number of blocks fetched to return a window within block `idx`
+  auto fetches = [&ldr, &ph, &ev, &trace, &blockWindow](int idx) {
+    const size_t before = ldr->_fetches.size();
+    checkIndexTraceSlice(ldr->get(blockWindow(idx), ph, ev), trace,
+                         blockWindow(idx));
+    return ldr->_fetches.size() - before;
+  };
+
+  BOOST_CHECK_EQUAL(fetches(1), 1);
+  BOOST_CHECK_EQUAL(fetches(2), 1);
+  BOOST_CHECK_EQUAL(fetches(1), 0);
+  // the oldest fetched block is dropped, even if it was used recently
+  BOOST_CHECK_EQUAL(fetches(3), 1); // drops 1
+  BOOST_CHECK_EQUAL(fetches(2), 0);
+  BOOST_CHECK_EQUAL(fetches(3), 0);
+  BOOST_CHECK_EQUAL(fetches(1), 1); // drops 2
+  BOOST_CHECK_EQUAL(fetches(3), 0);
+  BOOST_CHECK_EQUAL(fetches(2), 1); // drops 3
+  BOOST_CHECK_EQUAL(fetches(1), 0);
+  BOOST_CHECK_EQUAL(fetches(3), 1); // drops 1
+  BOOST_CHECK_EQUAL(ldr->_counters_wf_downloaded, 6);
+
+  // an expired block that is fetched again goes to the back of the queue
+  ldr           = new TraceStripLoader(trace, 10, 2, 0);
+  ldr->gapStart = t0 + TimeSpan(18);
+  ldr->gapEnd   = t0 + TimeSpan(19);
+  BOOST_CHECK_EQUAL(fetches(1), 1); // incomplete
+  BOOST_CHECK_EQUAL(fetches(2), 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  BOOST_CHECK_EQUAL(fetches(1), 1); // expired: 2 is the oldest now
+  BOOST_CHECK_EQUAL(fetches(3), 1); // drops 2
+  BOOST_CHECK_EQUAL(fetches(2), 1);
+}
+
+// Inventory with the `trace` station, whose sensor location has a stream
+// for each of `orientations` (Z, N, E, R or T, the latter two oriented as N
+// and E) with the `trace` band and instrument codes
+DataModel::InventoryPtr buildInventory(const GenericRecordCPtr &trace,
+                                       const vector<string> &orientations)
+{
+  const Core::Time start(1970, 1, 1, 0, 0, 0);
+
+  DataModel::InventoryPtr inv = new DataModel::Inventory();
+  DataModel::NetworkPtr net   = DataModel::Network::Create();
+  net->setCode(trace->networkCode());
+  net->setStart(start);
+  inv->add(net.get());
+
+  DataModel::StationPtr sta = DataModel::Station::Create();
+  sta->setCode(trace->stationCode());
+  sta->setStart(start);
+  sta->setLatitude(46.5);
+  sta->setLongitude(8.5);
+  sta->setElevation(500);
+  net->add(sta.get());
+
+  DataModel::SensorLocationPtr loc = DataModel::SensorLocation::Create();
+  loc->setCode(trace->locationCode());
+  loc->setStart(start);
+  loc->setLatitude(46.5);
+  loc->setLongitude(8.5);
+  loc->setElevation(500);
+  sta->add(loc.get());
+
+  const string channelCodeRoot =
+      HDD::Waveform::getBandAndInstrumentCodes(trace->channelCode());
+  for (const string &orientation : orientations)
+  {
+    DataModel::StreamPtr stream = DataModel::Stream::Create();
+    stream->setCode(channelCodeRoot + orientation);
+    stream->setStart(start);
+    stream->setAzimuth(orientation == "E" || orientation == "T" ? 90 : 0);
+    stream->setDip(orientation == "Z" ? -90 : 0);
+    loc->add(stream.get());
+  }
+  return inv;
+}
+
+// Loader fetching from a fake RecordStream the components of a sensor, each
+// one a differently scaled copy of `trace`
+DEFINE_SMARTPOINTER(ComponentsLoader);
+class ComponentsLoader : public HDD::Waveform::Loader
+{
+public:
+  ComponentsLoader(const GenericRecordCPtr &trace)
+      : Loader("fake://"), _trace(trace)
+  {}
+
+  unsigned _fetches = 0;
+
+protected:
+  virtual GenericRecordCPtr readWaveform(const Core::TimeWindow &tw,
+                                         const std::string &networkCode,
+                                         const std::string &stationCode,
+                                         const std::string &locationCode,
+                                         const std::string &channelCode)
+  {
+    _fetches++;
+    const string orientation =
+        HDD::Waveform::getOrientationCode(channelCode);
+    GenericRecordPtr tr = alterTrace(_trace, 0, 0, 0,
+                                     orientation == "Z"   ? 1
+                                     : orientation == "N" ? 2
+                                                          : -3);
+    tr->setChannelCode(channelCode);
+    return tr;
+  }
+
+private:
+  GenericRecordCPtr _trace;
+};
+
+void testProjectionCache(const GenericRecordCPtr &trace)
+{
+  Client::Inventory::Instance()->setInventory(
+      buildInventory(trace, {"Z", "N", "E"}).get());
+
+  HDD::Catalog::Phase ph = phaseFromTrace(trace);
+  ph.channelCode =
+      HDD::Waveform::getBandAndInstrumentCodes(trace->channelCode()) + "R";
+  const Core::TimeWindow tw(trace->startTime() + TimeSpan(0.5),
+                            trace->endTime() - TimeSpan(0.5));
+
+  // events at different back azimuths, each one gives a different projection
+  vector<HDD::Catalog::Event> events(3);
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    events[i].latitude  = 46.5 + 0.1 * std::cos(i * 2.);
+    events[i].longitude = 8.5 + 0.1 * std::sin(i * 2.);
+  }
+
+  // same trace from the cache and from an uncached load
+  ComponentsLoaderPtr aux = new ComponentsLoader(trace);
+  HDD::Waveform::ProjectionCachedLoaderPtr ldr =
+      new HDD::Waveform::ProjectionCachedLoader(aux, 2);
+  GenericRecordCPtr tr1 = ldr->get(tw, ph, events[0]);
+  GenericRecordCPtr tr2 = ldr->get(tw, ph, events[0]);
+  BOOST_CHECK_EQUAL(ldr->_counters_wf_cached, 1);
+  BOOST_CHECK_EQUAL(aux->_fetches, 3); // Z, N, E
+  GenericRecordCPtr uncached =
+      ComponentsLoaderPtr(new ComponentsLoader(trace))->get(tw, ph, events[0]);
+  testTracesEqual(tr1, uncached);
+  testTracesEqual(tr2, uncached);
+  BOOST_CHECK(tr1->channelCode() == ph.channelCode);
+
+  // the projection depends on the event location
+  testTracesEqual(ldr->get(tw, ph, events[1]),
+                  ComponentsLoaderPtr(new ComponentsLoader(trace))
+                      ->get(tw, ph, events[1]));
+  BOOST_CHECK_EQUAL(ldr->_counters_wf_cached, 1);
+  BOOST_CHECK_EQUAL(aux->_fetches, 6);
+
+  // the least recently used trace is evicted when the cap is reached
+  ldr->get(tw, ph, events[0]); // events[1] is the least recently used now
+  BOOST_CHECK_EQUAL(ldr->_counters_wf_cached, 2);
+  ldr->get(tw, ph, events[2]);
+  BOOST_CHECK_EQUAL(aux->_fetches, 9);
+  ldr->get(tw, ph, events[0]);
+  ldr->get(tw, ph, events[2]);
+  BOOST_CHECK_EQUAL(ldr->_counters_wf_cached, 4);
+  BOOST_CHECK_EQUAL(aux->_fetches, 9);
+  testTracesEqual(ldr->get(tw, ph, events[1]),
+                  ComponentsLoaderPtr(new ComponentsLoader(trace))
+                      ->get(tw, ph, events[1]));
+  BOOST_CHECK_EQUAL(ldr->_counters_wf_cached, 4);
+  BOOST_CHECK_EQUAL(aux->_fetches, 12);
+
+  // traces that don't need a projection are not cached
+  ph.channelCode = trace->channelCode();
+  ldr->get(tw, ph, events[0]);
+  ldr->get(tw, ph, events[0]);
+  BOOST_CHECK_EQUAL(ldr->_counters_wf_cached, 4);
+  BOOST_CHECK_EQUAL(aux->_fetches, 14);
+
+  Client::Inventory::Instance()->setInventory(nullptr);
+}
+
+void testSensorOrientationCache(const GenericRecordCPtr &trace)
+{
+  HDD::Catalog::Phase ph = phaseFromTrace(trace);
+  ph.channelCode =
+      HDD::Waveform::getBandAndInstrumentCodes(trace->channelCode()) + "R";
+  const Core::TimeWindow tw(trace->startTime(), trace->endTime());
+  HDD::Catalog::Event ev;
+  DataModel::ThreeComponents tc;
+  DataModel::SensorLocation *loc;
+
+  DataModel::InventoryPtr inv = buildInventory(trace, {"Z", "N", "E"});
+  Client::Inventory::Instance()->setInventory(inv.get());
+  BOOST_CHECK(HDD::Waveform::projectionRequired(tw, ph, ev, tc, loc));
+  BOOST_REQUIRE(loc);
+  BOOST_CHECK(loc == inv->network(0)->station(0)->sensorLocation(0));
+
+  // a new inventory where the sensor records the R component directly: the
+  // cached orientation must not be used anymore
+  inv = buildInventory(trace, {"Z", "R", "T"});
+  Client::Inventory::Instance()->setInventory(inv.get());
+  BOOST_CHECK(!HDD::Waveform::projectionRequired(tw, ph, ev, tc, loc));
+  BOOST_CHECK(loc == inv->network(0)->station(0)->sensorLocation(0));
+
+  // and back to three components
+  inv = buildInventory(trace, {"Z", "N", "E"});
+  Client::Inventory::Instance()->setInventory(inv.get());
+  BOOST_CHECK(HDD::Waveform::projectionRequired(tw, ph, ev, tc, loc));
+  BOOST_CHECK(loc == inv->network(0)->station(0)->sensorLocation(0));
+
+  // no inventory at all
+  Client::Inventory::Instance()->setInventory(nullptr);
+  BOOST_CHECK(!HDD::Waveform::projectionRequired(tw, ph, ev, tc, loc));
+}
+
 vector<GenericRecordCPtr> realTraces = {
     HDD::Waveform::readTrace("./data/waveform/xcorr1.mseed"),
     HDD::Waveform::readTrace("./data/waveform/xcorr2.mseed"),
@@ -430,3 +1010,39 @@ BOOST_DATA_TEST_CASE(test_snr_synthetic3, bdata::make(synthetic3Traces), trace)
 {
   testSnrSynthetic(trace);
 }
+
+BOOST_DATA_TEST_CASE(test_compact_mem_cache1, bdata::make(realTraces), trace)
+{
+  testCompactMemCache(trace);
+}
+
+BOOST_DATA_TEST_CASE(test_compact_mem_cache2,
+                     bdata::make(synthetic1Traces),
+                     trace)
+{
+  testCompactMemCache(trace);
+}
+
+BOOST_DATA_TEST_CASE(test_unavailable_list, bdata::make(badSnrTraces), trace)
+{
+  testUnavailableList(trace);
+}
+
+BOOST_AUTO_TEST_CASE(test_strip_cache) { testStripCache(); }
+
+BOOST_AUTO_TEST_CASE(test_strip_cache_incomplete_blocks)
+{
+  testStripCacheIncompleteBlocks();
+}
+
+BOOST_AUTO_TEST_CASE(test_strip_cache_eviction) { testStripCacheEviction(); }
+
+BOOST_DATA_TEST_CASE(test_projection_cache, bdata::make(realTraces), trace)
+{
+  testProjectionCache(trace);
+}
+
+BOOST_AUTO_TEST_CASE(test_sensor_orientation_cache)
+{
+  testSensorOrientationCache(buildSyntheticTrace1(100));
+}
@@ -21,6 +21,7 @@
 
 #include <seiscomp3/core/strings.h>
 #include <seiscomp3/math/math.h>
+#include <cmath>
 #include <sstream>
 #include <stdexcept>
 
@@ -56,6 +57,78 @@ TravelTimeTable *TravelTimeTable::create(const std::string &type,
   return ttt;
 }
 
+void TravelTimeTable::computeBatch(
+    double eventLat,
+    double eventLon,
+    double eventDepth,
+    const std::vector<const Catalog::Station *> &stations,
+    const std::vector<std::string> &phaseTypes,
+    std::vector<double> &travelTimes,
+    std::vector<double> &takeOffAngleAzims,
+    std::vector<double> &takeOffAngleDips,
+    std::vector<double> &velocitiesAtSrc,
+    std::vector<std::string> &errors)
+{
+  resizeBatchOutputs(stations.size(), travelTimes, takeOffAngleAzims,
+                     takeOffAngleDips, velocitiesAtSrc, errors);
+
+  for (size_t i = 0; i < stations.size(); i++)
+  {
+    try
+    {
+      compute(eventLat, eventLon, eventDepth, *stations[i], phaseTypes[i],
+              travelTimes[i], takeOffAngleAzims[i], takeOffAngleDips[i],
+              velocitiesAtSrc[i]);
+    }
+    catch (exception &e)
+    {
+      travelTimes[i] = std::nan("");
+      errors[i]      = e.what();
+    }
+  }
+}
+
+void TravelTimeTable::computeBatch(
+    double eventLat,
+    double eventLon,
+    double eventDepth,
+    const std::vector<const Catalog::Station *> &stations,
+    const std::vector<std::string> &phaseTypes,
+    std::vector<double> &travelTimes,
+    std::vector<std::string> &errors)
+{
+  travelTimes.assign(stations.size(), std::nan(""));
+  errors.assign(stations.size(), "");
+
+  for (size_t i = 0; i < stations.size(); i++)
+  {
+    try
+    {
+      compute(eventLat, eventLon, eventDepth, *stations[i], phaseTypes[i],
+              travelTimes[i]);
+    }
+    catch (exception &e)
+    {
+      travelTimes[i] = std::nan("");
+      errors[i]      = e.what();
+    }
+  }
+}
+
+void TravelTimeTable::resizeBatchOutputs(size_t size,
+                                         std::vector<double> &travelTimes,
+                                         std::vector<double> &takeOffAngleAzims,
+                                         std::vector<double> &takeOffAngleDips,
+                                         std::vector<double> &velocitiesAtSrc,
+                                         std::vector<std::string> &errors)
+{
+  travelTimes.assign(size, std::nan(""));
+  takeOffAngleAzims.assign(size, std::nan(""));
+  takeOffAngleDips.assign(size, std::nan(""));
+  velocitiesAtSrc.assign(size, std::nan(""));
+  errors.assign(size, "");
+}
+
 void TravelTimeTable::computeApproximatedTakeOfAngles(
     double eventLat,
     double eventLon,
@@ -87,5 +160,121 @@ void TravelTimeTable::computeApproximatedTakeOfAngles(
   }
 }
 
+bool TravelTimeMemo::get(const std::string &key,
+                         const Catalog::Event &event,
+                         double &travelTime,
+                         double &takeOfAngleAzim,
+                         double &takeOfAngleDip,
+                         double &velocityAtSrc)
+{
+  auto it = _values.find(key);
+  if (it == _values.end())
+  {
+    recomputes++;
+    return false;
+  }
+  const Value &v = it->second;
+
+  double azimuth;
+  double hDist = computeDistance(v.latitude, v.longitude, event.latitude,
+                                 event.longitude, &azimuth);
+  double vDist = event.depth - v.depth;
+  if (std::sqrt(square(hDist) + square(vDist)) > maxMovement)
+  {
+    recomputes++;
+    return false;
+  }
+
+  travelTime      = v.travelTime;
+  takeOfAngleAzim = v.takeOfAngleAzim;
+  takeOfAngleDip  = v.takeOfAngleDip;
+  velocityAtSrc   = v.velocityAtSrc;
+
+  if (firstOrderCorrection && hDist + std::abs(vDist) > 0)
+  {
+    // same derivatives used by the solver (see Solver::prepareDDSystem)
+    const double dip      = v.takeOfAngleDip - deg2rad(90);
+    const double azi      = v.takeOfAngleAzim - deg2rad(180);
+    const double slowness = 1. / v.velocityAtSrc;
+    const double dx       = slowness * std::cos(dip) * std::sin(azi);
+    const double dy       = slowness * std::cos(dip) * std::cos(azi);
+    const double dz       = slowness * std::sin(dip);
+    travelTime += dx * hDist * std::sin(deg2rad(azimuth)) +
+                  dy * hDist * std::cos(deg2rad(azimuth)) + dz * vDist;
+  }
+  hits++;
+  return true;
+}
+
+void TravelTimeMemo::set(const std::string &key,
+                         const Catalog::Event &event,
+                         double travelTime,
+                         double takeOfAngleAzim,
+                         double takeOfAngleDip,
+                         double velocityAtSrc)
+{
+  _values[key] = Value{event.latitude,  event.longitude, event.depth,
+                       travelTime,      takeOfAngleAzim, takeOfAngleDip,
+                       velocityAtSrc};
+}
+
+TravelTimeTableRegistry &TravelTimeTableRegistry::instance()
+{
+  static TravelTimeTableRegistry registry;
+  return registry;
+}
+
+TravelTimeTablePtr TravelTimeTableRegistry::get(const std::string &type,
+                                                const std::string &model,
+                                                bool lookupTable)
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+
+  const string key = type + "|" + model + (lookupTable ? "|lookupTable" : "");
+  auto it          = _tables.find(key);
+  if (it != _tables.end()) return it->second;
+
+  TravelTimeTablePtr ttt = TravelTimeTable::create(type, model);
+
+  if (lookupTable)
+  {
+    ScTravelTimeTable *scttt = dynamic_cast<ScTravelTimeTable *>(ttt.get());
+    if (scttt)
+    {
+      scttt->enableLookupTable(ScTravelTimeTable::LookupTableOptions());
+    }
+    else
+    {
+      SEISCOMP_WARNING("Travel time lookup table not supported by %s",
+                       type.c_str());
+    }
+  }
+
+  _tables[key] = ttt;
+  return ttt;
+}
+
+void TravelTimeTableRegistry::release(TravelTimeTablePtr &ttt)
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+
+  ttt = nullptr;
+
+  // the registry holds the last reference of the unused tables
+  for (auto it = _tables.begin(); it != _tables.end();)
+  {
+    if (it->second->referenceCount() == 1)
+      it = _tables.erase(it);
+    else
+      ++it;
+  }
+}
+
+size_t TravelTimeTableRegistry::size() const
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  return _tables.size();
+}
+
 } // namespace HDD
 } // namespace Seiscomp
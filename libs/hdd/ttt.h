@@ -22,6 +22,10 @@
 #include <seiscomp3/core/baseobject.h>
 #include <seiscomp3/seismology/ttt.h>
 
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 namespace Seiscomp {
 namespace HDD {
 
@@ -82,6 +86,75 @@ public:
                    phaseType, travelTime);
   }
 
+  /*
+   * Batch version of compute(): one source against a list of station/phase
+   * pairs (`stations` and `phaseTypes` have the same size). The output
+   * vectors are resized to the number of pairs. When a pair cannot be
+   * computed its travel time is NaN and the corresponding `errors` entry
+   * contains the reason (the entry is empty otherwise).
+   *
+   * The default implementation calls compute() for each pair, subclasses
+   * override it to share the work that depends on the source only.
+   */
+  virtual void
+  computeBatch(double eventLat,
+               double eventLon,
+               double eventDepth,
+               const std::vector<const Catalog::Station *> &stations,
+               const std::vector<std::string> &phaseTypes,
+               std::vector<double> &travelTimes,
+               std::vector<double> &takeOffAngleAzims,
+               std::vector<double> &takeOffAngleDips,
+               std::vector<double> &velocitiesAtSrc,
+               std::vector<std::string> &errors);
+
+  void computeBatch(const Catalog::Event &event,
+                    const std::vector<const Catalog::Station *> &stations,
+                    const std::vector<std::string> &phaseTypes,
+                    std::vector<double> &travelTimes,
+                    std::vector<double> &takeOffAngleAzims,
+                    std::vector<double> &takeOffAngleDips,
+                    std::vector<double> &velocitiesAtSrc,
+                    std::vector<std::string> &errors)
+  {
+    return computeBatch(event.latitude, event.longitude, event.depth,
+                        stations, phaseTypes, travelTimes, takeOffAngleAzims,
+                        takeOffAngleDips, velocitiesAtSrc, errors);
+  }
+
+  /*
+   * Sometimes only travel times are required (save computation)
+   */
+  virtual void
+  computeBatch(double eventLat,
+               double eventLon,
+               double eventDepth,
+               const std::vector<const Catalog::Station *> &stations,
+               const std::vector<std::string> &phaseTypes,
+               std::vector<double> &travelTimes,
+               std::vector<std::string> &errors);
+
+  void computeBatch(const Catalog::Event &event,
+                    const std::vector<const Catalog::Station *> &stations,
+                    const std::vector<std::string> &phaseTypes,
+                    std::vector<double> &travelTimes,
+                    std::vector<std::string> &errors)
+  {
+    return computeBatch(event.latitude, event.longitude, event.depth,
+                        stations, phaseTypes, travelTimes, errors);
+  }
+
+  /*
+   * Files the travel times of `station`/`phaseType` are read from, if any.
+   * Used to detect changes of the tables (e.g. to invalidate values computed
+   * from them and stored on disk)
+   */
+  virtual std::vector<std::string>
+  dataFiles(const Catalog::Station &station, const std::string &phaseType)
+  {
+    return {};
+  }
+
   const std::string type;
   const std::string model;
 
@@ -100,12 +173,93 @@ protected:
                                   double *takeOffAngleAzim = nullptr,
                                   double *takeOffAngleDip  = nullptr);
 
+  // resize the computeBatch() outputs to `size` entries (NaN/empty)
+  static void resizeBatchOutputs(size_t size,
+                                 std::vector<double> &travelTimes,
+                                 std::vector<double> &takeOffAngleAzims,
+                                 std::vector<double> &takeOffAngleDips,
+                                 std::vector<double> &velocitiesAtSrc,
+                                 std::vector<std::string> &errors);
+
   TravelTimeTable(const std::string &t, const std::string &m)
       : type(t), model(m)
   {}
   virtual ~TravelTimeTable() {}
 };
 
+/*
+ * Travel time parameters computed at a given event location, reused while the
+ * event stays within `maxMovement` km of that location (e.g. across the
+ * solver iterations). The stored location is not updated on reuse, so the
+ * approximation error doesn't accumulate over many small movements. With
+ * `firstOrderCorrection` the travel time is corrected for the movement with
+ * the derivatives used by the solver.
+ */
+class TravelTimeMemo
+{
+public:
+  TravelTimeMemo(double maxMovement, bool firstOrderCorrection)
+      : maxMovement(maxMovement), firstOrderCorrection(firstOrderCorrection)
+  {}
+
+  // Return true and set the parameters if the event didn't move more than
+  // `maxMovement` since `key` was stored
+  bool get(const std::string &key,
+           const Catalog::Event &event,
+           double &travelTime,
+           double &takeOfAngleAzim,
+           double &takeOfAngleDip,
+           double &velocityAtSrc);
+  void set(const std::string &key,
+           const Catalog::Event &event,
+           double travelTime,
+           double takeOfAngleAzim,
+           double takeOfAngleDip,
+           double velocityAtSrc);
+
+  const double maxMovement; // km
+  const bool firstOrderCorrection;
+  unsigned hits       = 0;
+  unsigned recomputes = 0;
+
+private:
+  struct Value
+  {
+    double latitude, longitude, depth;
+    double travelTime, takeOfAngleAzim, takeOfAngleDip, velocityAtSrc;
+  };
+  std::unordered_map<std::string, Value> _values;
+};
+
+/*
+ * Process-wide registry of travel time tables. Users of the same type/model
+ * (e.g. multiple profiles) share the same instance, which is safe for
+ * concurrent compute() calls. A table is destroyed when the last user
+ * releases it.
+ */
+class TravelTimeTableRegistry
+{
+public:
+  static TravelTimeTableRegistry &instance();
+
+  // Return the table for `type`/`model`, creating it if not already in use.
+  // `lookupTable` enables the ScTravelTimeTable lookup table (ignored by the
+  // other types)
+  TravelTimeTablePtr
+  get(const std::string &type, const std::string &model, bool lookupTable);
+
+  // Reset `ttt` and destroy the tables that are no longer used
+  void release(TravelTimeTablePtr &ttt);
+
+  size_t size() const;
+
+private:
+  TravelTimeTableRegistry() = default;
+
+  std::unordered_map<std::string, TravelTimeTablePtr> _tables;
+  mutable std::mutex _mtx;
+};
+
 } // namespace HDD
 } // namespace Seiscomp
 
@@ -18,12 +18,14 @@
 #include "sccatalog.h"
 #include "utils.h"
 
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/math/constants/constants.hpp>
 #include <cfenv>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <seiscomp3/client/inventory.h>
 #include <seiscomp3/core/datetime.h>
@@ -71,6 +73,168 @@ string waveformDebugPath(const string &wfDebugDir,
   return (boost::filesystem::path(wfDebugDir) / debugFile).string();
 }
 
+/*
+ * Parsing a filter string and building the corresponding SeisComP filter is
+ * not free and Waveform::filter is called for every processed trace. Keep a
+ * compiled prototype per (filter string, sampling frequency) and hand out
+ * clones of it: cloning copies the already parsed filter chain.
+ */
+class FilterFactory
+{
+public:
+  using Filter    = Math::Filtering::InPlaceFilter<double>;
+  using FilterPtr = std::unique_ptr<Filter>;
+
+  static FilterPtr create(const string &filterStr, double samplingFrequency)
+  {
+    static FilterFactory instance;
+    return instance.get(filterStr, samplingFrequency);
+  }
+
+private:
+  FilterPtr get(const string &filterStr, double samplingFrequency)
+  {
+    const string key =
+        stringify("%s@%.6f", filterStr.c_str(), samplingFrequency);
+    lock_guard<mutex> lock(_mtx);
+    auto it = _prototypes.find(key);
+    if (it == _prototypes.end())
+    {
+      string filterError;
+      FilterPtr prototype(Filter::Create(filterStr, &filterError));
+      if (!prototype)
+      {
+        string msg = stringify("Filter creation failed %s: %s",
+                               filterStr.c_str(), filterError.c_str());
+        throw runtime_error(msg);
+      }
+      prototype->setSamplingFrequency(samplingFrequency);
+      it = _prototypes.emplace(key, std::move(prototype)).first;
+    }
+    // the clone is guaranteed to start from a clean state, but some filter
+    // implementations don't copy the sampling frequency, so set it again
+    FilterPtr filter(it->second->clone());
+    filter->setSamplingFrequency(samplingFrequency);
+    return filter;
+  }
+
+  std::unordered_map<string, FilterPtr> _prototypes;
+  std::mutex _mtx;
+};
+
+/*
+ * Memoize the inventory lookups required to know the sensor orientation of a
+ * stream: walking the inventory for every waveform fetch is expensive and the
+ * result only changes at epoch boundaries. An entry is valid within the
+ * intersection of the sensor location and the three components epochs.
+ * The entries keep a reference to the inventory objects they point to, so
+ * that those stay valid, and the cache is cleared whenever the inventory
+ * instance is replaced.
+ */
+class SensorOrientationCache
+{
+public:
+  struct Entry
+  {
+    Core::Time validFrom;
+    Core::Time validUntil; // not valid() -> open epoch
+    DataModel::SensorLocation *loc;
+    ThreeComponents tc;
+    bool hasThreeComponents;
+    // keep alive the objects pointed to by `loc` and `tc`
+    DataModel::SensorLocationPtr locRef;
+    DataModel::StreamPtr compsRef[3];
+  };
+
+  static bool lookup(const string &networkCode,
+                     const string &stationCode,
+                     const string &locationCode,
+                     const string &channelCodeRoot,
+                     const Core::Time &atTime,
+                     Entry &entry)
+  {
+    static SensorOrientationCache instance;
+    return instance.get(networkCode, stationCode, locationCode,
+                        channelCodeRoot, atTime, entry);
+  }
+
+private:
+  bool get(const string &networkCode,
+           const string &stationCode,
+           const string &locationCode,
+           const string &channelCodeRoot,
+           const Core::Time &atTime,
+           Entry &entry)
+  {
+    const string key = networkCode + "." + stationCode + "." + locationCode +
+                       "." + channelCodeRoot;
+
+    lock_guard<mutex> lock(_mtx);
+
+    DataModel::Inventory *inv = Client::Inventory::Instance()->inventory();
+    if (inv != _inventory.get())
+    {
+      _entries.clear();
+      _inventory = inv;
+    }
+
+    for (auto it = _entries.find(key);
+         it != _entries.end() && it->first == key; ++it)
+    {
+      const Entry &e = it->second;
+      if (atTime >= e.validFrom &&
+          (!e.validUntil.valid() || atTime < e.validUntil))
+      {
+        entry = e;
+        return true;
+      }
+    }
+
+    DataModel::SensorLocation *loc = HDD::ScCatalog::findSensorLocation(
+        networkCode, stationCode, locationCode, atTime);
+    if (!loc) return false;
+
+    entry.loc    = loc;
+    entry.locRef = loc;
+    entry.tc     = ThreeComponents();
+    entry.hasThreeComponents =
+        getThreeComponents(entry.tc, loc, channelCodeRoot.c_str(), atTime);
+    for (int i = 0; i < 3; i++) entry.compsRef[i] = entry.tc.comps[i];
+
+    entry.validFrom  = loc->start();
+    entry.validUntil = Core::Time();
+    restrictValidity(entry, loc->start(), [loc]() { return loc->end(); });
+    for (DataModel::Stream *comp : entry.tc.comps)
+    {
+      if (!comp) continue;
+      restrictValidity(entry, comp->start(), [comp]() { return comp->end(); });
+    }
+
+    _entries.emplace(key, entry);
+    return true;
+  }
+
+  template <class EndGetter>
+  static void
+  restrictValidity(Entry &entry, const Core::Time &start, EndGetter getEnd)
+  {
+    if (start > entry.validFrom) entry.validFrom = start;
+    try
+    {
+      // end is optional and throws when not set, i.e. open epoch
+      const Core::Time end = getEnd();
+      if (!entry.validUntil.valid() || end < entry.validUntil)
+        entry.validUntil = end;
+    }
+    catch (...)
+    {}
+  }
+
+  std::unordered_multimap<string, Entry> _entries;
+  DataModel::InventoryPtr _inventory; // the entries were built from this
+  std::mutex _mtx;
+};
+
 } // namespace
 
 namespace Seiscomp {
@@ -206,26 +370,25 @@ void filter(GenericRecord &trace,
 {
   DoubleArray *data = DoubleArray::Cast(trace.data());
 
-  if (demeaning)
+  if (demeaning || !filterStr.empty())
   {
-    *data -= data->mean();
-    trace.dataUpdated();
-  }
+    // Demeaning and filtering (including any taper, which is part of the
+    // filter string) work in place on the same sample array: do them back
+    // to back and notify the record only once
+    if (demeaning)
+    {
+      const double mean = data->mean();
+      double *samples   = data->typedData();
+      const int size    = data->size();
+      for (int i = 0; i < size; i++) samples[i] -= mean;
+    }
 
-  if (!filterStr.empty())
-  {
-    string filterError;
-    auto filter =
-        Math::Filtering::InPlaceFilter<double>::Create(filterStr, &filterError);
-    if (!filter)
+    if (!filterStr.empty())
     {
-      string msg = stringify("Filter creation failed %s: %s", filterStr.c_str(),
-                             filterError.c_str());
-      throw runtime_error(msg);
+      auto filter = FilterFactory::create(filterStr, trace.samplingFrequency());
+      filter->apply(data->size(), data->typedData());
     }
-    filter->setSamplingFrequency(trace.samplingFrequency());
-    filter->apply(data->size(), data->typedData());
-    delete filter;
+
     trace.dataUpdated();
   }
 
@@ -631,13 +794,15 @@ bool projectionRequired(const Core::TimeWindow &tw,
     return false;
   }
 
-  loc = ScCatalog::findSensorLocation(ph.networkCode, ph.stationCode,
-                                      ph.locationCode, tw.startTime());
-
-  if (loc)
+  loc = nullptr;
+  SensorOrientationCache::Entry sensor;
+  if (SensorOrientationCache::lookup(ph.networkCode, ph.stationCode,
+                                     ph.locationCode, channelCodeRoot,
+                                     tw.startTime(), sensor))
   {
-    bool hasThreeComponents =
-        getThreeComponents(tc, loc, channelCodeRoot.c_str(), tw.startTime());
+    loc                     = sensor.loc;
+    tc                      = sensor.tc;
+    bool hasThreeComponents = sensor.hasThreeComponents;
 
     if ((tc.comps[ThreeComponents::Vertical] &&
          (tc.comps[ThreeComponents::Vertical]->code() == ph.channelCode)) ||
@@ -825,6 +990,45 @@ GenericRecordPtr projectWaveform(const Core::TimeWindow &tw,
   return trace;
 }
 
+ExclusionList::ExclusionList(const std::string &file, double expiry)
+    : _file(file)
+{
+  if (!Util::fileExists(_file)) return;
+
+  // file format: one "insertion time,waveform id" entry per line
+  const Core::Time now = Core::Time::GMT();
+  vector<string> kept;
+  std::ifstream ifs(_file);
+  string line;
+  while (getline(ifs, line))
+  {
+    const size_t sep = line.find(',');
+    if (sep == string::npos) continue;
+    Core::Time inserted;
+    if (!inserted.fromString(line.substr(0, sep).c_str(), "%FT%T.%fZ"))
+      continue;
+    if (expiry > 0 && (now - inserted) > Core::TimeSpan(expiry)) continue;
+    if (_ids.insert(line.substr(sep + 1)).second) kept.push_back(line);
+  }
+  ifs.close();
+
+  // drop the expired entries from the file too
+  std::ofstream ofs(_file, std::ios::trunc);
+  for (const string &entry : kept) ofs << entry << std::endl;
+}
+
+void ExclusionList::add(const std::string &wfId)
+{
+  if (!_ids.insert(wfId).second) return;
+  std::ofstream ofs(_file, std::ios::app);
+  if (!ofs)
+  {
+    SEISCOMP_WARNING("Cannot write to %s", _file.c_str());
+    return;
+  }
+  ofs << Core::Time::GMT().iso() << "," << wfId << std::endl;
+}
+
 GenericRecordCPtr Loader::get(const Core::TimeWindow &tw,
                               const Catalog::Phase &ph,
                               const Catalog::Event &ev)
@@ -833,6 +1037,11 @@ GenericRecordCPtr Loader::get(const Core::TimeWindow &tw,
 
   if (!_recordStreamURL.empty())
   {
+    if (_unavailableList && _unavailableList->has(waveformId(ph, tw)))
+    {
+      return nullptr;
+    }
+
     DataModel::ThreeComponents tc;
     DataModel::SensorLocation *loc;
     bool projection = projectionRequired(tw, ph, ev, tc, loc);
@@ -840,10 +1049,8 @@ GenericRecordCPtr Loader::get(const Core::TimeWindow &tw,
     {
       try
       {
-        trace = readWaveformFromRecordStream(
-            _recordStreamURL, tw, ph.networkCode, ph.stationCode,
-            ph.locationCode, ph.channelCode, _tolerance, _minAvailability);
-        _counters_wf_downloaded++;
+        trace = readWaveform(tw, ph.networkCode, ph.stationCode,
+                             ph.locationCode, ph.channelCode);
       }
       catch (exception &e)
       {
@@ -855,11 +1062,8 @@ GenericRecordCPtr Loader::get(const Core::TimeWindow &tw,
       // If the waveform is not available, possibly a projection 123->ZNE
       // or ZNE->ZRT is required.
       auto loadWaveform = [this, &tw, &ph](const string &channelCode) {
-        GenericRecordCPtr trace = readWaveformFromRecordStream(
-            _recordStreamURL, tw, ph.networkCode, ph.stationCode,
-            ph.locationCode, channelCode, _tolerance, _minAvailability);
-        _counters_wf_downloaded++;
-        return trace;
+        return readWaveform(tw, ph.networkCode, ph.stationCode,
+                            ph.locationCode, channelCode);
       };
       try
       {
@@ -877,6 +1081,8 @@ GenericRecordCPtr Loader::get(const Core::TimeWindow &tw,
         SEISCOMP_DEBUG("%s", e.what());
       }
     }
+
+    if (!trace && _unavailableList) _unavailableList->add(waveformId(ph, tw));
   }
 
   if (!trace) _counters_wf_no_avail++;
@@ -896,6 +1102,19 @@ GenericRecordCPtr Loader::get(const Core::TimeWindow &tw,
   return trace;
 }
 
+GenericRecordCPtr Loader::readWaveform(const Core::TimeWindow &tw,
+                                       const std::string &networkCode,
+                                       const std::string &stationCode,
+                                       const std::string &locationCode,
+                                       const std::string &channelCode)
+{
+  GenericRecordCPtr trace = readWaveformFromRecordStream(
+      _recordStreamURL, tw, networkCode, stationCode, locationCode,
+      channelCode, _tolerance, _minAvailability);
+  _counters_wf_downloaded++;
+  return trace;
+}
+
 GenericRecordPtr Loader::process(const GenericRecordCPtr &trace,
                                  bool demeaning,
                                  const std::string &filterStr,
@@ -914,6 +1133,130 @@ GenericRecordPtr Loader::process(const GenericRecordCPtr &trace,
   }
 }
 
+GenericRecordCPtr
+StripCachedLoader::readWaveform(const Core::TimeWindow &tw,
+                                const std::string &networkCode,
+                                const std::string &stationCode,
+                                const std::string &locationCode,
+                                const std::string &channelCode)
+{
+  const long firstBlock = std::floor(double(tw.startTime()) / _blockLen);
+  const long lastBlock  = std::floor(double(tw.endTime()) / _blockLen);
+
+  TimeWindowBuffer seq(tw, _tolerance);
+  Core::Time coveredUntil;
+  for (long blockIdx = firstBlock; blockIdx <= lastBlock; blockIdx++)
+  {
+    Block block = getBlock(blockIdx, networkCode, stationCode, locationCode,
+                           channelCode);
+    for (const RecordCPtr &rec : *block)
+    {
+      // records crossing a block boundary are returned by both blocks
+      if (coveredUntil.valid() && rec->endTime() <= coveredUntil) continue;
+      if (seq.feed(rec.get())) coveredUntil = rec->endTime();
+    }
+  }
+
+  GenericRecordPtr trace =
+      contiguousRecord(seq, tw, _tolerance, _minAvailability);
+  if (!trace)
+  {
+    string msg =
+        stringify("Cannnot load trace, data availability %.2f%%"
+                  "(stream %s.%s.%s.%s from %s length %.2f sec)",
+                  seq.availability(), networkCode.c_str(), stationCode.c_str(),
+                  locationCode.c_str(), channelCode.c_str(),
+                  tw.startTime().iso().c_str(), tw.length());
+    throw runtime_error(msg);
+  }
+  return trace;
+}
+
+StripCachedLoader::Block
+StripCachedLoader::getBlock(long blockIdx,
+                            const std::string &networkCode,
+                            const std::string &stationCode,
+                            const std::string &locationCode,
+                            const std::string &channelCode)
+{
+  const string key =
+      stringify("%s.%s.%s.%s.%ld", networkCode.c_str(), stationCode.c_str(),
+                locationCode.c_str(), channelCode.c_str(), blockIdx);
+
+  const auto it = _blocks.find(key);
+  if (it != _blocks.end())
+  {
+    const CachedBlock &cached = it->second;
+    if (!cached.expiry.valid() || Core::Time::GMT() < cached.expiry)
+      return cached.data;
+    // incomplete block whose retry time has come: fetch it again
+    _blocks.erase(it);
+    _blocksOrder.erase(
+        std::find(_blocksOrder.begin(), _blocksOrder.end(), key));
+  }
+
+  const Core::Time blockStart =
+      Core::Time(0, 0) + Core::TimeSpan(blockIdx * _blockLen);
+  const Core::TimeWindow blockTw(blockStart,
+                                 blockStart + Core::TimeSpan(_blockLen));
+
+  std::shared_ptr<TimeWindowBuffer> seq = fetchBlock(
+      blockTw, networkCode, stationCode, locationCode, channelCode);
+  _counters_wf_downloaded++;
+
+  SEISCOMP_DEBUG("Fetched strip %s (%s length %.2f sec) availability %.2f%%",
+                 key.c_str(), blockStart.iso().c_str(), _blockLen,
+                 seq->availability());
+
+  // A block with missing data is stored too, so that it is not requested
+  // again for every pick, but only until its retry time
+  CachedBlock cached;
+  cached.data = seq;
+  if (seq->availability() < _completeBlockAvailability)
+    cached.expiry = Core::Time::GMT() + Core::TimeSpan(_incompleteBlockRetry);
+
+  if (_maxBlocks > 0)
+  {
+    while (_blocksOrder.size() >= _maxBlocks)
+    {
+      _blocks.erase(_blocksOrder.front());
+      _blocksOrder.pop_front();
+    }
+  }
+  _blocks.emplace(key, cached);
+  _blocksOrder.push_back(key);
+  return seq;
+}
+
+std::shared_ptr<TimeWindowBuffer>
+StripCachedLoader::fetchBlock(const Core::TimeWindow &blockTw,
+                              const std::string &networkCode,
+                              const std::string &stationCode,
+                              const std::string &locationCode,
+                              const std::string &channelCode)
+{
+  IO::RecordStreamPtr rs = IO::RecordStream::Open(_recordStreamURL.c_str());
+  if (rs == nullptr)
+  {
+    string msg = "Cannot open RecordStream: " + _recordStreamURL;
+    throw runtime_error(msg);
+  }
+
+  rs->setTimeWindow(blockTw);
+  rs->addStream(networkCode, stationCode, locationCode, channelCode);
+
+  std::shared_ptr<TimeWindowBuffer> seq(
+      new TimeWindowBuffer(blockTw, _tolerance));
+  IO::RecordInput inp(rs.get(), Array::DOUBLE, Record::DATA_ONLY);
+  RecordPtr rec;
+  while (rec = inp.next())
+  {
+    seq->feed(rec.get());
+  }
+  rs->close();
+  return seq;
+}
+
 GenericRecordCPtr DiskCachedLoader::get(const Core::TimeWindow &tw,
                                         const Catalog::Phase &ph,
                                         const Catalog::Event &ev)
@@ -976,6 +1319,41 @@ GenericRecordCPtr DiskCachedLoader::get(const Core::TimeWindow &tw,
   return trace;
 }
 
+GenericRecordCPtr ProjectionCachedLoader::get(const Core::TimeWindow &tw,
+                                              const Catalog::Phase &ph,
+                                              const Catalog::Event &ev)
+{
+  DataModel::ThreeComponents tc;
+  DataModel::SensorLocation *loc;
+  if (!projectionRequired(tw, ph, ev, tc, loc))
+  {
+    return _auxLdr->get(tw, ph, ev);
+  }
+
+  const string wfId = stringify("%s.%.6f.%.6f", waveformId(ph, tw).c_str(),
+                                ev.latitude, ev.longitude);
+  const auto it = _index.find(wfId);
+  if (it != _index.end())
+  {
+    _counters_wf_cached++;
+    _waveforms.splice(_waveforms.begin(), _waveforms, it->second);
+    return it->second->second;
+  }
+
+  GenericRecordCPtr trace = _auxLdr->get(tw, ph, ev);
+  if (trace)
+  {
+    while (_maxTraces > 0 && _waveforms.size() >= _maxTraces)
+    {
+      _index.erase(_waveforms.back().first);
+      _waveforms.pop_back();
+    }
+    _waveforms.emplace_front(wfId, trace);
+    _index.emplace(wfId, _waveforms.begin());
+  }
+  return trace;
+}
+
 GenericRecordCPtr MemCachedLoader::get(const Core::TimeWindow &tw,
                                        const Catalog::Phase &ph,
                                        const Catalog::Event &ev,
@@ -1002,6 +1380,13 @@ GenericRecordCPtr MemCachedLoader::get(const Core::TimeWindow &tw,
     storeInCache(tw, ph.networkCode, ph.stationCode, ph.locationCode,
                  ph.channelCode, trace);
 
+    // return the same (reduced precision) data of the next cache hits
+    if (_compact)
+    {
+      trace = getFromCache(tw, ph.networkCode, ph.stationCode,
+                           ph.locationCode, ph.channelCode);
+    }
+
     // Dump waveforms when loaded the first time for debugging
     if (!_wfDebugDir.empty())
     {
@@ -1080,7 +1465,14 @@ GenericRecordCPtr MemCachedLoader::getFromCache(const Core::TimeWindow &tw,
   const string wfId =
       waveformId(tw, networkCode, stationCode, locationCode, channelCode);
   const auto it = _waveforms.find(wfId);
-  return it != _waveforms.end() ? it->second : nullptr;
+  if (it == _waveforms.end()) return nullptr;
+  if (!_compact) return it->second;
+
+  const GenericRecordCPtr &stored = it->second;
+  GenericRecordPtr trace(
+      new GenericRecord(static_cast<const Record &>(*stored)));
+  trace->setData(stored->data()->copy(Array::DOUBLE));
+  return trace;
 }
 
 void MemCachedLoader::storeInCache(const Core::TimeWindow &tw,
@@ -1092,7 +1484,20 @@ void MemCachedLoader::storeInCache(const Core::TimeWindow &tw,
 {
   const string wfId =
       waveformId(tw, networkCode, stationCode, locationCode, channelCode);
-  _waveforms[wfId] = trace;
+  if (!_compact || trace->data()->dataType() != Array::DOUBLE)
+  {
+    _waveforms[wfId] = trace;
+    return;
+  }
+
+  // GenericRecord(const Record&) copies the header only
+  GenericRecordPtr stored(
+      new GenericRecord(static_cast<const Record &>(*trace)));
+  stored->setData(trace->data()->copy(Array::FLOAT));
+  _counters_wf_mem_saved += trace->data()->size() *
+                            (trace->data()->elementSize() -
+                             stored->data()->elementSize());
+  _waveforms[wfId] = stored;
 }
 
 Core::TimeWindow
@@ -1170,7 +1575,8 @@ GenericRecordCPtr SnrFilteredLoader::get(const Core::TimeWindow &tw,
   const string wfId = waveformId(ph, tw);
 
   // Check if we have already excluded the trace's SNR.
-  if (_snrExcludedWfs.count(wfId) != 0)
+  if (_snrExcludedWfs.count(wfId) != 0 ||
+      (_snrExcludedList && _snrExcludedList->has(wfId)))
   {
     return nullptr;
   }
@@ -1187,6 +1593,7 @@ GenericRecordCPtr SnrFilteredLoader::get(const Core::TimeWindow &tw,
     if (!goodSnr(trace, ph.time))
     {
       _snrExcludedWfs.insert(wfId);
+      if (_snrExcludedList) _snrExcludedList->add(wfId);
       SEISCOMP_DEBUG("Trace has too low SNR(%s)", string(ph).c_str());
       // Dump SNR low traces (debugging).
       if (!_wfDebugDir.empty())
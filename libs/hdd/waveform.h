@@ -25,6 +25,9 @@
 #include <seiscomp3/datamodel/utils.h>
 #include <seiscomp3/io/recordstream.h>
 
+#include <deque>
+#include <list>
+#include <memory>
 #include <stdexcept>
 #include <unordered_map>
 #include <unordered_set>
@@ -109,6 +112,33 @@ std::string waveformId(const Core::TimeWindow &tw,
 std::string waveformId(const HDD::Catalog::Phase &ph,
                        const Core::TimeWindow &tw);
 
+DEFINE_SMARTPOINTER(ExclusionList);
+
+/*
+ * Set of waveform ids backed by a file, used to remember across restarts the
+ * waveforms that shouldn't be requested again (e.g. not available or with a
+ * too low SNR). Every insertion is appended to the file straight away.
+ * Entries older than `expiry` seconds are dropped when the file is loaded,
+ * which is useful for data that might become available later on (0 -> the
+ * entries never expire).
+ */
+class ExclusionList : public Core::BaseObject
+{
+public:
+  ExclusionList(const std::string &file, double expiry = 0);
+
+  virtual ~ExclusionList() {}
+
+  bool has(const std::string &wfId) const { return _ids.count(wfId) != 0; }
+  void add(const std::string &wfId);
+
+  size_t size() const { return _ids.size(); }
+
+private:
+  const std::string _file;
+  std::unordered_set<std::string> _ids;
+};
+
 DEFINE_SMARTPOINTER(Loader);
 
 class Loader : public Core::BaseObject
@@ -136,6 +166,14 @@ public:
     _wfDebugDir = directory;
   }
 
+  // optionally persist the waveforms whose data couldn't be fetched, so that
+  // they are not requested again. Only the data availability is recorded
+  // here, not the verdicts of the processing (e.g. SNR)
+  void setExclusionList(const ExclusionListPtr &unavailable)
+  {
+    _unavailableList = unavailable;
+  }
+
   unsigned _counters_wf_no_avail   = 0;
   unsigned _counters_wf_downloaded = 0;
 
@@ -145,8 +183,16 @@ protected:
                            const std::string &filterStr,
                            double resampleFreq);
 
+  // fetch a single stream from the RecordStream (throws on failure)
+  virtual GenericRecordCPtr readWaveform(const Core::TimeWindow &tw,
+                                         const std::string &networkCode,
+                                         const std::string &stationCode,
+                                         const std::string &locationCode,
+                                         const std::string &channelCode);
+
   const std::string _recordStreamURL;
   std::string _wfDebugDir;
+  ExclusionListPtr _unavailableList;
 
   static constexpr double _tolerance       = 0.1;
   static constexpr double _minAvailability = 0.95;
@@ -170,6 +216,75 @@ protected:
   LoaderPtr _auxLdr;
 };
 
+DEFINE_SMARTPOINTER(StripCachedLoader);
+
+/*
+ * Same as Loader, but instead of fetching from the RecordStream the exact
+ * time window requested, it fetches continuous blocks of `blockLen` seconds
+ * per stream (aligned to multiples of `blockLen`), keeps them in memory and
+ * returns slices of them. When many events occur close in time at the same
+ * stations (e.g. aftershock sequences), this issues a single RecordStream
+ * request per stream block instead of one per pick.
+ * At most `maxBlocks` blocks are kept in memory, the oldest fetched ones are
+ * dropped first. Blocks not fully covered by data (e.g. data not yet
+ * available or a temporary RecordStream failure) are reused only for
+ * `incompleteBlockRetry` seconds, then fetched again.
+ */
+class StripCachedLoader : public Loader
+{
+public:
+  StripCachedLoader(const std::string &recordStream,
+                    double blockLen,
+                    unsigned maxBlocks,
+                    double incompleteBlockRetry = 300)
+      : Loader(recordStream), _blockLen(blockLen), _maxBlocks(maxBlocks),
+        _incompleteBlockRetry(incompleteBlockRetry)
+  {
+    if (_blockLen <= 0)
+      throw std::runtime_error("Strip cache block length must be positive");
+  }
+
+  virtual ~StripCachedLoader() {}
+
+protected:
+  virtual GenericRecordCPtr readWaveform(const Core::TimeWindow &tw,
+                                         const std::string &networkCode,
+                                         const std::string &stationCode,
+                                         const std::string &locationCode,
+                                         const std::string &channelCode);
+
+  using Block = std::shared_ptr<const RecordSequence>;
+
+  Block getBlock(long blockIdx,
+                 const std::string &networkCode,
+                 const std::string &stationCode,
+                 const std::string &locationCode,
+                 const std::string &channelCode);
+
+  // fetch the data of `blockTw` from the RecordStream (throws on failure)
+  virtual std::shared_ptr<TimeWindowBuffer>
+  fetchBlock(const Core::TimeWindow &blockTw,
+             const std::string &networkCode,
+             const std::string &stationCode,
+             const std::string &locationCode,
+             const std::string &channelCode);
+
+  const double _blockLen; // secs
+  const unsigned _maxBlocks;
+  const double _incompleteBlockRetry; // secs
+
+  // availability (%) above which a block is considered complete
+  static constexpr double _completeBlockAvailability = 99.9;
+
+  struct CachedBlock
+  {
+    Block data;
+    Core::Time expiry; // invalid for complete blocks, which never expire
+  };
+  std::unordered_map<std::string, CachedBlock> _blocks;
+  std::deque<std::string> _blocksOrder; // fetch order, for eviction
+};
+
 DEFINE_SMARTPOINTER(DiskCachedLoader);
 
 class DiskCachedLoader : public CompositeLoader
@@ -217,10 +332,18 @@ protected:
 
 DEFINE_SMARTPOINTER(MemCachedLoader);
 
+/*
+ * In `compact` mode the cached traces are stored with single precision
+ * samples, which halves the memory footprint of the cache. The samples are
+ * converted back to double precision when a trace is returned (the precision
+ * loss is negligible for cross-correlation purposes).
+ */
 class MemCachedLoader : public CompositeLoader
 {
 public:
-  MemCachedLoader(LoaderPtr auxLdr) : CompositeLoader(auxLdr) {}
+  MemCachedLoader(LoaderPtr auxLdr, bool compact = false)
+      : CompositeLoader(auxLdr), _compact(compact)
+  {}
 
   virtual ~MemCachedLoader() {}
 
@@ -243,6 +366,7 @@ public:
                 const Catalog::Event &ev);
 
   unsigned _counters_wf_cached = 0;
+  size_t _counters_wf_mem_saved = 0; // bytes saved by compact mode
 
 protected:
   virtual GenericRecordCPtr getFromCache(const Core::TimeWindow &tw,
@@ -258,9 +382,44 @@ protected:
                             const std::string &channelCode,
                             const GenericRecordCPtr &trace);
 
+  const bool _compact;
   std::unordered_map<std::string, GenericRecordCPtr> _waveforms;
 };
 
+DEFINE_SMARTPOINTER(ProjectionCachedLoader);
+
+/*
+ * Keep in memory the (unprocessed) traces that required a projection of the
+ * three components (e.g. ZNE->ZRT), so that the rotation is not recomputed
+ * when the same trace is requested again (e.g. with a different processing).
+ * The rotation depends on the event location, so the cache is by event
+ * location too. Traces that don't require a projection are not cached.
+ * At most `maxTraces` traces are kept, the least recently used ones are
+ * dropped first.
+ */
+class ProjectionCachedLoader : public CompositeLoader
+{
+public:
+  ProjectionCachedLoader(LoaderPtr auxLdr, unsigned maxTraces = 10000)
+      : CompositeLoader(auxLdr), _maxTraces(maxTraces)
+  {}
+
+  virtual ~ProjectionCachedLoader() {}
+
+  virtual GenericRecordCPtr get(const Core::TimeWindow &tw,
+                                const Catalog::Phase &ph,
+                                const Catalog::Event &ev);
+
+  unsigned _counters_wf_cached = 0;
+
+protected:
+  const unsigned _maxTraces;
+
+  // most recently used first
+  std::list<std::pair<std::string, GenericRecordCPtr>> _waveforms;
+  std::unordered_map<std::string, decltype(_waveforms)::iterator> _index;
+};
+
 DEFINE_SMARTPOINTER(ExtraLenLoader);
 
 class ExtraLenLoader : public CompositeLoader
@@ -326,6 +485,13 @@ public:
   bool goodSnr(const GenericRecordCPtr &trace,
                const Core::Time &pickTime) const;
 
+  // optionally persist the low SNR verdicts (the list must be specific to
+  // the SNR and filter configuration in use)
+  void setExclusionList(const ExclusionListPtr &excluded)
+  {
+    _snrExcludedList = excluded;
+  }
+
   unsigned _counters_wf_snr_low = 0;
 
 protected:
@@ -340,6 +506,7 @@ protected:
 
   std::unordered_set<std::string> _snrGoodWfs;
   std::unordered_set<std::string> _snrExcludedWfs;
+  ExclusionListPtr _snrExcludedList;
 };
 
 DEFINE_SMARTPOINTER(BatchLoader);